@@ -42,36 +42,172 @@
 #include <dlfcn.h>
 #include <string.h>
 
-// Functions being interposed on include H5Fopen, H5Dread, and H5Oopen.
+// Functions being interposed on include H5Fopen, H5Fclose, H5Dread, H5Oopen, and the attribute reads and iterations.
 herr_t (*original_H5Dread)(hid_t, hid_t, hid_t, hid_t, hid_t, void*);
 hid_t (*original_H5Fopen)(const char *, unsigned, hid_t);
+herr_t (*original_H5Fclose)(hid_t);
 hid_t (*original_H5Oopen)(hid_t, const char *, hid_t);
 int (*original_nc_open)(const char *path, int omode, int *ncidp);
 void (*original_H5_term_library)(void);
+herr_t (*original_H5Aread)(hid_t, hid_t, void *);
+herr_t (*original_H5Aiterate2)(hid_t, H5_index_t, H5_iter_order_t, hsize_t *, H5A_operator2_t, void *);
+herr_t (*original_H5Aiterate_by_name)(hid_t, const char *, H5_index_t, H5_iter_order_t, hsize_t *, H5A_operator2_t, void *, hid_t);
 
 // Global variables to be used across function calls
 char *use_carved;
 hid_t src_file_id;
 hid_t dest_file_id;
-hid_t original_file_id;
 char *is_netcdf4; // TODO: replace with an robust automatic check i.e. some kind of byte encoding 
 char **files_opened;
 int files_opened_current_size;
 FILE *log_ptr;
 char *DEBUG;
-H5R_ref_t created_reference_objects[2048];
-int current_index;
+int flush_interval;
+char *carved_directory;
+bool is_repeat_mode;
+bool is_passthrough_mode;
+bool is_partial_carving_mode;
+hsize_t partial_carving_block_size;
+size_t chunk_buffer_size;
+bool is_async_carving_mode;
+bool is_deferred_carving_mode;
+bool is_tracing_mode;
+bool is_lazy_skeleton_mode;
+bool is_skeleton_completed_at_exit;
+bool is_skeleton_template_mode;
+bool is_skeleton_storage_deferred;
+hsize_t carved_file_page_size;
+bool is_free_space_persistent;
+hsize_t core_file_size_limit;
+bool is_direct_read_mode;
+int promotion_threshold;
+bool is_copying_all_attributes;
+carved_file_handle **file_handle_pool;
+int file_handle_pool_current_size;
+
+// Set for the whole process once the library terminates, so that attributes read while the carved files are finished are not recorded.
+// The carving code reads attributes through the original functions, which are never recorded.
+static bool is_attribute_recording_suspended;
 
-int nc_open(const char *path, int omode, int *ncidp) {
+/*
+	Runs once when the shared library is loaded.
+	Resolves the configuration from the environment and the original functions being interposed on, 
+	so that the hooks do not repeat getenv and dlsym calls on every invocation.
+*/
+__attribute__((constructor))
+static void initialize_carving_context(void) {
 	DEBUG = getenv("DEBUG");
 
 	if (DEBUG) {
-		if (log_ptr == NULL) {
-			log_ptr = fopen("log", "w");
-		}
+		log_ptr = fopen("log", "w");
 	}
 
+	// Fetch USE_CARVED and NETCDF4 environment variables
+	use_carved = getenv("USE_CARVED");
+	is_netcdf4 = getenv("NETCDF4");
+	is_repeat_mode = use_carved != NULL && strcmp(use_carved, "true") == 0;
+
+	// Directory of carved files. If not set, carved files are created next to the original files.
+	carved_directory = getenv("CARVED_DIRECTORY");
+
+	// In pass-through mode the hooks only forward to the original functions
+	char *passthrough_env = getenv("CARVE_PASSTHROUGH");
+	is_passthrough_mode = passthrough_env != NULL && strcmp(passthrough_env, "true") == 0;
+
+	// In partial carving mode only the blocks of a dataset overlapping the selections read are carved
+	char *partial_env = getenv("CARVE_PARTIAL");
+	is_partial_carving_mode = partial_env != NULL && strcmp(partial_env, "true") == 0;
+
+	// Target size in bytes of the blocks tracked for contiguous datasets in partial carving mode
+	char *partial_block_size_env = getenv("CARVE_PARTIAL_BLOCK_SIZE");
+	partial_carving_block_size = partial_block_size_env == NULL ? 1024 * 1024 : strtoull(partial_block_size_env, NULL, 10);
+
+	// Upper bound in bytes of the buffer used to copy raw chunks
+	char *chunk_buffer_size_env = getenv("CARVE_CHUNK_BUFFER_SIZE");
+	chunk_buffer_size = chunk_buffer_size_env == NULL ? 64 * 1024 * 1024 : strtoull(chunk_buffer_size_env, NULL, 10);
+
+	// In asynchronous mode a worker thread carves the datasets read, so H5Dread returns without waiting for the copy
+	char *async_env = getenv("CARVE_ASYNC");
+	is_async_carving_mode = async_env != NULL && strcmp(async_env, "true") == 0;
+
+	// In deferred mode reads are only recorded, and the carved files are built in one batch when the library terminates
+	char *deferred_env = getenv("CARVE_DEFERRED");
+	is_deferred_carving_mode = deferred_env != NULL && strcmp(deferred_env, "true") == 0;
+
+	// In tracing mode reads are appended to an access trace, and the carved files are built later by h5carve_materialize
+	char *trace_env = getenv("CARVE_TRACE");
+	is_tracing_mode = trace_env != NULL && open_carve_trace(trace_env);
+
+	// In lazy skeleton mode objects are added to the skeleton when they are first accessed. With "complete", the rest of the skeleton is built when the library terminates.
+	char *lazy_skeleton_env = getenv("CARVE_LAZY_SKELETON");
+	is_skeleton_completed_at_exit = lazy_skeleton_env != NULL && strcmp(lazy_skeleton_env, "complete") == 0;
+	is_lazy_skeleton_mode = is_skeleton_completed_at_exit || (lazy_skeleton_env != NULL && strcmp(lazy_skeleton_env, "true") == 0);
+
+	// Skeletons are cloned from templates cached under CARVED_DIRECTORY by the structure of the original file
+	char *skeleton_templates_env = getenv("CARVE_SKELETON_TEMPLATES");
+	is_skeleton_template_mode = skeleton_templates_env != NULL && strcmp(skeleton_templates_env, "true") == 0;
+
+	// Skeleton datasets allocate no storage and write no fill values until they are carved
+	char *skeleton_no_alloc_env = getenv("CARVE_SKELETON_NO_ALLOC");
+	is_skeleton_storage_deferred = skeleton_no_alloc_env != NULL && strcmp(skeleton_no_alloc_env, "true") == 0;
+
+	// Carved files allocate their space in pages of this many bytes, read through a page buffer
+	char *page_size_env = getenv("CARVE_PAGE_SIZE");
+	carved_file_page_size = page_size_env == NULL ? 0 : strtoull(page_size_env, NULL, 10);
+
+	// Carved files keep track of their free space across sessions, so space freed by carving in one run is reused by the next
+	char *persist_free_space_env = getenv("CARVE_PERSIST_FREE_SPACE");
+	is_free_space_persistent = persist_free_space_env != NULL && strcmp(persist_free_space_env, "true") == 0;
+
+	// In repeat mode, carved files up to this many bytes are read into memory when opened
+	char *core_size_env = getenv("CARVE_CORE_SIZE");
+	core_file_size_limit = core_size_env == NULL ? 0 : strtoull(core_size_env, NULL, 10);
+
+	// Carved files get a sidecar index of their contiguous datasets, which repeat mode reads without the library
+	char *direct_read_env = getenv("CARVE_DIRECT_READ");
+	is_direct_read_mode = direct_read_env != NULL && strcmp(direct_read_env, "true") == 0;
+
+	// In repeat mode datasets opened in the original file this many times in a run are promoted into the carved file. "true" promotes them on the first fallback.
+	char *promote_env = getenv("CARVE_PROMOTE");
+	promotion_threshold = promote_env == NULL ? 0 : strcmp(promote_env, "true") == 0 ? 1 : atoi(promote_env);
+
+	// Only the attributes read or iterated over by the application are copied into the carved files, unless set to "all"
+	char *attributes_env = getenv("CARVE_ATTRIBUTES");
+	is_copying_all_attributes = attributes_env != NULL && strcmp(attributes_env, "all") == 0;
+
+	// Number of datasets carved between flushes of a carved file
+	char *flush_interval_env = getenv("CARVED_FLUSH_INTERVAL");
+	flush_interval = flush_interval_env == NULL ? 0 : atoi(flush_interval_env);
+
+	// Fetch original functions
+	original_H5Dread = dlsym(RTLD_NEXT, "H5Dread");
+	original_H5Fopen = dlsym(RTLD_NEXT, "H5Fopen");
+	original_H5Fclose = dlsym(RTLD_NEXT, "H5Fclose");
+	original_H5Oopen = dlsym(RTLD_NEXT, "H5Oopen");
 	original_nc_open = dlsym(RTLD_NEXT, "nc_open");
+	original_H5_term_library = dlsym(RTLD_NEXT, "H5_term_library");
+	original_H5Aread = dlsym(RTLD_NEXT, "H5Aread");
+	original_H5Aiterate2 = dlsym(RTLD_NEXT, "H5Aiterate2");
+	original_H5Aiterate_by_name = dlsym(RTLD_NEXT, "H5Aiterate_by_name");
+}
+
+int nc_open(const char *path, int omode, int *ncidp) {
+	// libnetcdf may have been loaded with dlopen after the constructor ran
+	if (original_nc_open == NULL) {
+		original_nc_open = dlsym(RTLD_NEXT, "nc_open");
+
+		if (original_nc_open == NULL) {
+			if (DEBUG) {
+				fprintf(log_ptr, "Could not find nc_open: %s\n", dlerror());
+			}
+
+			return NC_ENOTBUILT;
+		}
+	}
+
+	if (is_passthrough_mode) {
+		return original_nc_open(path, omode, ncidp);
+	}
 
 	char *filename = malloc(strlen(path) + 1);
 	strcpy(filename, path);
@@ -79,12 +215,9 @@ int nc_open(const char *path, int omode, int *ncidp) {
 	char *carved_filename = get_carved_filename(filename, NULL, NULL);
 
 	free(filename);
-	
-	// Fetch USE_CARVED environment variable
-	use_carved = getenv("USE_CARVED");
 
 	// Check if USE_CARVED environment variable has been set
-	if (use_carved != NULL && strcmp(use_carved, "true") == 0) {
+	if (is_repeat_mode) {
 		if (DEBUG) {
 			fprintf(log_ptr, "nc_open called %s %d %ls\n", carved_filename, omode, ncidp);
 		}
@@ -106,50 +239,40 @@ int nc_open(const char *path, int omode, int *ncidp) {
 	Additional functionality added includes making an identical skeleton copy of the existing HDF5 file.
 	The copy includes all groups, datasets, and attributes but excludes the contents of the datasets.
 */
-hid_t H5Fopen (const char *filename, unsigned flags, hid_t fapl_id) {
-	DEBUG = getenv("DEBUG");
-
-	if (DEBUG) {
-		if (log_ptr == NULL) {
-			log_ptr = fopen("log", "w");
-		}
-
+static hid_t hook_H5Fopen(const char *filename, unsigned flags, hid_t fapl_id) {
+	if (DEBUG)
 		fprintf(log_ptr, "H5Fopen called %s %d %ld\n", filename, flags, fapl_id);
-	}
-
-	// Fetch original function
-	original_H5Fopen = dlsym(RTLD_NEXT, "H5Fopen");
 
 	// Create name of carved file
-	char *carved_directory = getenv("CARVED_DIRECTORY");
-
-	is_netcdf4 = getenv("NETCDF4");
-  
-	// Fetch USE_CARVED environment variable
-	use_carved = getenv("USE_CARVED");
-
 	char *carved_filename = get_carved_filename(filename, is_netcdf4, use_carved);
 
 	// Check if USE_CARVED environment variable has been set
-	if (use_carved != NULL && strcmp(use_carved, "true") == 0) {
-		// Open original file for fallback machinery
-		original_file_id = original_H5Fopen(filename, flags, fapl_id);
+	if (is_repeat_mode) {
+		// Open carved file for re-execution mode. Datasets are promoted into it through the same shared file, so it is opened read-write when promoting.
+		src_file_id = promotion_threshold > 0 ? open_carved_file(carved_filename, H5F_ACC_RDWR, fapl_id) : H5I_INVALID_HID;
 
-		if (original_file_id == H5I_INVALID_HID) {
-			if (DEBUG)
-				fprintf(log_ptr, "Error opening original file to be used as fallback %s %d %ld\n", filename, flags, fapl_id);
-			return original_file_id;
+		if (src_file_id == H5I_INVALID_HID) {
+			if (promotion_threshold > 0 && DEBUG)
+				fprintf(log_ptr, "Carved file cannot be opened read-write, datasets are not promoted into it %s\n", carved_filename);
+			src_file_id = open_carved_file(carved_filename, flags, fapl_id);
 		}
 
-		// Open carved file for re-execution mode
-		src_file_id = original_H5Fopen(carved_filename, flags, H5P_DEFAULT);
-
 		if (src_file_id == H5I_INVALID_HID) {
 			if (DEBUG)
 				fprintf(log_ptr, "Error opening carved file %s %d\n", carved_filename, flags);
 			return src_file_id;
 		}
 
+		// Carving status of the datasets is looked up in the manifest of the carved file
+		load_carving_manifest(src_file_id);
+
+		// The original file is only opened on the first fallback to it
+		register_original_file(src_file_id, filename, flags, fapl_id);
+
+		if (is_direct_read_mode) {
+			load_direct_read_index(src_file_id, carved_filename);
+		}
+
 		if (DEBUG)
 			fprintf(log_ptr, "CARVING DATASETS ACCESSED\n");
 
@@ -177,12 +300,22 @@ hid_t H5Fopen (const char *filename, unsigned flags, hid_t fapl_id) {
 	    strcpy(files_opened[files_opened_current_size], filename);
 
 	    files_opened_current_size += 1;
+
+	    if (is_tracing_mode) {
+	    	append_trace_file(filename);
+	    }
+	}
+
+	// In deferred and tracing modes the carved file is built later
+	if (is_deferred_carving_mode || is_tracing_mode) {
+		free(carved_filename);
+		return src_file_id;
 	}
 
 	// If carved file already exists or file was opened previously, skeleton file has already been created. Skip first phase.
 	if (access(carved_filename, F_OK) == 0) {
 		if (dest_file_id == -1) {
-			dest_file_id = original_H5Fopen(carved_filename, H5F_ACC_RDWR, H5P_DEFAULT);
+			dest_file_id = open_carved_file(carved_filename, H5F_ACC_RDWR, H5P_DEFAULT);
 
 			if (dest_file_id == H5I_INVALID_HID) {
 				if (DEBUG)
@@ -191,89 +324,141 @@ hid_t H5Fopen (const char *filename, unsigned flags, hid_t fapl_id) {
 			}
 		}
 
-    	return src_file_id;
-	}
+		// Pool handles to the source and carved file for the H5Dread hook
+		carved_file_handle *handle = acquire_file_handle(filename, src_file_id);
 
-	// Open root group of source file
-	hid_t group_location_id = H5Gopen(src_file_id, "/", H5P_DEFAULT);
+		if (handle == NULL) {
+			if (DEBUG)
+				fprintf(log_ptr, "Error pooling file handles %s\n", filename);
+			return H5I_INVALID_HID;
+		}
 
-	if (group_location_id == H5I_INVALID_HID) {
-		if (DEBUG)
-			fprintf(log_ptr, "Error opening source file root group %ld\n", src_file_id);
+		track_application_file(handle, src_file_id);
 
-		return H5I_INVALID_HID;
+    	return src_file_id;
 	}
 
-	// Create destination (to-be carved) file and open the root group to duplicate the general structure of source file
-	dest_file_id = H5Fcreate(carved_filename, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+	// Build the skeleton of the source file in the carved file, or clone it from a template
+	dest_file_id = create_carved_file(src_file_id, carved_filename);
 
 	if (dest_file_id == H5I_INVALID_HID) {
-		if (DEBUG)
-			fprintf(log_ptr, "Error creating destination file %s\n", carved_filename);
 		return H5I_INVALID_HID;
 	}
 
-	// Open root group of destination file
-	hid_t destination_group_location_id = H5Gopen(dest_file_id, "/", H5P_DEFAULT);
+	// Pool handles to the source and carved file for the H5Dread hook
+	carved_file_handle *handle = acquire_file_handle(filename, src_file_id);
 
-	if (destination_group_location_id == H5I_INVALID_HID) {
+	if (handle == NULL) {
 		if (DEBUG)
-			fprintf(log_ptr, "Error opening destination file root group %ld\n", dest_file_id);
+			fprintf(log_ptr, "Error pooling file handles %s\n", filename);
 		return H5I_INVALID_HID;
 	}
 
-	// herr_t fallback_metadata_ret_val = create_fallback_metadata(filename, destination_group_location_id);
-
-	// if (fallback_metadata_ret_val < 0) {
-	// 	if (DEBUG)
-	// 		fprintf(log_ptr, "Error creating fallback metadata");
-	// 	return fallback_metadata_ret_val;
-	// }
+	track_application_file(handle, src_file_id);
+	
+	if (DEBUG)
+		fprintf(log_ptr, "CARVING DATASETS ACCESSED\n");
 
-    hid_t dataset_copy_check_attr_dataspace_id = H5Screate(H5S_SCALAR);
+	return src_file_id;
+}
 
-    hid_t dataset_copy_check_attr_id = H5Acreate2(destination_group_location_id, "WAS_DATASET_COPIED", H5T_NATIVE_HBOOL, dataset_copy_check_attr_dataspace_id, 
-                               H5P_DEFAULT, H5P_DEFAULT);
+hid_t H5Fopen (const char *filename, unsigned flags, hid_t fapl_id) {
+	if (is_passthrough_mode) {
+		return original_H5Fopen(filename, flags, fapl_id);
+	}
 
-    hbool_t is_empty = false;
-    H5Awrite(dataset_copy_check_attr_id, H5T_NATIVE_HBOOL, &is_empty);
+	lock_carving_state();
+	hid_t return_val = hook_H5Fopen(filename, flags, fapl_id);
+	unlock_carving_state();
 
-	if (DEBUG)
-		fprintf(log_ptr, "CARVING GROUPS AND EMPTY DATASETS\n");
+	return return_val;
+}
 
-	// Start DFS to make a copy of the HDF5 file structure without populating contents i.e a "skeleton" 
-	herr_t link_iterate_return_val = H5Literate2(group_location_id, H5_INDEX_NAME, H5_ITER_INC, NULL, shallow_copy_object, &destination_group_location_id);
+/*
+	Closes an HDF5 file.
+	Additional functionality added includes closing the pooled handle of the original file once the application has closed all of its own,
+	so that the application can open the file again, read-write for instance.
+*/
+herr_t H5Fclose(hid_t file_id) {
+	herr_t return_val = original_H5Fclose(file_id);
 
-	if (link_iterate_return_val < 0) {
-		if (DEBUG)
-			fprintf(log_ptr, "Link iteration failed %ld %ld\n", group_location_id, destination_group_location_id);
-		return H5I_INVALID_HID;
+	if (is_passthrough_mode || is_repeat_mode || return_val < 0) {
+		return return_val;
 	}
-	
-	if (DEBUG)
-		fprintf(log_ptr, "CARVING DATASETS ACCESSED\n");
 
-	return src_file_id;
+	lock_carving_state();
+	release_application_file(file_id);
+	unlock_carving_state();
+
+	return return_val;
 }
+
 /* 
 	Reads a dataset from the HDF5 file into application memory.
     Additional functionality added includes monitoring which datasets have
     been accessed and populating the empty datasets in the carved file
     with the contents of the datasets accessed in the original file.
 */
-herr_t H5Dread(hid_t dataset_id, hid_t	mem_type_id, hid_t mem_space_id, hid_t file_space_id, hid_t	dxpl_id, void *buf)	{
+static herr_t hook_H5Dread(hid_t dataset_id, hid_t mem_type_id, hid_t mem_space_id, hid_t file_space_id, hid_t dxpl_id, void *buf) {
 	if (DEBUG)
 		fprintf(log_ptr, "H5Dread called %ld %ld %ld %ld %ld\n", dataset_id, mem_type_id, mem_space_id, file_space_id, dxpl_id);
 
+	// In partial carving mode, selections reaching blocks missing from a partially carved dataset are read from the original file
+	if (is_repeat_mode && is_partial_carving_mode && is_partially_carved(dataset_id) && !is_selection_carved(dataset_id, file_space_id)) {
+		int size_of_name_buffer = H5Iget_name(dataset_id, NULL, 0) + 1;
+
+		if (size_of_name_buffer == 0) {
+			if (DEBUG)
+				fprintf(log_ptr, "Error fetching size of dataset name buffer %ld\n", dataset_id);
+			return -1;
+		}
+
+		char *dataset_name = (char *)malloc(size_of_name_buffer);
+		H5Iget_name(dataset_id, dataset_name, size_of_name_buffer);
+
+		if (DEBUG)
+			fprintf(log_ptr, "Reading partially carved dataset %s from original file\n", dataset_name);
+
+		// The dataspaces of the carved dataset have the extent of the original dataset, so they apply to it as is
+		hid_t original_file_id = get_original_file(dataset_id);
+		hid_t original_dataset_id = original_file_id == H5I_INVALID_HID ? H5I_INVALID_HID : H5Dopen(original_file_id, dataset_name, H5P_DEFAULT);
+
+		if (original_dataset_id == H5I_INVALID_HID) {
+			if (DEBUG)
+				fprintf(log_ptr, "Error opening dataset in original file %s\n", dataset_name);
+			free(dataset_name);
+			return -1;
+		}
+
+		free(dataset_name);
+
+		herr_t return_val = original_H5Dread(original_dataset_id, mem_type_id, mem_space_id, file_space_id, dxpl_id, buf);
+		H5Dclose(original_dataset_id);
+
+		return return_val;
+	}
+
+	// Reads of carved contiguous datasets needing no type conversion are served from the carved file without the library
+	if (is_repeat_mode && is_direct_read_mode && read_dataset_directly(dataset_id, mem_type_id, mem_space_id, file_space_id, dxpl_id, buf) == 0) {
+		return 0;
+	}
+
     // Original function call
-	original_H5Dread = dlsym(RTLD_NEXT, "H5Dread");
 	herr_t return_val = original_H5Dread(dataset_id, mem_type_id, mem_space_id, file_space_id, dxpl_id, buf);
 
-	// Fetch USE_CARVED environment variable
-	use_carved = getenv("USE_CARVED");
-
 	// Check if USE_CARVED environment variable has been set and return if it has (if it has been set, the carved file is queried by the above H5Dread call)
-	if (use_carved != NULL && strcmp(use_carved, "true") == 0) {	
+	if (is_repeat_mode) {
+		return return_val;
+	}
+
+	// Datasets already carved in this process need no further work, which costs a single lookup in the in-memory carved set
+	carved_dataset_key key;
+
+	if (get_carved_dataset_key(dataset_id, &key) < 0) {
+		return -1;
+	}
+
+	if (is_in_carved_set(&key)) {
 		return return_val;
 	}
 
@@ -298,238 +483,303 @@ herr_t H5Dread(hid_t dataset_id, hid_t	mem_type_id, hid_t mem_space_id, hid_t fi
 	char *dataset_filename = (char *)malloc(dataset_filename_len);
 	H5Fget_name(dataset_file_id, dataset_filename, dataset_filename_len);
 
-	// Create name of carved file
-	char *carved_directory = getenv("CARVED_DIRECTORY");
-	is_netcdf4 = getenv("NETCDF4");
-	// Fetch USE_CARVED environment variable
-	use_carved = getenv("USE_CARVED");
-
-	char *carved_filename = get_carved_filename(dataset_filename, is_netcdf4, use_carved);
-	
-	original_H5Fopen = dlsym(RTLD_NEXT, "H5Fopen");
-	hid_t dataset_src_file = original_H5Fopen(dataset_filename, H5F_ACC_RDONLY, H5P_DEFAULT);
-	hid_t dataset_carved_file = original_H5Fopen(carved_filename, H5F_ACC_RDWR, H5P_DEFAULT);
-	free(dataset_filename);
-
-	hid_t carved_empty_dataset = H5Dopen(dataset_carved_file, dataset_name, H5P_DEFAULT);
-
-	// If the dataset being read does not exist in the carved file, copy the datatset object to the carved file
-    if (!does_dataset_exist(carved_empty_dataset)) {
-    	if (DEBUG)
-			fprintf(log_ptr, "Deleting empty dataset from carved file %s\n", dataset_name);
-    	hid_t link_deletion_ret_value = H5Ldelete(dataset_carved_file, dataset_name, H5P_DEFAULT);
-
-    	if (link_deletion_ret_value < 0) {
-    		if (DEBUG)
-				fprintf(log_ptr, "Error deleting empty dataset object %ld %s\n", dataset_carved_file, dataset_name);
-    		return link_deletion_ret_value;
-    	}
-
-    	if (DEBUG)
-			fprintf(log_ptr, "Copying complete dataset to carved file %s\n", dataset_name);
+	// In deferred and tracing modes the read is only recorded, the dataset is carved when the library terminates or by h5carve_materialize
+	if (is_deferred_carving_mode || is_tracing_mode) {
+		H5Fclose(dataset_file_id);
 
+		hsize_t selection_start[H5S_MAX_RANK], selection_end[H5S_MAX_RANK];
+		int selection_rank = is_partial_carving_mode ? get_selection_bounds(file_space_id, selection_start, selection_end) : 0;
 
-		// Make copy of dataset in the destination file
-		herr_t object_copy_return_val = H5Ocopy(dataset_src_file, dataset_name, dataset_carved_file, dataset_name, H5P_DEFAULT, H5P_DEFAULT);
+		if (is_tracing_mode) {
+			append_trace_dataset(dataset_filename, dataset_name, selection_rank, selection_start, selection_end);
+		} else {
+			record_deferred_dataset(dataset_filename, dataset_name, selection_rank, selection_start, selection_end);
+		}
 
-		if (object_copy_return_val < 0) {
-			if (DEBUG)
-				fprintf(log_ptr, "Error copying object %ld %s %ld %s\n", dataset_src_file, dataset_name, dataset_carved_file, dataset_name);
-			return object_copy_return_val;
+		// Datasets read partially are recorded again on later reads, since other selections may reach other blocks
+		if (selection_rank == 0) {
+			add_to_carved_set(&key);
 		}
 
-		hid_t dataset_copy_check_attr_id = H5Aopen(dataset_carved_file, "WAS_DATASET_COPIED", H5P_DEFAULT);
+		free(dataset_filename);
+		free(dataset_name);
+		return return_val;
+	}
 
-		if (dataset_copy_check_attr_id < 0) {
-            if (DEBUG)
-				fprintf(log_ptr, "Error opening dataset copy check attribute %ld\n", dataset_carved_file);
-            return -1;
-        }
+	// Reuse the source and carved file handles pooled by the H5Fopen hook instead of reopening both files on every read
+	carved_file_handle *handle = acquire_file_handle(dataset_filename, dataset_file_id);
+	H5Fclose(dataset_file_id);
+	free(dataset_filename);
 
-		hbool_t dataset_copy_check_attr_val = true;
+	if (handle == NULL) {
+		if (DEBUG)
+			fprintf(log_ptr, "Error acquiring pooled file handles for dataset %s\n", dataset_name);
+		free(dataset_name);
+		return -1;
+	}
 
-        herr_t dataset_copy_check_attr_write_status = H5Awrite(dataset_copy_check_attr_id, H5T_NATIVE_HBOOL, &dataset_copy_check_attr_val);
-        
-        if (dataset_copy_check_attr_write_status < 0) {
-            if (DEBUG)
-				fprintf(log_ptr, "Error writing value to dataset copy check ttribute %ld\n", dataset_copy_check_attr_id);
-            return -1;
-        }
+	hid_t dataset_carved_file = handle->carved_file_id;
 
-		original_H5Oopen = dlsym(RTLD_NEXT, "H5Oopen");
-		hid_t recent = original_H5Oopen(dataset_carved_file, dataset_name, H5P_DEFAULT);
+	// In lazy skeleton mode the empty dataset and its parent groups are created on first read
+	if (is_lazy_skeleton_mode && ensure_skeleton_path(handle, dataset_name) < 0) {
+		free(dataset_name);
+		return -1;
+	}
 
-		if (recent < 0) {
-			if (DEBUG)
-				fprintf(log_ptr, "Error opening object after H5Ocopy %ld %s\n", dataset_carved_file, dataset_name);
-			return recent;
-		}
+	hid_t carved_empty_dataset = H5Dopen(dataset_carved_file, dataset_name, H5P_DEFAULT);
+	bool is_dataset_carved = does_dataset_exist(carved_empty_dataset);
+	H5Dclose(carved_empty_dataset);
 
-		// Delete copied attributes (attributes may contain references to objects which would be invalid in carved file)
-		herr_t attribute_iterate_return_val = H5Aiterate2(recent, H5_INDEX_NAME, H5_ITER_INC, NULL, delete_attributes, NULL);
+	// If the dataset being read does not exist in the carved file, copy the datatset object to the carved file
+    if (!is_dataset_carved) {
+    	// In asynchronous mode the carving worker copies the dataset while the application carries on. 
+    	// Partially carved datasets are queued again on later reads, since other selections may reach other blocks.
+    	if (is_async_carving_mode && enqueue_carve_job(handle, dataset_name, file_space_id)) {
+    		is_dataset_carved = !is_partial_carving_mode;
+    	} else {
+    		herr_t carve_return_val = carve_dataset(handle, dataset_id, dataset_name, mem_type_id, mem_space_id, file_space_id, dxpl_id, return_val >= 0 ? buf : NULL, &is_dataset_carved);
+
+    		if (carve_return_val < 0) {
+    			free(dataset_name);
+    			return carve_return_val;
+    		}
+    	}
+	}
 
-		if (attribute_iterate_return_val < 0) {
-			if (DEBUG)
-				fprintf(log_ptr, "Attribute iteration failed\n");
-			return attribute_iterate_return_val;
-		}
+	// Partially carved datasets are checked again on later reads
+	if (is_dataset_carved) {
+		add_to_carved_set(&key);
 	}
 
-	H5Fclose(dataset_src_file);
-	H5Fclose(dataset_carved_file);
 	free(dataset_name);
 	
 	return return_val;
 }
 
+herr_t H5Dread(hid_t dataset_id, hid_t	mem_type_id, hid_t mem_space_id, hid_t file_space_id, hid_t	dxpl_id, void *buf)	{
+	if (is_passthrough_mode) {
+		return original_H5Dread(dataset_id, mem_type_id, mem_space_id, file_space_id, dxpl_id, buf);
+	}
+
+	lock_carving_state();
+	herr_t return_val = hook_H5Dread(dataset_id, mem_type_id, mem_space_id, file_space_id, dxpl_id, buf);
+	unlock_carving_state();
+
+	return return_val;
+}
+
 /*
 	Opens an object within an HDF5 file.
 	Additional functionality added includes monitoring if the datasets accessed in re-execution mode
 	are present in the carved file or not. If not, diverts the control flow to access the dataset in 
 	the original file instead of the carved file.
 */
-hid_t H5Oopen(hid_t loc_id, const char *name, hid_t lapl_id) {
+static hid_t hook_H5Oopen(hid_t loc_id, const char *name, hid_t lapl_id) {
     if (DEBUG)
         fprintf(log_ptr, "H5Oopen called %ld %s %ld\n", loc_id, name, lapl_id);
 
     // Original function call
-    original_H5Oopen = dlsym(RTLD_NEXT, "H5Oopen");
     hid_t return_val = original_H5Oopen(loc_id, name, lapl_id);
 
-    if (return_val == H5I_INVALID_HID) {
+    // Objects missing from a lazily built carved file are opened in the original file in repeat mode.
+    // A complete skeleton has every object of the original file, so a failed open, such as a probe for an optional object, fails there too.
+    bool is_missing_from_carved_file = is_repeat_mode && return_val == H5I_INVALID_HID && is_skeleton_incomplete(loc_id);
+
+    if (return_val == H5I_INVALID_HID && !is_missing_from_carved_file) {
         if (DEBUG)
                 fprintf(log_ptr, "Error opening object %ld %s %ld\n", loc_id, name, lapl_id);
         return return_val;
     }
 
-    // Fetch USE_CARVED environment variable
-    use_carved = getenv("USE_CARVED");
+    // In lazy skeleton mode objects opened are added to the skeleton
+    if (is_lazy_skeleton_mode && !is_repeat_mode && !is_deferred_carving_mode && !is_tracing_mode && add_object_to_skeleton(return_val) < 0) {
+        if (DEBUG)
+            fprintf(log_ptr, "Error adding object to skeleton %ld %s\n", loc_id, name);
+    }
 
     // If in repeat mode and object does not exist in carved file, bifurcate access to original file
-    if ((use_carved != NULL && strcmp(use_carved, "true") == 0) && H5Iget_type(return_val) == H5I_DATASET && (!does_dataset_exist(return_val))) {
-        // Fetch length of name of dataset
-        int size_of_name_buffer = H5Iget_name(loc_id, NULL, 0) + 1; // Preliminary call to fetch length of dataset name
+    // Partially carved datasets stay in the carved file, the H5Dread hook reads the blocks missing from it in the original file
+    if (is_missing_from_carved_file || (is_repeat_mode && H5Iget_type(return_val) == H5I_DATASET && (!does_dataset_exist(return_val)) && !(is_partial_carving_mode && is_partially_carved(return_val)))) {
+        if (return_val != H5I_INVALID_HID) {
+            H5Oclose(return_val);
+        }
 
-        if (size_of_name_buffer == 0) {
+        // The location in the original file matching loc_id is cached, and stays open until the library terminates
+        hid_t original_file_loc_id = get_original_location(loc_id);
+
+        if (original_file_loc_id == H5I_INVALID_HID) {
             if (DEBUG)
-                fprintf(log_ptr, "Error fetching size of dataset name buffer %ld\n", loc_id);
-            return -1;
+                fprintf(log_ptr, "Error opening location in original file %ld %s\n", loc_id, name);
+            return H5I_INVALID_HID;
         }
 
-        // Create and populate buffer for dataset name
-        char *parent_object_name = (char *)malloc(size_of_name_buffer);
-        H5Iget_name(loc_id, parent_object_name, size_of_name_buffer); // Fill parent_object_name buffer with the dataset name
+        return_val = original_H5Oopen(original_file_loc_id, name, lapl_id);
 
-        hid_t original_file_loc_id = original_H5Oopen(original_file_id, parent_object_name, lapl_id);
-        free(parent_object_name);
+        // Datasets opened in the original file often enough are copied into the carved file, so later runs read them locally
+        if (promotion_threshold > 0 && return_val != H5I_INVALID_HID) {
+            record_fallback_hit(return_val);
+        }
+    }
 
-        return_val = original_H5Oopen(original_file_loc_id, name, lapl_id);
+    return return_val;
+}
+
+hid_t H5Oopen(hid_t loc_id, const char *name, hid_t lapl_id) {
+    if (is_passthrough_mode) {
+        return original_H5Oopen(loc_id, name, lapl_id);
     }
 
+    lock_carving_state();
+    hid_t return_val = hook_H5Oopen(loc_id, name, lapl_id);
+    unlock_carving_state();
+
     return return_val;
 }
 
-void H5_term_library(void) {
-	// current_index = 0;
+/*
+	Reads an attribute.
+	Additional functionality added includes recording the attribute as accessed, so that only the attributes read are copied into the carved file.
+*/
+herr_t H5Aread(hid_t attr_id, hid_t type_id, void *buf) {
+	herr_t return_val = original_H5Aread(attr_id, type_id, buf);
 
-	if (DEBUG)
-		fprintf(log_ptr, "H5_term_library called\n");
+	if (is_passthrough_mode || is_repeat_mode || is_copying_all_attributes || is_attribute_recording_suspended || return_val < 0) {
+		return return_val;
+	}
 
-	// Fetch USE_CARVED environment variable
-	use_carved = getenv("USE_CARVED");
+	int size_of_name_buffer = H5Aget_name(attr_id, 0, NULL) + 1;
 
-	// Check if USE_CARVED environment variable has been set
-	if (use_carved == NULL) {
-		for (int i = 0; i < files_opened_current_size; i++) {
-			src_file_id = original_H5Fopen(files_opened[i], H5F_ACC_RDONLY, H5P_DEFAULT);
+	if (size_of_name_buffer <= 1) {
+		return return_val;
+	}
 
-			if (src_file_id == H5I_INVALID_HID) {
-				if (DEBUG)
-					fprintf(log_ptr, "Error reopening source file for copying attributes %s\n", files_opened[i]);
-			}
+	char *attribute_name = malloc(size_of_name_buffer);
+	H5Aget_name(attr_id, size_of_name_buffer, attribute_name);
+	lock_carving_state();
+	record_attribute_access(attr_id, attribute_name);
+	unlock_carving_state();
+	free(attribute_name);
 
-			// Create name of carved file
-			char *carved_directory = getenv("CARVED_DIRECTORY");
-			is_netcdf4 = getenv("NETCDF4");
-			// Fetch USE_CARVED environment variable
-			use_carved = getenv("USE_CARVED");
+	return return_val;
+}
 
-			char *carved_filename = get_carved_filename(files_opened[i], is_netcdf4, use_carved);
-	
-			dest_file_id = original_H5Fopen(carved_filename, H5F_ACC_RDWR, H5P_DEFAULT);
+// Operator of an attribute iteration of the application, wrapped to record the attributes visited
+typedef struct {
+	H5A_operator2_t op;
+	void *op_data;
+} attribute_iteration;
 
-			if (dest_file_id == H5I_INVALID_HID) {
-				if (DEBUG)
-					fprintf(log_ptr, "Error reopening dest file for copying attributes %s\n", carved_filename);
-			}
+static herr_t record_iterated_attribute(hid_t location_id, const char *attr_name, const H5A_info_t *ainfo, void *op_data) {
+	attribute_iteration *iteration = (attribute_iteration *)op_data;
 
-			hid_t dataset_copy_check_attr_id = H5Aopen(dest_file_id, "WAS_DATASET_COPIED", H5P_DEFAULT);
+	record_attribute_access(location_id, attr_name);
 
-			if (dataset_copy_check_attr_id < 0) {
-	            if (DEBUG)
-					fprintf(log_ptr, "Error opening dataset copy check attribute %ld\n", dest_file_id);
-	        }
+	return iteration->op(location_id, attr_name, ainfo, iteration->op_data);
+}
 
-	        hbool_t dataset_copy_check_attr_val;
-	        
-			herr_t dataset_copy_check_attr_return_val = H5Aread(dataset_copy_check_attr_id, H5T_NATIVE_HBOOL, &dataset_copy_check_attr_val);
+/*
+	Iterates over the attributes of an object.
+	Additional functionality added includes recording the attributes visited as accessed, since iterations such as those of netCDF
+	read the attributes they visit through the attribute information alone.
+*/
+herr_t H5Aiterate2(hid_t loc_id, H5_index_t idx_type, H5_iter_order_t order, hsize_t *idx, H5A_operator2_t op, void *op_data) {
+	if (is_passthrough_mode || is_repeat_mode || is_copying_all_attributes || is_attribute_recording_suspended || op == NULL) {
+		return original_H5Aiterate2(loc_id, idx_type, order, idx, op, op_data);
+	}
 
-			if (dataset_copy_check_attr_return_val < 0) {
-				if (DEBUG)
-	    			fprintf(log_ptr, "Error reading dataset copy check attribute data %ld\n", dataset_copy_check_attr_id);
-			}
+	attribute_iteration iteration = {op, op_data};
+
+	// The wrapped operator records the attributes from inside the library, so the carving state is locked across the iteration
+	lock_carving_state();
+	herr_t return_val = original_H5Aiterate2(loc_id, idx_type, order, idx, record_iterated_attribute, &iteration);
+	unlock_carving_state();
 
-			if (dataset_copy_check_attr_val == true) {
-				hid_t original_file_group_location_id = H5Gopen(src_file_id, "/", H5P_DEFAULT);	
+	return return_val;
+}
+
+herr_t H5Aiterate_by_name(hid_t loc_id, const char *obj_name, H5_index_t idx_type, H5_iter_order_t order, hsize_t *idx, H5A_operator2_t op, void *op_data, hid_t lapl_id) {
+	if (is_passthrough_mode || is_repeat_mode || is_copying_all_attributes || is_attribute_recording_suspended || op == NULL) {
+		return original_H5Aiterate_by_name(loc_id, obj_name, idx_type, order, idx, op, op_data, lapl_id);
+	}
+
+	attribute_iteration iteration = {op, op_data};
+
+	lock_carving_state();
+	herr_t return_val = original_H5Aiterate_by_name(loc_id, obj_name, idx_type, order, idx, record_iterated_attribute, &iteration, lapl_id);
+	unlock_carving_state();
+
+	return return_val;
+}
+
+void H5_term_library(void) {
+	if (is_passthrough_mode) {
+		original_H5_term_library();
+		return;
+	}
+
+	// The attributes recorded are copied from here on, by this thread while others may still be running
+	lock_carving_state();
+	is_attribute_recording_suspended = true;
+	unlock_carving_state();
+
+	if (DEBUG)
+		fprintf(log_ptr, "H5_term_library called\n");
+
+	// Carve the datasets still queued for the carving worker before copying attributes
+	drain_carve_queue();
+
+	// Build the carved files and carve the datasets recorded in deferred mode
+	if (is_deferred_carving_mode && !is_tracing_mode) {
+		carve_deferred_datasets();
+	}
 
-				if (original_file_group_location_id == H5I_INVALID_HID) {
-					if (DEBUG)
-						fprintf(log_ptr, "Error opening source file root group %ld\n", src_file_id);
-				}
+	close_carve_trace();
 
-				hid_t carved_file_group_location_id = H5Gopen(dest_file_id, "/", H5P_DEFAULT);
+	// Carve the datasets promoted in repeat mode that the carving worker could not take
+	if (is_repeat_mode && promotion_threshold > 0) {
+		finish_dataset_promotions();
+	}
 
-				if (carved_file_group_location_id == H5I_INVALID_HID) {
-					if (DEBUG)
-						fprintf(log_ptr, "Error opening carved file root group %ld\n", dest_file_id);
-				}
+	// Check if USE_CARVED environment variable has been set
+	// In tracing mode no carved file has been written
+	if (use_carved == NULL && !is_tracing_mode) {
+		for (int i = 0; i < files_opened_current_size; i++) {
+			// Reuse the pooled handles of the source and carved file
+			carved_file_handle *handle = acquire_file_handle(files_opened[i], H5I_INVALID_HID);
 
+			if (handle == NULL) {
 				if (DEBUG)
-					fprintf(log_ptr, "CARVING ATTRIBUTES\n");
-
-				// Iterate over attributes at this level in the source file and make non-shallow copies in the destination file
-				herr_t attribute_iterate_return_val = H5Aiterate2(original_file_group_location_id, H5_INDEX_NAME, H5_ITER_INC, NULL, copy_object_attributes, &carved_file_group_location_id); // Iterate through each attribute and create a copy
-				
-				if (attribute_iterate_return_val < 0) {
-					if (DEBUG)
-						fprintf(log_ptr, "Attribute iteration failed\n");
-				}
-
-				// Start DFS to make a copy of attributes
-				herr_t link_iterate_return_val = H5Literate2(original_file_group_location_id, H5_INDEX_NAME, H5_ITER_INC, NULL, copy_attributes, &carved_file_group_location_id);
-
-				if (link_iterate_return_val < 0) {
-					if (DEBUG)
-						fprintf(log_ptr, "Link iteration failed\n");
-				}
-
-				dataset_copy_check_attr_val = false;
-
-		        herr_t dataset_copy_check_attr_write_status = H5Awrite(dataset_copy_check_attr_id, H5T_NATIVE_HBOOL, &dataset_copy_check_attr_val);
-		        if (dataset_copy_check_attr_write_status < 0) {
-		            if (DEBUG)
-						fprintf(log_ptr, "Error writing value to dataset copy check ttribute %ld\n", dataset_copy_check_attr_id);
-		        }
+					fprintf(log_ptr, "Error acquiring file handles for copying attributes %s\n", files_opened[i]);
+				free(files_opened[i]);
+				continue;
+			}
+
+			// Build the objects never accessed into a lazily built skeleton
+			if (is_skeleton_completed_at_exit) {
+				complete_skeleton(handle);
+			}
+
+			// Copy every attribute, or only those the application accessed
+			if (is_copying_all_attributes) {
+				copy_carved_file_attributes(handle);
+			} else {
+				copy_accessed_attributes(handle);
 			}
 
-			H5Fclose(src_file_id);
-			H5Fclose(dest_file_id);
 			free(files_opened[i]);
 		}
 
 		free(files_opened);
 	}
 
-	original_H5_term_library = dlsym(RTLD_NEXT, "H5_term_library");
+	// Close pooled file handles, flushing the carved files
+	release_file_handles();
+
+	// Close the original files and locations opened for fallbacks in repeat mode
+	release_original_files();
+
+	// Close the carved files read directly in repeat mode
+	release_direct_read_indexes();
+
 	original_H5_term_library();
 }
@@ -34,22 +34,98 @@
 #ifndef H5CARVE_H
 #define H5CARVE_H
 
-// Functions being interposed on include H5Fopen, H5Dread, and H5Oopen.
+// Functions being interposed on include H5Fopen, H5Fclose, H5Dread, and H5Oopen.
 extern herr_t (*original_H5Dread)(hid_t, hid_t, hid_t, hid_t, hid_t, void*);
 extern hid_t (*original_H5Fopen)(const char *, unsigned, hid_t);
+extern herr_t (*original_H5Fclose)(hid_t);
 extern hid_t (*original_H5Oopen)(hid_t, const char *, hid_t);
 extern int (*original_nc_open)(const char *path, int omode, int *ncidp);
 extern void (*original_H5_term_library)(void);
+extern herr_t (*original_H5Aread)(hid_t, hid_t, void *);
+extern herr_t (*original_H5Aiterate2)(hid_t, H5_index_t, H5_iter_order_t, hsize_t *, H5A_operator2_t, void *);
+extern herr_t (*original_H5Aiterate_by_name)(hid_t, const char *, H5_index_t, H5_iter_order_t, hsize_t *, H5A_operator2_t, void *, hid_t);
 
 // Global variables to be used across function calls
 extern char *use_carved;
 extern hid_t src_file_id;
 extern hid_t dest_file_id;
-extern hid_t original_file_id;
 extern char *is_netcdf4; // TODO: replace with an robust automatic check i.e. some kind of byte encoding 
 extern char **files_opened;
 extern int files_opened_current_size;
 extern FILE *log_ptr;
 extern char *DEBUG;
+extern int flush_interval;
+extern char *carved_directory;
+extern bool is_repeat_mode;
+extern bool is_passthrough_mode;
+extern bool is_partial_carving_mode;
+extern hsize_t partial_carving_block_size;
+extern size_t chunk_buffer_size;
+extern bool is_async_carving_mode;
+extern bool is_deferred_carving_mode;
+extern bool is_tracing_mode;
+extern bool is_lazy_skeleton_mode;
+extern bool is_skeleton_completed_at_exit;
+extern bool is_skeleton_template_mode;
+extern bool is_skeleton_storage_deferred;
+extern hsize_t carved_file_page_size;
+extern bool is_free_space_persistent;
+extern hsize_t core_file_size_limit;
+extern bool is_direct_read_mode;
+extern int promotion_threshold;
+extern bool is_copying_all_attributes;
+
+// Source and carved file handles, keyed by original filename. The carved file is kept open for the lifetime of the process,
+// the original file while the application has it open or carving needs it.
+typedef struct {
+	char *filename;
+	char *carved_filename;
+	hid_t src_file_id;
+	// File access properties of the application, with which the original file is opened again
+	hid_t src_file_access_plist;
+	// Handles of the application on the original file still open
+	int application_handle_count;
+	hid_t carved_file_id;
+	int datasets_carved_since_flush;
+	// Free space tracked in the carved file and its size when it was pooled, for the space report
+	hssize_t free_space_at_open;
+	hsize_t file_size_at_open;
+	// Paths of the datasets carved in this run, whose entries in the direct read index are updated when the handle is released
+	char **carved_dataset_names;
+	int carved_dataset_names_size;
+} carved_file_handle;
+
+// Identity of a dataset within the process: the file number of its file and its object token
+typedef struct {
+	unsigned long fileno;
+	H5O_token_t token;
+} carved_dataset_key;
+
+/*
+	Access trace written by the preload library when CARVE_TRACE is set, and turned into carved files by h5carve_materialize.
+	A trace is a sequence of records, each a carve_trace_record header followed by the payload, padded to a multiple of 8 bytes:
+	- CARVE_TRACE_FILE: the absolute path of an original file, NUL-terminated.
+	- CARVE_TRACE_DATASET: rank start coordinates and rank end coordinates of the bounds of the selection read as uint64_t, 
+	  followed by the path of the dataset, NUL-terminated. A rank of 0 stands for the whole dataset.
+	Files are identified by the hash of their absolute path, so traces of several processes can be appended to the same file or concatenated.
+*/
+#define CARVE_TRACE_MAGIC 0x54433548 // "H5CT"
+
+enum {
+	CARVE_TRACE_FILE = 1,
+	CARVE_TRACE_DATASET = 2,
+};
+
+typedef struct {
+	uint32_t magic;
+	uint16_t kind;
+	uint16_t rank;
+	uint32_t name_length; // Including the terminating NUL
+	uint32_t record_length; // Including the header and the padding
+	uint64_t file_id;
+} carve_trace_record;
+
+extern carved_file_handle **file_handle_pool;
+extern int file_handle_pool_current_size;
 
 #endif
@@ -39,15 +39,289 @@
 #include <stdlib.h>
 #include <string.h>
 #include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+#include <pthread.h>
+#include <time.h>
 
-extern H5R_ref_t created_reference_objects[2048];
-extern current_index;
+/*
+	Arena the attribute copy helpers allocate their buffers from: names, hvl_t arrays, reference arrays and destination buffers.
+	The buffers are freed in one step once an attribute has been copied, error returns included. The blocks are kept for the next attribute, 
+	apart from those grown past the default block size for large attributes.
+*/
+#define ATTRIBUTE_ARENA_BLOCK_SIZE (64 * 1024)
+
+typedef struct attribute_arena_block {
+	struct attribute_arena_block *next;
+	size_t size;
+	size_t used;
+	max_align_t data[];
+} attribute_arena_block;
+
+static attribute_arena_block *attribute_arena; // Blocks in use, the current one first
+static attribute_arena_block *attribute_arena_free_blocks; // Blocks emptied by release_attribute_arena
+static size_t attribute_arena_bytes;
+static size_t attribute_arena_peak_bytes;
+
+void *attribute_arena_alloc(size_t size) {
+	size = (size + sizeof(max_align_t) - 1) / sizeof(max_align_t) * sizeof(max_align_t);
+
+	if (attribute_arena == NULL || attribute_arena->used + size > attribute_arena->size) {
+		attribute_arena_block *block = attribute_arena_free_blocks;
+
+		if (block != NULL && size <= block->size) {
+			attribute_arena_free_blocks = block->next;
+		} else {
+			size_t block_size = size > ATTRIBUTE_ARENA_BLOCK_SIZE ? size : ATTRIBUTE_ARENA_BLOCK_SIZE;
+			block = malloc(sizeof(attribute_arena_block) + block_size);
+			block->size = block_size;
+			attribute_arena_bytes += block_size;
+
+			if (attribute_arena_bytes > attribute_arena_peak_bytes) {
+				attribute_arena_peak_bytes = attribute_arena_bytes;
+			}
+		}
+
+		block->used = 0;
+		block->next = attribute_arena;
+		attribute_arena = block;
+	}
+
+	void *buffer = (char *)attribute_arena->data + attribute_arena->used;
+	attribute_arena->used += size;
+
+	return buffer;
+}
+
+// Free every buffer of the arena at once, keeping the blocks of the default size for the next attribute
+void release_attribute_arena(void) {
+	while (attribute_arena != NULL) {
+		attribute_arena_block *block = attribute_arena;
+		attribute_arena = block->next;
+
+		if (block->size > ATTRIBUTE_ARENA_BLOCK_SIZE) {
+			attribute_arena_bytes -= block->size;
+			free(block);
+		} else {
+			block->next = attribute_arena_free_blocks;
+			attribute_arena_free_blocks = block;
+		}
+	}
+}
+
+// Report the peak size of the arena. Called once the attributes of a carved file have been copied.
+void log_attribute_arena_peak(void) {
+	if (DEBUG)
+		fprintf(log_ptr, "Attribute arena peak %zu bytes, %zu bytes retained\n", attribute_arena_peak_bytes, attribute_arena_bytes);
+}
+
+/*
+	Scope of the identifiers opened while copying attributes: attributes, datatypes and dataspaces.
+	Scopes nest; closing one closes the identifiers registered since it was opened.
+*/
+static hid_t *attribute_scope_ids;
+static size_t attribute_scope_size;
+static size_t attribute_scope_capacity;
+
+size_t open_attribute_scope(void) {
+	return attribute_scope_size;
+}
+
+// Register an identifier with the innermost scope. Returns the identifier, so that calls can be wrapped.
+hid_t scope_attribute_handle(hid_t id) {
+	if (id < 0) {
+		return id;
+	}
+
+	if (attribute_scope_size == attribute_scope_capacity) {
+		attribute_scope_capacity = attribute_scope_capacity == 0 ? 64 : attribute_scope_capacity * 2;
+		attribute_scope_ids = realloc(attribute_scope_ids, attribute_scope_capacity * sizeof(hid_t));
+	}
+
+	attribute_scope_ids[attribute_scope_size++] = id;
+
+	return id;
+}
+
+void close_attribute_scope(size_t scope) {
+	while (attribute_scope_size > scope) {
+		// Drops the reference of the scope whatever the type of the identifier, closing it
+		H5Idec_ref(attribute_scope_ids[--attribute_scope_size]);
+	}
+}
+
+/*
+	References of the carved file created for the objects referenced by the attributes of its source file, memoized by referenced object.
+	Dimension scale attributes such as DIMENSION_LIST and REFERENCE_LIST point to the same few objects many times over, 
+	so each object is only dereferenced by name and referenced in the carved file once.
+	Old-style references are keyed by their value, the address of the object, so repeated ones are not even dereferenced.
+	New-style object references are keyed by their value too: the token of the object they point to, at the start of their buffer.
+	A hit is confirmed with H5Requal against a copy of the source reference, since that buffer is private to the library.
+	The memo owns the references it holds, and those it could not memoize, and destroys them in bulk once the attributes are written.
+*/
+enum {
+	REFERENCE_MEMO_OBJECT_ADDRESS = 1,
+	REFERENCE_MEMO_OBJECT_TOKEN = 2,
+};
+
+typedef struct {
+	uint8_t kind;
+	H5O_token_t key;
+	// Source reference of a new-style entry
+	H5R_ref_t src_ref;
+	union {
+		hobj_ref_t object_ref;
+		H5R_ref_t ref;
+	} dest_ref;
+} reference_memo_entry;
+
+static reference_memo_entry *reference_memo;
+static bool *reference_memo_slot_used;
+static size_t reference_memo_capacity;
+static size_t reference_memo_size;
+static unsigned long reference_memo_src_fileno;
+static unsigned long reference_memo_dest_fileno;
+
+// Identifiers of the source and carved files the file numbers above were fetched for
+static hid_t reference_memo_src_file_id = H5I_INVALID_HID;
+static hid_t reference_memo_dest_file_id = H5I_INVALID_HID;
+
+// New-style references created in the carved file that are not held by the memo
+static H5R_ref_t *unmemoized_references;
+static size_t unmemoized_references_size;
+
+static size_t hash_reference_memo_key(uint8_t kind, const H5O_token_t *key) {
+	// FNV-1a over the kind and the key
+	uint64_t hash = (14695981039346656037ULL ^ kind) * 1099511628211ULL;
+	const unsigned char *bytes = (const unsigned char *)key;
+
+	for (size_t i = 0; i < sizeof(H5O_token_t); i++) {
+		hash = (hash ^ bytes[i]) * 1099511628211ULL;
+	}
+
+	return (size_t)hash;
+}
+
+// Slot of a key in the memo, or of the unused slot where it would be inserted
+static size_t find_reference_memo_slot(uint8_t kind, const H5O_token_t *key) {
+	size_t slot = hash_reference_memo_key(kind, key) & (reference_memo_capacity - 1);
+
+	while (reference_memo_slot_used[slot] && (reference_memo[slot].kind != kind || memcmp(&reference_memo[slot].key, key, sizeof(H5O_token_t)) != 0)) {
+		slot = (slot + 1) & (reference_memo_capacity - 1);
+	}
+
+	return slot;
+}
+
+// Destroy the references held by the memo and empty it. Called once the attributes of a carved file have been copied.
+void release_reference_memo(void) {
+	for (size_t i = 0; i < reference_memo_capacity; i++) {
+		if (reference_memo_slot_used[i] && reference_memo[i].kind == REFERENCE_MEMO_OBJECT_TOKEN) {
+			H5Rdestroy(&reference_memo[i].src_ref);
+			H5Rdestroy(&reference_memo[i].dest_ref.ref);
+		}
+	}
+
+	for (size_t i = 0; i < unmemoized_references_size; i++) {
+		H5Rdestroy(&unmemoized_references[i]);
+	}
+
+	free(unmemoized_references);
+	unmemoized_references = NULL;
+	unmemoized_references_size = 0;
+
+	free(reference_memo);
+	free(reference_memo_slot_used);
+	reference_memo = NULL;
+	reference_memo_slot_used = NULL;
+	reference_memo_capacity = 0;
+	reference_memo_size = 0;
+}
+
+/*
+	Look a referenced object up in the memo. The memo is emptied when it was filled for another pair of source and carved files.
+	File numbers are only fetched when the identifiers of the files change, since identifiers are not reused for other files.
+*/
+static reference_memo_entry *get_reference_memo_entry(uint8_t kind, const H5O_token_t *key) {
+	if (src_file_id != reference_memo_src_file_id || dest_file_id != reference_memo_dest_file_id) {
+		unsigned long src_fileno, dest_fileno;
+
+		if (H5Fget_fileno(src_file_id, &src_fileno) < 0 || H5Fget_fileno(dest_file_id, &dest_fileno) < 0) {
+			return NULL;
+		}
+
+		if (src_fileno != reference_memo_src_fileno || dest_fileno != reference_memo_dest_fileno) {
+			release_reference_memo();
+			reference_memo_src_fileno = src_fileno;
+			reference_memo_dest_fileno = dest_fileno;
+		}
+
+		reference_memo_src_file_id = src_file_id;
+		reference_memo_dest_file_id = dest_file_id;
+	}
+
+	if (reference_memo_size == 0) {
+		return NULL;
+	}
+
+	size_t slot = find_reference_memo_slot(kind, key);
+
+	return reference_memo_slot_used[slot] ? &reference_memo[slot] : NULL;
+}
+
+static reference_memo_entry *add_reference_memo_entry(uint8_t kind, const H5O_token_t *key) {
+	// Keep the load factor below one half, doubling and rehashing when exceeded
+	if ((reference_memo_size + 1) * 2 > reference_memo_capacity) {
+		reference_memo_entry *old_memo = reference_memo;
+		bool *old_slot_used = reference_memo_slot_used;
+		size_t old_capacity = reference_memo_capacity;
+
+		reference_memo_capacity = old_capacity == 0 ? 64 : old_capacity * 2;
+		reference_memo = malloc(reference_memo_capacity * sizeof(reference_memo_entry));
+		reference_memo_slot_used = calloc(reference_memo_capacity, sizeof(bool));
+
+		for (size_t i = 0; i < old_capacity; i++) {
+			if (old_slot_used[i]) {
+				size_t slot = find_reference_memo_slot(old_memo[i].kind, &old_memo[i].key);
+				reference_memo[slot] = old_memo[i];
+				reference_memo_slot_used[slot] = true;
+			}
+		}
+
+		free(old_memo);
+		free(old_slot_used);
+	}
+
+	size_t slot = find_reference_memo_slot(kind, key);
+	reference_memo[slot].kind = kind;
+	reference_memo[slot].key = *key;
+	reference_memo_slot_used[slot] = true;
+	reference_memo_size += 1;
+
+	return &reference_memo[slot];
+}
 
 hobj_ref_t *copy_reference_object(hobj_ref_t *source_ref, int num_elements, hid_t src_attribute_id) {
-	hobj_ref_t *dest_ref = malloc(num_elements * sizeof(hobj_ref_t));
+	hobj_ref_t *dest_ref = attribute_arena_alloc(num_elements * sizeof(hobj_ref_t));
 
 	// Iterate over all elements in the reference attribute
 	for (int i = 0; i < num_elements; i++) {
+		// Objects referenced before are looked up by the address held in the reference
+		H5O_token_t memo_key;
+		memset(&memo_key, 0, sizeof(H5O_token_t));
+		memcpy(&memo_key, source_ref + i, sizeof(hobj_ref_t));
+
+		reference_memo_entry *memo_entry = get_reference_memo_entry(REFERENCE_MEMO_OBJECT_ADDRESS, &memo_key);
+
+		if (memo_entry != NULL) {
+			dest_ref[i] = memo_entry->dest_ref.object_ref;
+			continue;
+		}
+
 		// Process the reference data
 	    hid_t referenced_obj = H5Rdereference1(src_attribute_id, H5R_OBJECT, (source_ref + i)); // Should this be replaced by H5Rdereference? Attempting to replace it leads to errors
 	    
@@ -63,11 +337,12 @@ hobj_ref_t *copy_reference_object(hobj_ref_t *source_ref, int num_elements, hid_
 	    if (size_of_name_buffer == 0) {
 	        if (DEBUG)
 	        	fprintf(log_ptr, "Error fetching size of dataset name buffer %ld\n", referenced_obj);
+	        H5Oclose(referenced_obj);
 	        return NULL;
 	    }
 
 	    // Create and populate buffer for object name
-	    char *referenced_obj_name = (char *)malloc(size_of_name_buffer);
+	    char *referenced_obj_name = attribute_arena_alloc(size_of_name_buffer);
 	    H5Iget_name(referenced_obj, referenced_obj_name, size_of_name_buffer); // Fill referenced_obj_name buffer with the dataset name
 
 	    if (DEBUG)
@@ -79,137 +354,233 @@ hobj_ref_t *copy_reference_object(hobj_ref_t *source_ref, int num_elements, hid_
 	    if (ref_dest_creation_return_value < 0) {
 	        if (DEBUG)
 	        	fprintf(log_ptr, "Error creating destination file reference %ld %s\n", dest_file_id, referenced_obj_name);
+	        H5Oclose(referenced_obj);
 	        return NULL;
 	    }
 
-	    free(referenced_obj_name);
+	    add_reference_memo_entry(REFERENCE_MEMO_OBJECT_ADDRESS, &memo_key)->dest_ref.object_ref = dest_ref[i];
+
+	    H5Oclose(referenced_obj);
 	}
     
 	return dest_ref;
 }
 
-herr_t copy_compound_type(hid_t src_id, void *src_buffer, void *dest_buffer, hid_t data_type, int num_elements, int num_members, size_t starting_offset) {
-	// Iterate over all elements in the compound attribute
-    for (hsize_t j = 0; j < num_elements; j++) {
-    	if (DEBUG)
-    		fprintf(log_ptr, "Copying element %ld\n", j);
+/*
+	Copy plan of a datatype: the slots of an element holding references or variable-length data, by offset.
+	The plain members of all elements are copied with a single memcpy, then only the slots are fixed up, element by element.
+	Nested compound members and arrays are flattened into the slots of the outer element, and adjacent slots of the same kind are merged.
+	Plans are compiled once per datatype and looked up with H5Tequal.
+*/
+enum {
+	TYPE_COPY_OBJECT_REFERENCE = 1, // hobj_ref_t, remapped with copy_reference_object
+	TYPE_COPY_REFERENCE = 2, // H5R_ref_t, remapped with copy_reference_object_H5R_ref_t
+	TYPE_COPY_VLEN = 3, // hvl_t, copied with copy_vlen_type
+};
+
+typedef struct {
+	int kind;
+	size_t offset;
+	size_t count;
+	hid_t type_id; // Datatype of a single slot, H5I_INVALID_HID for old-style references
+} type_copy_fixup;
+
+typedef struct {
+	hid_t type_id;
+	size_t size;
+	type_copy_fixup *fixups;
+	int num_fixups;
+} type_copy_plan;
+
+static type_copy_plan **type_copy_plans;
+static int type_copy_plans_size;
+
+static size_t get_type_copy_slot_size(int kind) {
+	return kind == TYPE_COPY_OBJECT_REFERENCE ? sizeof(hobj_ref_t) : kind == TYPE_COPY_REFERENCE ? sizeof(H5R_ref_t) : sizeof(hvl_t);
+}
 
-    	// Iterate over all members in an element
-		for (int i = 0; i < num_members; i++) {
-			if (DEBUG)
-    			fprintf(log_ptr, "Copying member %d\n", i);
+static void add_type_copy_fixup(type_copy_plan *plan, int kind, size_t offset, hid_t type_id) {
+	type_copy_fixup *last_fixup = plan->num_fixups > 0 ? &plan->fixups[plan->num_fixups - 1] : NULL;
+
+	// Slots following the previous one with the same datatype, such as the elements of an array, are fixed up in one call
+	if (last_fixup != NULL && last_fixup->kind == kind && last_fixup->offset + last_fixup->count * get_type_copy_slot_size(kind) == offset &&
+		(kind == TYPE_COPY_OBJECT_REFERENCE || H5Tequal(last_fixup->type_id, type_id) > 0)) {
+		last_fixup->count += 1;
+		return;
+	}
 
-			char *field_name = H5Tget_member_name(data_type, i);
-    		size_t field_offset = H5Tget_member_offset(data_type, i);
-    		hid_t field_type = H5Tget_member_type(data_type, i);
+	plan->fixups = realloc(plan->fixups, (plan->num_fixups + 1) * sizeof(type_copy_fixup));
+	plan->fixups[plan->num_fixups].kind = kind;
+	plan->fixups[plan->num_fixups].offset = offset;
+	plan->fixups[plan->num_fixups].count = 1;
+	plan->fixups[plan->num_fixups].type_id = kind == TYPE_COPY_OBJECT_REFERENCE ? H5I_INVALID_HID : H5Tcopy(type_id);
+	plan->num_fixups += 1;
+}
 
-    		// Get the precise offset of the member, depending on the starting offset of the compound type. 
-    		// Starting offset is 0 for the root compound type. For nested compound types, it is the field_offset of the parent compound type.
-    		size_t offset = starting_offset + field_offset;
+// Add the slots of a value of type type_id at offset within an element to the plan. Returns -1 if a slot cannot be remapped.
+static int compile_type_copy_plan(type_copy_plan *plan, hid_t type_id, size_t offset) {
+	H5T_class_t type_class = H5Tget_class(type_id);
+	int return_val = 0;
 
-    		if (DEBUG)
-    			fprintf(log_ptr, "Field name %s Field offset %ld Field type %d\n", field_name, field_offset, H5Tget_class(field_type));
-
-    		// Check datatype class of each datatype
-    		if (H5Tget_class(field_type) == H5T_REFERENCE) {
-    			if (H5Tget_size(field_type) == sizeof(hobj_ref_t)) {
-    				if (H5Tequal(H5Tget_super(field_type), H5T_STD_REF_OBJ)) {
-					    // TODO add check for REF_OBJ and DSET_REGION
-		        		hobj_ref_t *ref_data_dest = copy_reference_object(src_buffer + offset, 1, src_id);
-
-		        		if (ref_data_dest == NULL) {
-		        			return -1;
-		        		}
-
-		        		// Add member to the compound datatype in carved file
-				        H5Tinsert(data_type, field_name, offset, field_type);
-
-				        // Copy data to the offset of the member in destination buffer
-						memcpy(dest_buffer + offset, ref_data_dest, H5Tget_size(field_type));
-						free(ref_data_dest);
-					} else if (H5Tequal(H5Tget_super(field_type), H5T_STD_REF_DSETREG)) {
-						// TODO: Add support for dataset region references
-				    	printf("Dataset region references not supported yet.\n");
-				    	return NULL;
-					}
-    			} else if (H5Tget_size(field_type) == sizeof(H5R_ref_t)){
-					// TODO add check for REF_OBJ and DSET_REGION
-	        		void *ref_data_dest = copy_reference_object_H5R_ref_t(src_id, dest_file_id, field_type, 1, src_buffer + offset);
-
-	        		if (ref_data_dest == NULL) {
-	        			return -1;
-	        		}
-
-	        		// Add member to the compound datatype in carved file
-			        H5Tinsert(data_type, field_name, offset, field_type);
-
-			        // Copy data to the offset of the member in destination buffer
-					memcpy(dest_buffer + offset, ref_data_dest, H5Tget_size(field_type));
-					free(ref_data_dest);
-				}
-    		} else if (H5Tget_class(field_type) == H5T_COMPOUND) {
-    			// Get number of members for the nested compound datatype member
-				int nested_num_members = H5Tget_nmembers(field_type);
-
-				// Copy nested compound datatype member recursively
-    			herr_t copy_compound_type_return_value = copy_compound_type(src_id, src_buffer, dest_buffer, field_type, 1, nested_num_members, offset);
-
-    			if (copy_compound_type_return_value == -1) {
-    				return -1;
-    			}
-    		} else if (H5Tget_class(field_type) == H5T_VLEN) {
-				hvl_t *dest_data = copy_vlen_type(src_id, field_type, (hvl_t *)(src_buffer + offset), 1);
-				
-				if (dest_data == NULL) {
-					return -1;
+	if (type_class == H5T_REFERENCE) {
+		if (H5Tget_size(type_id) == sizeof(H5R_ref_t)) {
+			add_type_copy_fixup(plan, TYPE_COPY_REFERENCE, offset, type_id);
+		} else if (H5Tequal(type_id, H5T_STD_REF_OBJ) > 0) {
+			add_type_copy_fixup(plan, TYPE_COPY_OBJECT_REFERENCE, offset, type_id);
+		} else {
+			// Old-style dataset region references point into the source file and cannot be copied as raw bytes
+			if (DEBUG)
+				fprintf(log_ptr, "Dataset region references are not supported within compound or array datatypes\n");
+			return_val = -1;
+		}
+	} else if (type_class == H5T_VLEN) {
+		add_type_copy_fixup(plan, TYPE_COPY_VLEN, offset, type_id);
+	} else if (type_class == H5T_COMPOUND) {
+		int num_members = H5Tget_nmembers(type_id);
+
+		for (int i = 0; i < num_members && return_val == 0; i++) {
+			hid_t member_type_id = H5Tget_member_type(type_id, i);
+			return_val = compile_type_copy_plan(plan, member_type_id, offset + H5Tget_member_offset(type_id, i));
+			H5Tclose(member_type_id);
+		}
+	} else if (type_class == H5T_ARRAY) {
+		hid_t super_type_id = H5Tget_super(type_id);
+		H5T_class_t super_type_class = H5Tget_class(super_type_id);
+		int num_fixups = plan->num_fixups;
+
+		// Arrays of plain values are copied with the rest of the element
+		if (super_type_class == H5T_REFERENCE || super_type_class == H5T_VLEN || super_type_class == H5T_COMPOUND || super_type_class == H5T_ARRAY) {
+			size_t super_type_size = H5Tget_size(super_type_id);
+			size_t num_elements = H5Tget_size(type_id) / super_type_size;
+
+			for (size_t i = 0; i < num_elements && return_val == 0; i++) {
+				return_val = compile_type_copy_plan(plan, super_type_id, offset + i * super_type_size);
+
+				// Elements holding no slot need not be walked again
+				if (plan->num_fixups == num_fixups) {
+					break;
 				}
+			}
+		}
+
+		H5Tclose(super_type_id);
+	}
+
+	return return_val;
+}
+
+static void release_type_copy_plan(type_copy_plan *plan) {
+	for (int j = 0; j < plan->num_fixups; j++) {
+		if (plan->fixups[j].type_id != H5I_INVALID_HID)
+			H5Tclose(plan->fixups[j].type_id);
+	}
 
-				// Copy data to the offset of the member in destination buffer
-				memcpy(dest_buffer + offset, dest_data, H5Tget_size(field_type));
-				free(dest_data);
-    		} else if (H5Tget_class(field_type) == H5T_ARRAY) {
-    			hid_t base_type_id;
-		    	hsize_t total_elements = get_total_num_elems_and_base_type(field_type, &base_type_id);
+	H5Tclose(plan->type_id);
+	free(plan->fixups);
+	free(plan);
+}
+
+// Fetch the copy plan of a datatype, compiling it on first use. Returns NULL if the datatype holds values that cannot be copied.
+static type_copy_plan *get_type_copy_plan(hid_t data_type) {
+	for (int i = 0; i < type_copy_plans_size; i++) {
+		if (H5Tequal(type_copy_plans[i]->type_id, data_type) > 0) {
+			return type_copy_plans[i];
+		}
+	}
+
+	type_copy_plan *plan = calloc(1, sizeof(type_copy_plan));
+	plan->type_id = H5Tcopy(data_type);
+	plan->size = H5Tget_size(data_type);
+
+	if (compile_type_copy_plan(plan, data_type, 0) < 0) {
+		release_type_copy_plan(plan);
+		return NULL;
+	}
+
+	if (DEBUG)
+		fprintf(log_ptr, "Compiled copy plan of %zu bytes with %d fixups\n", plan->size, plan->num_fixups);
+
+	type_copy_plans = realloc(type_copy_plans, (type_copy_plans_size + 1) * sizeof(type_copy_plan *));
+	type_copy_plans[type_copy_plans_size] = plan;
+	type_copy_plans_size += 1;
+
+	return plan;
+}
+
+// Free the compiled copy plans. Called once the attributes of a carved file have been copied.
+void release_type_copy_plans(void) {
+	for (int i = 0; i < type_copy_plans_size; i++) {
+		release_type_copy_plan(type_copy_plans[i]);
+	}
+
+	free(type_copy_plans);
+	type_copy_plans = NULL;
+	type_copy_plans_size = 0;
+}
 
-		    	void *dest_data = copy_array(src_id, src_buffer + offset, field_type, base_type_id, total_elements);
-	    		
-				// Copy data to the offset of the member in destination buffer
-				memcpy(dest_buffer + offset, dest_data, H5Tget_size(field_type));
-				free(dest_data);
-    		} else {
-    			H5Tinsert(data_type, field_name, offset, field_type);
+// Copy num_elements elements following a copy plan from the source buffer into the destination buffer, remapping the references they hold to the carved file
+static herr_t apply_type_copy_plan(const type_copy_plan *plan, hid_t src_id, void *src_buffer, void *dest_buffer, hsize_t num_elements) {
+	// Plain members of all elements in a single copy
+	memcpy(dest_buffer, src_buffer, plan->size * num_elements);
 
-    			// Traverse to the appropriate offset in the source buffer 
-    			char *value = (char *)src_buffer + offset;
+	if (DEBUG)
+		fprintf(log_ptr, "Copying %llu elements with %d fixups each\n", (unsigned long long)num_elements, plan->num_fixups);
+
+	for (hsize_t j = 0; j < num_elements && plan->num_fixups > 0; j++) {
+		size_t element_offset = j * plan->size;
+
+		for (int i = 0; i < plan->num_fixups; i++) {
+			type_copy_fixup *fixup = &plan->fixups[i];
+			char *src_slot = (char *)src_buffer + element_offset + fixup->offset;
+			void *dest_slot_data;
+
+			if (fixup->kind == TYPE_COPY_OBJECT_REFERENCE) {
+				dest_slot_data = copy_reference_object((hobj_ref_t *)src_slot, fixup->count, src_id);
+			} else if (fixup->kind == TYPE_COPY_REFERENCE) {
+				dest_slot_data = copy_reference_object_H5R_ref_t(src_id, dest_file_id, fixup->type_id, fixup->count, (H5R_ref_t *)src_slot);
+			} else {
+				dest_slot_data = copy_vlen_type(src_id, fixup->type_id, (hvl_t *)src_slot, fixup->count);
+			}
+
+			if (dest_slot_data == NULL) {
+				return -1;
+			}
 
-    			// Copy data to the offset of the member in destination buffer
-				memcpy(dest_buffer + offset, value, H5Tget_size(field_type));
-    		}
+			memcpy((char *)dest_buffer + element_offset + fixup->offset, dest_slot_data, fixup->count * get_type_copy_slot_size(fixup->kind));
 		}
+	}
+
+	return 0;
+}
 
-		// Increment the starting offset by the size of each element of the compound datatype. 
-		// Each element of a compound datatype is positioned at an offset that is a multiple of its position in the compound datatype. 
-		// The offset of each element is the size of the compound datatype.
-    	starting_offset += (H5Tget_size(data_type));
+// Copy num_elements elements of a datatype from the source buffer into the destination buffer, remapping the references they hold to the carved file
+herr_t copy_type_elements(hid_t src_id, void *src_buffer, void *dest_buffer, hid_t data_type, hsize_t num_elements) {
+	type_copy_plan *plan = get_type_copy_plan(data_type);
+
+	if (plan == NULL) {
+		return -1;
 	}
+
+	return apply_type_copy_plan(plan, src_id, src_buffer, dest_buffer, num_elements);
 }
 
 hvl_t *copy_vlen_type(hid_t src_attribute_id, hid_t data_type, hvl_t *src_data, int num_elements) {
-	hvl_t *dest_data = malloc(num_elements * sizeof(hvl_t));
+	hvl_t *dest_data = attribute_arena_alloc(num_elements * sizeof(hvl_t));
+	hid_t super_data_type = scope_attribute_handle(H5Tget_super(data_type));
 
 	// Check datatype class of each datatype
-	if (H5Tget_class(H5Tget_super(data_type)) == H5T_REFERENCE) {
-		if (H5Tequal(H5Tget_super(data_type), H5T_STD_REF_OBJ)) {
+	if (H5Tget_class(super_data_type) == H5T_REFERENCE) {
+		if (H5Tequal(super_data_type, H5T_STD_REF_OBJ)) {
 			// Process the VLEN data
 		    for (int i = 0; i < num_elements; i++) {
 		    	if (DEBUG)
-    				fprintf(log_ptr, "Copying REFERENCE element %d len %ld\n", i, dest_data[i].len);
+    				fprintf(log_ptr, "Copying REFERENCE element %d len %ld\n", i, src_data[i].len);
 
     			// Create carved version of the ith element of the hvl_t struct
 			    dest_data[i].len = src_data[i].len;
 			 	dest_data[i].p = copy_reference_object(src_data[i].p, src_data[i].len, src_attribute_id);
 		    }
-		} else if (H5Tequal(H5Tget_super(data_type), H5T_STD_REF_DSETREG)) {
+		} else if (H5Tequal(super_data_type, H5T_STD_REF_DSETREG)) {
 			// TODO: Add support for dataset region references
         	printf("Dataset region references not supported yet.\n");
         	return NULL;
@@ -217,48 +588,40 @@ hvl_t *copy_vlen_type(hid_t src_attribute_id, hid_t data_type, hvl_t *src_data,
 			// Process the VLEN data
 		    for (int i = 0; i < num_elements; i++) {
 		    	if (DEBUG)
-    				fprintf(log_ptr, "Copying REFERENCE element %d len %ld\n", i, dest_data[i].len);
+    				fprintf(log_ptr, "Copying REFERENCE element %d len %ld\n", i, src_data[i].len);
 
     			// Create carved version of the ith element of the hvl_t struct
 			    dest_data[i].len = src_data[i].len;
 			 	dest_data[i].p = copy_reference_object_H5R_ref_t(src_attribute_id, dest_file_id, data_type, src_data[i].len, src_data[i].p);
 		    }
 		}
-	} else if (H5Tget_class(H5Tget_super(data_type)) == H5T_COMPOUND) {
-		for (int i = 0; i < num_elements; i++) {
-			// Get the size of the compound datatype
-	    	size_t size = H5Tget_size(H5Tget_super(data_type));
+	} else if (H5Tget_class(super_data_type) == H5T_COMPOUND || H5Tget_class(super_data_type) == H5T_ARRAY) {
+		// The plan of the element type is fetched once for all sequences
+		type_copy_plan *plan = get_type_copy_plan(super_data_type);
 
-	    	// Number of elements of the compound datatype is equal to the length of each hvl_t struct
-	    	hsize_t num_elements = src_data[i].len;
+		if (plan == NULL) {
+			return NULL;
+		}
 
+		for (int i = 0; i < num_elements; i++) {
 	    	// Create carved version of the ith element of the hvl_t struct
 	    	dest_data[i].len = src_data[i].len;
-	    	dest_data[i].p = malloc(size * num_elements);
-
-	    	// Get number of members in the compound datatype
-	    	hid_t vlen_element_data_type = H5Tget_super(data_type);
-    		int num_members = H5Tget_nmembers(vlen_element_data_type);
+	    	dest_data[i].p = attribute_arena_alloc(plan->size * src_data[i].len);
     		
     		if (DEBUG)
-    			fprintf(log_ptr, "Copying COMPOUND element %d len %ld members %d\n", i, dest_data[i].len, num_members);
-    		
-    		herr_t copy_compound_type_return_value = copy_compound_type(src_attribute_id, src_data[i].p, dest_data[i].p, vlen_element_data_type, num_elements, num_members, 0);
+    			fprintf(log_ptr, "Copying COMPOUND or ARRAY element %d len %ld\n", i, dest_data[i].len);
 
-    		if (copy_compound_type_return_value == -1) {
+    		if (apply_type_copy_plan(plan, src_attribute_id, src_data[i].p, dest_data[i].p, src_data[i].len) < 0) {
 				return NULL;
 			}
 		}
-	} else if (H5Tget_class(H5Tget_super(data_type)) == H5T_VLEN) {
+	} else if (H5Tget_class(super_data_type) == H5T_VLEN) {
 		for (int i = 0; i < num_elements; i++) {
-			size_t size = H5Tget_size(H5Tget_super(data_type));
 			hsize_t num_elements = src_data[i].len;
 
 			// Create carved version of the ith element of the hvl_t struct
 	    	dest_data[i].len = src_data[i].len;
-	    	dest_data[i].p = malloc(size * num_elements);
-	    	
-			dest_data[i].p = copy_vlen_type(src_attribute_id, H5Tget_super(data_type), (hvl_t *)(src_data[i].p), num_elements);
+			dest_data[i].p = copy_vlen_type(src_attribute_id, super_data_type, (hvl_t *)(src_data[i].p), num_elements);
 
 			if (DEBUG)
     			fprintf(log_ptr, "Copying VLEN element %d len %ld elements\n", i, num_elements);
@@ -267,40 +630,33 @@ hvl_t *copy_vlen_type(hid_t src_attribute_id, hid_t data_type, hvl_t *src_data,
 				return NULL;
 			}			
 		}
-	} else if (H5Tget_class(H5Tget_super(data_type)) == H5T_ARRAY) {
-		for (int i = 0; i < num_elements; i++) {
-			// Compute the total number of elements in the array
-	    	hid_t base_type_id;
-	    	hid_t super_data_type = H5Tget_super(data_type);
-	    	hsize_t total_elements = get_total_num_elems_and_base_type(super_data_type, &base_type_id);
-
-	    	dest_data[i].len = src_data[i].len;
-			dest_data[i].p = copy_array(src_attribute_id, src_data[i].p, super_data_type, H5Tcopy(base_type_id), total_elements * src_data[i].len);
-		}
 	} else {
 		// Process the VLEN data
 	    for (int i = 0; i < num_elements; i++) {
 	    	if (DEBUG)
-    				fprintf(log_ptr, "Copying OTHER element %d len %ld\n", i, dest_data[i].len);
+    				fprintf(log_ptr, "Copying OTHER element %d len %ld\n", i, src_data[i].len);
 
-    		// Iterate over each element of the hvl_t struct
-	        for (int j = 0; j < src_data[i].len; j++) {
-	    		// Create carved version of the ith element of the hvl_t struct
-	            dest_data[i].len = src_data[i].len;
-	            dest_data[i].p = src_data[i].p;
-	        }
+    		// Create carved version of the ith element of the hvl_t struct
+            dest_data[i].len = src_data[i].len;
+            dest_data[i].p = src_data[i].p;
 	    }
 	}
 
 	return dest_data;
 }	
 
-herr_t copy_attributes(hid_t loc_id, const char *name, const H5L_info_t *ainfo, void *opdata) {
+static herr_t copy_attributes_in_scope(hid_t loc_id, const char *name, const H5L_info_t *ainfo, void *opdata) {
 	if (DEBUG)
 		fprintf(log_ptr, "Copying attributes of object %s\n", name);
+
+	// Soft and external links are recreated as links in the skeleton, the attributes belong to the object they point to.
+	// Objects missing from a lazily built skeleton are skipped along with everything below them.
+	if (ainfo->type != H5L_TYPE_HARD || H5Lexists(*(hid_t *)opdata, name, H5P_DEFAULT) <= 0) {
+		return 0;
+	}
+
 	// Open the object
-	original_H5Oopen = dlsym(RTLD_NEXT, "H5Oopen");
-	hid_t object_id = original_H5Oopen(loc_id, name, H5P_DEFAULT);
+	hid_t object_id = scope_attribute_handle(original_H5Oopen(loc_id, name, H5P_DEFAULT));
 
 	if (object_id < 0) {
 		printf("Error opening object %ld %s\n", loc_id, name);
@@ -327,7 +683,7 @@ herr_t copy_attributes(hid_t loc_id, const char *name, const H5L_info_t *ainfo,
 	// Groups can be leaf nodes as well as subtrees whereas datasets can only be leaf nodes. 
 	// Continue traversing the graph in case of groups.
 	if (object_type == H5I_DATASET) {
-		hid_t dest_object_id = H5Dopen(dest_parent_object_id, name, H5P_DEFAULT);
+		hid_t dest_object_id = scope_attribute_handle(H5Dopen(dest_parent_object_id, name, H5P_DEFAULT));
 
 		if (dest_object_id < 0) {
 			printf("Error opening dest object %ld %s\n", dest_parent_object_id, name);
@@ -335,14 +691,14 @@ herr_t copy_attributes(hid_t loc_id, const char *name, const H5L_info_t *ainfo,
 		}
 
 		// Iterate over attributes at this level in the source file and make non-shallow copies in the destination file
-		herr_t attribute_iterate_return_val = H5Aiterate2(object_id, H5_INDEX_NAME, H5_ITER_INC, NULL, copy_object_attributes, &dest_object_id); // Iterate through each attribute and create a copy
+		herr_t attribute_iterate_return_val = original_H5Aiterate2(object_id, H5_INDEX_NAME, H5_ITER_INC, NULL, copy_object_attributes, &dest_object_id); // Iterate through each attribute and create a copy
 		
 		if (attribute_iterate_return_val < 0) {
 			printf("Attribute iteration failed\n");
 			return attribute_iterate_return_val;
 		}
 	} else if (object_type == H5I_GROUP) {
-		hid_t dest_object_id = original_H5Oopen(dest_parent_object_id, name, H5P_DEFAULT);
+		hid_t dest_object_id = scope_attribute_handle(original_H5Oopen(dest_parent_object_id, name, H5P_DEFAULT));
 
 		if (dest_object_id < 0) {
 			printf("Error opening dest object %ld %s\n", dest_parent_object_id, name);
@@ -350,7 +706,7 @@ herr_t copy_attributes(hid_t loc_id, const char *name, const H5L_info_t *ainfo,
 		}
 
 		// Iterate over attributes at this level in the source file and make non-shallow copies in the destination file
-		herr_t attribute_iterate_return_val = H5Aiterate2(object_id, H5_INDEX_NAME, H5_ITER_INC, NULL, copy_object_attributes, &dest_object_id); // Iterate through each attribute and create a copy
+		herr_t attribute_iterate_return_val = original_H5Aiterate2(object_id, H5_INDEX_NAME, H5_ITER_INC, NULL, copy_object_attributes, &dest_object_id); // Iterate through each attribute and create a copy
 		
 		if (attribute_iterate_return_val < 0) {
 			printf("Attribute iteration failed\n");
@@ -369,7 +725,17 @@ herr_t copy_attributes(hid_t loc_id, const char *name, const H5L_info_t *ainfo,
 	return 0;
 }
 
-int copy_object_attributes(hid_t loc_id, const char *name, const H5A_info_t *linfo, void *opdata) {
+// Copy the attributes of an object of the source file and of the objects below it. The objects opened are closed on return.
+herr_t copy_attributes(hid_t loc_id, const char *name, const H5L_info_t *ainfo, void *opdata) {
+	size_t scope = open_attribute_scope();
+	herr_t return_val = copy_attributes_in_scope(loc_id, name, ainfo, opdata);
+
+	close_attribute_scope(scope);
+
+	return return_val;
+}
+
+static int copy_object_attribute_in_scope(hid_t loc_id, const char *name, void *opdata) {
 	hid_t dest_attribute_id, attribute_data_type, attribute_data_space;
 	hid_t dest_object_id = *(hid_t *)opdata;
 
@@ -379,7 +745,7 @@ int copy_object_attributes(hid_t loc_id, const char *name, const H5A_info_t *lin
 	}
 
 	// Open the attribute
-	hid_t src_attribute_id = H5Aopen(loc_id, name, H5P_DEFAULT);
+	hid_t src_attribute_id = scope_attribute_handle(H5Aopen(loc_id, name, H5P_DEFAULT));
 
 	if (src_attribute_id < 0) {
 		if (DEBUG)
@@ -399,11 +765,11 @@ int copy_object_attributes(hid_t loc_id, const char *name, const H5A_info_t *lin
 	}
 
 	// Create and populate buffer for attribute name
-	char *name_of_attribute = (char *)malloc(size_of_name_buffer);
+	char *name_of_attribute = attribute_arena_alloc(size_of_name_buffer);
 	H5Aget_name(src_attribute_id, size_of_name_buffer, name_of_attribute);
 
 	// Fetch data type of attribute
-	attribute_data_type = H5Aget_type(src_attribute_id);
+	attribute_data_type = scope_attribute_handle(H5Aget_type(src_attribute_id));
 
 	if (attribute_data_type == H5I_INVALID_HID) {
 		if (DEBUG)
@@ -423,10 +789,10 @@ int copy_object_attributes(hid_t loc_id, const char *name, const H5A_info_t *lin
 	    }
 	    
 	    // Allocate memory to store the reference data
-	    hobj_ref_t *ref_data_src_file = malloc(num_elements * sizeof(hobj_ref_t));
+	    hobj_ref_t *ref_data_src_file = attribute_arena_alloc(num_elements * sizeof(hobj_ref_t));
 
 	    // Read the reference attribute into the allocated memory
-	    herr_t read_return_val = H5Aread(src_attribute_id, H5T_STD_REF_OBJ, ref_data_src_file);
+	    herr_t read_return_val = original_H5Aread(src_attribute_id, H5T_STD_REF_OBJ, ref_data_src_file);
 
 	    if (read_return_val < 0) {
 	        if (DEBUG)
@@ -441,10 +807,9 @@ int copy_object_attributes(hid_t loc_id, const char *name, const H5A_info_t *lin
 
 	        hobj_ref_t *ref_data_dest = copy_reference_object(ref_data_src_file, num_elements, src_attribute_id);
 
-	        free(ref_data_src_file);
 
 	        // Copy the dataspace
-	        hid_t ref_data_dest_dataspace = H5Aget_space(src_attribute_id);   
+	        hid_t ref_data_dest_dataspace = scope_attribute_handle(H5Aget_space(src_attribute_id));   
 	        if (ref_data_dest_dataspace < 0) {
 	            if (DEBUG)
     				fprintf(log_ptr, "Error copying dataspace %ld\n", src_attribute_id);
@@ -453,9 +818,9 @@ int copy_object_attributes(hid_t loc_id, const char *name, const H5A_info_t *lin
 
 	        // If attribute already exists, open the existing attribute. Otherwise, create the attribute.
 	        if (H5Aexists(dest_object_id, name_of_attribute)) {
-	        	dest_attribute_id = H5Aopen(dest_object_id, name_of_attribute, H5P_DEFAULT);
+	        	dest_attribute_id = scope_attribute_handle(H5Aopen(dest_object_id, name_of_attribute, H5P_DEFAULT));
 	        } else {
-	        	dest_attribute_id = H5Acreate2(dest_object_id, name_of_attribute, H5T_STD_REF_OBJ, ref_data_dest_dataspace, H5P_DEFAULT, H5P_DEFAULT);
+	        	dest_attribute_id = scope_attribute_handle(H5Acreate2(dest_object_id, name_of_attribute, H5T_STD_REF_OBJ, ref_data_dest_dataspace, H5P_DEFAULT, H5P_DEFAULT));
 	        }
 
 	        if (dest_attribute_id < 0) {
@@ -471,7 +836,6 @@ int copy_object_attributes(hid_t loc_id, const char *name, const H5A_info_t *lin
 	            return -1;
 	        }
 
-	        free(ref_data_dest);
 	    } else if (H5Tequal(attribute_data_type, H5T_STD_REF_DSETREG)) {
 	        // TODO: Add support for dataset region references
 	        if (DEBUG)
@@ -480,7 +844,7 @@ int copy_object_attributes(hid_t loc_id, const char *name, const H5A_info_t *lin
 	    }
     } else if (H5Tget_class(attribute_data_type) == H5T_COMPOUND) {
     	// Fetch data space of attribute
-		attribute_data_space = H5Aget_space(src_attribute_id);
+		attribute_data_space = scope_attribute_handle(H5Aget_space(src_attribute_id));
 
 		// Get the size of the compound datatype
 	    size_t size = H5Tget_size(attribute_data_type);
@@ -489,53 +853,54 @@ int copy_object_attributes(hid_t loc_id, const char *name, const H5A_info_t *lin
 	    H5Sget_simple_extent_dims(attribute_data_space, &num_points, NULL);
 
 	    // Allocate buffer to read the attribute
-	    void *src_buffer = malloc(size * num_points);
+	    void *src_buffer = attribute_arena_alloc(size * num_points);
 
-	    // Read the attribute data
-	    herr_t status = H5Aread(src_attribute_id, attribute_data_type, src_buffer);
+	    // Read the attribute data. The arena is not zeroed, so nothing read may be used after a failed read.
+	    herr_t read_return_val = original_H5Aread(src_attribute_id, attribute_data_type, src_buffer);
 
-	    hid_t dest_attribute_type = H5Tcreate(H5T_COMPOUND, size);
+	    if (read_return_val < 0) {
+	    	if (DEBUG)
+    			fprintf(log_ptr, "Error reading attribute %ld\n", src_attribute_id);
+	    	return read_return_val;
+	    }
 
 	    // Allocate buffer to read the attribute
-	    void *dest_buffer = malloc(size * num_points);
-
-	    // Get number of members in the compound datatype
-    	int num_members = H5Tget_nmembers(attribute_data_type);
+	    void *dest_buffer = attribute_arena_alloc(size * num_points);
 
     	if (DEBUG)
-    		fprintf(log_ptr, "Copying COMPOUND attribute %s %ld elements %d members\n", name_of_attribute, num_points, num_members);
-
-        herr_t copy_compound_type_return_value = copy_compound_type(src_attribute_id, src_buffer, dest_buffer, attribute_data_type, num_points, num_members, 0);
+    		fprintf(log_ptr, "Copying COMPOUND attribute %s %ld elements\n", name_of_attribute, num_points);
 
-        free(src_buffer);
+        herr_t return_val = copy_type_elements(src_attribute_id, src_buffer, dest_buffer, attribute_data_type, num_points);
 
-        if (copy_compound_type_return_value == -1) {
-        	return -1;
-        }
+        if (return_val >= 0) {
+		    // If attribute already exists, open the existing attribute. Otherwise, create the attribute.
+	        if (H5Aexists(dest_object_id, name_of_attribute)) {
+	        	dest_attribute_id = scope_attribute_handle(H5Aopen(dest_object_id, name_of_attribute, H5P_DEFAULT));
+	        } else {
+		    	dest_attribute_id = scope_attribute_handle(H5Acreate1(dest_object_id, name_of_attribute, attribute_data_type, attribute_data_space, H5P_DEFAULT));
+	        }
 
-	    // If attribute already exists, open the existing attribute. Otherwise, create the attribute.
-        if (H5Aexists(dest_object_id, name_of_attribute)) {
-        	dest_attribute_id = H5Aopen(dest_object_id, name_of_attribute, H5P_DEFAULT);
-        } else {
-	    	dest_attribute_id = H5Acreate1(dest_object_id, name_of_attribute, attribute_data_type, attribute_data_space, H5P_DEFAULT);
-        }
+		    if (dest_attribute_id < 0) {
+				if (DEBUG)
+	    			fprintf(log_ptr, "Error creating attribute %ld %s %ld %ld\n", dest_object_id, name_of_attribute, attribute_data_type, attribute_data_space);
+				return_val = dest_attribute_id;
+			} else {
+			    return_val = H5Awrite(dest_attribute_id, attribute_data_type, dest_buffer);
 
-	    if (dest_attribute_id < 0) {
-			if (DEBUG)
-    			fprintf(log_ptr, "Error creating attribute %ld %s %ld %ld\n", dest_object_id, name_of_attribute, attribute_data_type, attribute_data_space);
-			return dest_attribute_id;
+			    if (return_val < 0 && DEBUG)
+	    			fprintf(log_ptr, "Error writing attribute %ld %ld\n", dest_attribute_id, attribute_data_type);
+			}
 		}
 
-	    herr_t write_return_val = H5Awrite(dest_attribute_id, attribute_data_type, dest_buffer);
+	    // Variable-length members read are allocated by the library, and released whether or not the copy succeeded
+	    H5Treclaim(attribute_data_type, attribute_data_space, H5P_DEFAULT, src_buffer);
 
-	    if (write_return_val < 0) {
-			if (DEBUG)
-    			fprintf(log_ptr, "Error writing attribute %ld %ld\n", dest_attribute_id, attribute_data_type);
-			return write_return_val;
-		}
+	    if (return_val < 0) {
+	    	return return_val;
+	    }
     } else if (H5Tget_class(attribute_data_type) == H5T_VLEN) {
     	// Fetch data space of attribute
-		attribute_data_space = H5Aget_space(src_attribute_id);
+		attribute_data_space = scope_attribute_handle(H5Aget_space(src_attribute_id));
 
 		hsize_t dims[1];
 		H5Sget_simple_extent_dims(attribute_data_space, dims, NULL);
@@ -544,85 +909,80 @@ int copy_object_attributes(hid_t loc_id, const char *name, const H5A_info_t *lin
     		fprintf(log_ptr, "Copying VLEN attribute %s type %ld %ld elements\n", name_of_attribute, attribute_data_type, dims[0]);
 
     	// Allocate memory to read VLEN data
-		hvl_t *src_data = (hvl_t *)malloc(dims[0] * sizeof(hvl_t));
+		hvl_t *src_data = attribute_arena_alloc(dims[0] * sizeof(hvl_t));
 
-		herr_t status = H5Aread(src_attribute_id, attribute_data_type, src_data);
+		herr_t read_return_val = original_H5Aread(src_attribute_id, attribute_data_type, src_data);
+
+		if (read_return_val < 0) {
+			if (DEBUG)
+    			fprintf(log_ptr, "Error reading attribute %ld\n", src_attribute_id);
+			return read_return_val;
+		}
 		
 	    // If attribute already exists, open the existing attribute. Otherwise, create the attribute.
 		if (H5Aexists(dest_object_id, name_of_attribute)) {
-			dest_attribute_id = H5Aopen(dest_object_id, name_of_attribute, H5P_DEFAULT);
+			dest_attribute_id = scope_attribute_handle(H5Aopen(dest_object_id, name_of_attribute, H5P_DEFAULT));
 		} else {
-			dest_attribute_id = H5Acreate(dest_object_id, name_of_attribute, attribute_data_type, attribute_data_space, H5P_DEFAULT, H5P_DEFAULT);
-		}
-
-		hvl_t *dest_data = copy_vlen_type(src_attribute_id, attribute_data_type, src_data, dims[0]);
-
-		if (dest_data == NULL) {
-			return -1;
+			dest_attribute_id = scope_attribute_handle(H5Acreate(dest_object_id, name_of_attribute, attribute_data_type, attribute_data_space, H5P_DEFAULT, H5P_DEFAULT));
 		}
 
-	    herr_t write_status = H5Awrite(dest_attribute_id, attribute_data_type, dest_data);
+		hvl_t *dest_data = dest_attribute_id < 0 ? NULL : copy_vlen_type(src_attribute_id, attribute_data_type, src_data, dims[0]);
+		herr_t return_val = dest_data == NULL ? -1 : H5Awrite(dest_attribute_id, attribute_data_type, dest_data);
 	    
-	    if (write_status < 0) {
-	        if (DEBUG)
-    			fprintf(log_ptr, "Error writing attribute %ld %ld\n", dest_attribute_id, attribute_data_type);
-	        return write_status;
-	    }
-
-	    for (int i = 0; i < current_index; i++) {
-			H5Rdestroy(&created_reference_objects[i]);
-		}
+	    if (return_val < 0 && DEBUG)
+			fprintf(log_ptr, "Error copying attribute %s %ld\n", name_of_attribute, attribute_data_type);
 
-		current_index = 0;
+	    // The variable-length data read is allocated by the library, and released whether or not the copy succeeded
+	    H5Treclaim(attribute_data_type, attribute_data_space, H5P_DEFAULT, src_data);
 
-	    if ((H5Tget_class(H5Tget_super(attribute_data_type)) == H5T_COMPOUND) || (H5Tget_class(H5Tget_super(attribute_data_type)) == H5T_REFERENCE)) {
-	    	for (int i = 0; i < dims[0]; i++) {
-	    		free(dest_data[i].p);
-	    	}
+	    if (return_val < 0) {
+	    	return return_val;
 	    }
-
-	    free(dest_data);
-	    free(src_data);
     } else if (H5Tget_class(attribute_data_type) == H5T_ARRAY) {
-        // Compute the total number of elements in the array
-    	hid_t base_type_id;
-    	hid_t array_dtype_copy = H5Tcopy(attribute_data_type);
-    	hsize_t total_elements = get_total_num_elems_and_base_type(attribute_data_type, &base_type_id);
+    	hid_t array_dtype_copy = scope_attribute_handle(H5Tcopy(attribute_data_type));
 
     	// If attribute already exists, open the existing attribute. Otherwise, create the attribute.
 		if (H5Aexists(dest_object_id, name_of_attribute)) {
-			dest_attribute_id = H5Aopen(dest_object_id, name_of_attribute, H5P_DEFAULT);
+			dest_attribute_id = scope_attribute_handle(H5Aopen(dest_object_id, name_of_attribute, H5P_DEFAULT));
 		} else {
 			// dest_attribute_id = H5Acreate(dest_object_id, name_of_attribute, array_dtype_copy, H5Screate(H5S_SCALAR), H5P_DEFAULT, H5P_DEFAULT);
-			dest_attribute_id = H5Acreate(dest_object_id, name_of_attribute, array_dtype_copy, H5Screate(H5S_SCALAR), H5P_DEFAULT, H5P_DEFAULT);
+			dest_attribute_id = scope_attribute_handle(H5Acreate(dest_object_id, name_of_attribute, array_dtype_copy, scope_attribute_handle(H5Screate(H5S_SCALAR)), H5P_DEFAULT, H5P_DEFAULT));
 		}
 
 		// void *src_data = malloc(total_elements * H5Tget_size(base_type_id));
 		// void *src_data = malloc(H5Aget_storage_size(src_attribute_id));
-		void *src_data = malloc(H5Tget_size(attribute_data_type));
+		void *src_data = attribute_arena_alloc(H5Tget_size(attribute_data_type));
 
-		H5Aread(src_attribute_id, attribute_data_type, src_data);
+		herr_t read_return_val = original_H5Aread(src_attribute_id, attribute_data_type, src_data);
 
-		void *dest_data = copy_array(src_attribute_id, src_data, attribute_data_type, H5Tcopy(base_type_id), total_elements);
-		
-		herr_t write_status = H5Awrite(dest_attribute_id, array_dtype_copy, dest_data);
+		if (read_return_val < 0) {
+			if (DEBUG)
+    			fprintf(log_ptr, "Error reading attribute %ld\n", src_attribute_id);
+			return read_return_val;
+		}
+
+		// The elements of the array, nested ones included, are copied following the plan of the array datatype
+		void *dest_data = attribute_arena_alloc(H5Tget_size(attribute_data_type));
+		herr_t return_val = dest_attribute_id < 0 ? -1 : copy_type_elements(src_attribute_id, src_data, dest_data, attribute_data_type, 1);
+
+		if (return_val >= 0)
+			return_val = H5Awrite(dest_attribute_id, array_dtype_copy, dest_data);
 		
-		if (write_status < 0) {
-	        if (DEBUG)
-    			fprintf(log_ptr, "Error writing attribute %ld %ld\n", dest_attribute_id, array_dtype_copy);
-	        return write_status;
-	    }
+		if (return_val < 0 && DEBUG)
+			fprintf(log_ptr, "Error copying attribute %s %ld\n", name_of_attribute, array_dtype_copy);
 
-	    for (int i = 0; i < current_index; i++) {
-			H5Rdestroy(&created_reference_objects[i]);
+		// Variable-length elements read are allocated by the library, and released whether or not the copy succeeded
+		H5Treclaim(attribute_data_type, scope_attribute_handle(H5Aget_space(src_attribute_id)), H5P_DEFAULT, src_data);
+
+		if (return_val < 0) {
+			return return_val;
 		}
 
-		current_index = 0;
     } else {
     	if (DEBUG)
     		fprintf(log_ptr, "Copying OTHER attribute %s\n", name_of_attribute);
     	// Fetch data space of attribute
-		attribute_data_space = H5Aget_space(src_attribute_id);
+		attribute_data_space = scope_attribute_handle(H5Aget_space(src_attribute_id));
 
 		if (attribute_data_space < 0) {
 			if (DEBUG)
@@ -634,8 +994,8 @@ int copy_object_attributes(hid_t loc_id, const char *name, const H5A_info_t *lin
 		hsize_t attribute_data_size = H5Aget_storage_size(src_attribute_id);
 
 		// Create and populate buffer for attribute data
-		void* attribute_data_buffer = malloc(attribute_data_size);
-		herr_t read_return_val = H5Aread(src_attribute_id, attribute_data_type, attribute_data_buffer);
+		void* attribute_data_buffer = attribute_arena_alloc(attribute_data_size);
+		herr_t read_return_val = original_H5Aread(src_attribute_id, attribute_data_type, attribute_data_buffer);
 
 		if (read_return_val < 0) {
 			if (DEBUG)
@@ -644,10 +1004,10 @@ int copy_object_attributes(hid_t loc_id, const char *name, const H5A_info_t *lin
 		}
 
 		if (H5Aexists(dest_object_id, name_of_attribute)) {
-			dest_attribute_id = H5Aopen(dest_object_id, name_of_attribute, H5P_DEFAULT);
+			dest_attribute_id = scope_attribute_handle(H5Aopen(dest_object_id, name_of_attribute, H5P_DEFAULT));
 		} else {
 			// Create attribute in destination file
-			dest_attribute_id = H5Acreate1(dest_object_id, name_of_attribute, attribute_data_type, attribute_data_space, H5P_DEFAULT);
+			dest_attribute_id = scope_attribute_handle(H5Acreate1(dest_object_id, name_of_attribute, attribute_data_type, attribute_data_space, H5P_DEFAULT));
 		}
 		
 		if (dest_attribute_id < 0) {
@@ -665,88 +1025,59 @@ int copy_object_attributes(hid_t loc_id, const char *name, const H5A_info_t *lin
 			return write_return_val;
 		}
 
-		free(attribute_data_buffer);
     }
 
-    free(name_of_attribute);
 	return 0;
 }
 
-void *copy_array(hid_t src_attribute_id, void *src_data, hid_t attribute_data_type, hid_t base_type_id, int total_elements) {
-	if (H5Tget_class(base_type_id) == H5T_REFERENCE) {
-		if (H5Tequal(base_type_id, H5T_STD_REF_OBJ) > 0) {
-	    	// void *src_data = malloc(total_elements * H5Tget_size(base_type_id));
-
-			// H5Aread(src_attribute_id, attribute_data_type, src_data);
-
-			void *dest_data = copy_reference_object(src_data, total_elements, src_attribute_id);
-
-	    	return dest_data;
-	    }
-	    else if (H5Tequal(base_type_id, H5T_STD_REF_DSETREG) > 0) {
-	        printf("The datatype is H5T_STD_REF_DSETREG (dataset region reference).\n");
-	    }
-	    else {
-			// void *src_data = malloc(total_elements * sizeof(H5R_ref_t));
-
-			// H5Aread(src_attribute_id, attribute_data_type, src_data);
-
-			void *dest_data = copy_reference_object_H5R_ref_t(src_attribute_id, dest_file_id, attribute_data_type, total_elements, src_data);
-
-			return dest_data;
-	    }
-	} else if (H5Tget_class(base_type_id) == H5T_VLEN) {
-		void *dest_data = copy_vlen_type(src_attribute_id, base_type_id, src_data, total_elements);
-
-		if (dest_data == NULL) {
-			return -1;
-		}
-
-		return dest_data;
-	} else if (H5Tget_class(base_type_id) == H5T_COMPOUND) {
-		// Get number of members in the compound datatype
-    	int num_members = H5Tget_nmembers(base_type_id);
-
-    	void *dest_data = malloc(H5Tget_size(base_type_id) * total_elements);
-
-        herr_t copy_compound_type_return_value = copy_compound_type(src_attribute_id, src_data, dest_data, base_type_id, total_elements, num_members, 0);
-
-		return dest_data;
-		// return NULL;
-	} else {
-		void *src_data = malloc(total_elements * H5Tget_size(base_type_id));
+/*
+	Copy an attribute of an object of the source file to the matching object of the carved file. 
+	opdata points to the carved object. The buffers and identifiers of the copy are released in one step, error returns included.
+*/
+int copy_object_attributes(hid_t loc_id, const char *name, const H5A_info_t *linfo, void *opdata) {
+	size_t scope = open_attribute_scope();
+	int return_val = copy_object_attribute_in_scope(loc_id, name, opdata);
 
-		H5Aread(src_attribute_id, attribute_data_type, src_data);
+	close_attribute_scope(scope);
+	release_attribute_arena();
 
-		return src_data;		
-	}
+	return return_val;
 }
 
 /* 
  * This function reads references from src_attribute_id into an
  * internal buffer (src_data), dereferences them to get object names,
- * and then creates new references in dest_file_id stored in a 
- * heap-allocated array dest_data, which is returned.
+ * and then creates new references in dest_file_id stored in an
+ * array dest_data allocated from the attribute arena, which is returned.
  */
 H5R_ref_t* copy_reference_object_H5R_ref_t(hid_t src_attribute_id, hid_t dest_file_id, hid_t attribute_data_type, size_t total_elements, H5R_ref_t *src_data) {
     // Allocate array for the destination references (what we'll return)
-    H5R_ref_t *dest_data = (H5R_ref_t *)malloc(total_elements * sizeof(H5R_ref_t));
-
-    if (!dest_data) {
-        fprintf(stderr, "Failed to allocate memory for dest_data.\n");
-        free(src_data);
-        return NULL;
-    }
+    H5R_ref_t *dest_data = attribute_arena_alloc(total_elements * sizeof(H5R_ref_t));
 
     // Loop through all references, dereference them, fetch the object name,
     // then create the new reference in dest_file_id.
-    for (int i = 0; i < total_elements; i++) {
+    for (size_t i = 0; i < total_elements; i++) {
+        // Object references seen before are looked up by their value, without dereferencing them. The reference stays owned by the memo.
+        bool is_memoizable = H5Rget_type(&src_data[i]) == H5R_OBJECT2;
+        H5O_token_t memo_key;
+
+        if (is_memoizable) {
+            memcpy(&memo_key, &src_data[i], sizeof(H5O_token_t));
+            reference_memo_entry *memo_entry = get_reference_memo_entry(REFERENCE_MEMO_OBJECT_TOKEN, &memo_key);
+
+            if (memo_entry != NULL && H5Requal(&memo_entry->src_ref, &src_data[i]) > 0) {
+                dest_data[i] = memo_entry->dest_ref.ref;
+                continue;
+            }
+
+            // Another reference with the same key holds the slot
+            is_memoizable = memo_entry == NULL;
+        }
+
         hid_t referenced_obj = H5Rdereference1(src_attribute_id, H5R_OBJECT, &src_data[i]);
         if (referenced_obj < 0) {
             if (DEBUG)
                 fprintf(log_ptr, "Error dereferencing object %ld\n", (long)src_attribute_id);
-            free(src_data);
-            free(dest_data);
             return NULL;
         }
 
@@ -756,20 +1087,11 @@ H5R_ref_t* copy_reference_object_H5R_ref_t(hid_t src_attribute_id, hid_t dest_fi
             if (DEBUG)
                 fprintf(log_ptr, "Error fetching name length for object %ld\n", (long)referenced_obj);
             H5Oclose(referenced_obj);
-            free(src_data);
-            free(dest_data);
             return NULL;
         }
 
         // Allocate buffer for object name
-        char *referenced_obj_name = (char *)malloc((int)size_of_name_buffer);
-        if (!referenced_obj_name) {
-            fprintf(stderr, "Failed to allocate memory for referenced_obj_name.\n");
-            H5Oclose(referenced_obj);
-            free(src_data);
-            free(dest_data);
-            return NULL;
-        }
+        char *referenced_obj_name = attribute_arena_alloc(size_of_name_buffer);
 
         // Retrieve the object name into the buffer
         H5Iget_name(referenced_obj, referenced_obj_name, size_of_name_buffer);
@@ -784,18 +1106,24 @@ H5R_ref_t* copy_reference_object_H5R_ref_t(hid_t src_attribute_id, hid_t dest_fi
                 fprintf(log_ptr, "Error creating reference in destination.\n");
             }
             H5Oclose(referenced_obj);
-            free(referenced_obj_name);
-            free(src_data);
-            free(dest_data);
             return NULL;
         }
 
-        created_reference_objects[current_index] = dest_data[i];
-        current_index++;
+        // References not held by the memo are destroyed with it, once they have been written
+        H5R_ref_t memo_src_ref;
+
+        if (is_memoizable && H5Rcopy(&src_data[i], &memo_src_ref) >= 0) {
+            reference_memo_entry *memo_entry = add_reference_memo_entry(REFERENCE_MEMO_OBJECT_TOKEN, &memo_key);
+            memo_entry->src_ref = memo_src_ref;
+            memo_entry->dest_ref.ref = dest_data[i];
+        } else {
+            unmemoized_references = realloc(unmemoized_references, (unmemoized_references_size + 1) * sizeof(H5R_ref_t));
+            unmemoized_references[unmemoized_references_size] = dest_data[i];
+            unmemoized_references_size += 1;
+        }
 
         // Close & cleanup
         H5Oclose(referenced_obj);
-        free(referenced_obj_name);
     }
 
     // Return the pointer to the newly allocated references array
@@ -810,7 +1138,8 @@ hsize_t get_total_num_elems_and_base_type(hid_t type_id, hid_t *base_type_id) {
         H5Tget_array_dims(type_id, dims);
 
         // The super type might itself be H5T_ARRAY, descend recursively.
-        hid_t super_type_id = H5Tget_super(type_id);
+        // The base type is a super type too, so it stays open until the scope of the attribute being copied is closed.
+        hid_t super_type_id = scope_attribute_handle(H5Tget_super(type_id));
 
         // Get total elements in the nested array
         // hsize_t nested_count = get_total_num_elems_and_base_type(super_type_id, base_type_id, recursive_copy_type_id);
@@ -895,269 +1224,5468 @@ herr_t delete_attributes(hid_t loc_id, const char *name, const H5A_info_t *ainfo
 	}
 }
 
-// Copy structure of the HDF5 without copying contents. Essentially a DFS into the directed graph structure of an HDF5 file.
-// In the directed graph structure, datasets are leaf nodes and groups are sub-trees
-herr_t shallow_copy_object(hid_t loc_id, const char *name, const H5L_info_t *linfo, void *opdata) {
-	if (DEBUG)
-    	fprintf(log_ptr, "Creating shallow copy of object %ld %s\n", loc_id, name);
+/*
+	Keep a skeleton dataset from allocating raw data storage or writing fill values until it is carved.
+	Compact datasets keep their data in the object header, and external and virtual datasets have no storage of their own in the file.
+*/
+static void defer_skeleton_storage(hid_t create_plist) {
+	H5D_layout_t layout = H5Pget_layout(create_plist);
+
+	if (layout == H5D_CONTIGUOUS && H5Pget_external_count(create_plist) == 0) {
+		H5Pset_alloc_time(create_plist, H5D_ALLOC_TIME_LATE);
+	} else if (layout == H5D_CHUNKED) {
+		H5Pset_alloc_time(create_plist, H5D_ALLOC_TIME_INCR);
+	} else {
+		return;
+	}
 
-	// Open the object
-	original_H5Oopen = dlsym(RTLD_NEXT, "H5Oopen");
-	hid_t object_id = original_H5Oopen(loc_id, name, H5P_DEFAULT);
+	H5Pset_fill_time(create_plist, H5D_FILL_TIME_NEVER);
+}
 
-	if (object_id < 0) {
+/*
+	Create an empty copy of a source dataset at name relative to dest_loc_id, recorded as empty in the carving manifest.
+	carved_data_type is the copy in the carved file of the committed datatype of the dataset, which the copy links to, or H5I_INVALID_HID.
+*/
+static herr_t create_skeleton_dataset(hid_t dataset_id, hid_t dest_loc_id, const char *name, hid_t carved_data_type, bool is_storage_deferred) {
+	// Fetch data type of dataset
+	hid_t data_type = H5Dget_type(dataset_id);
+
+	if (data_type == H5I_INVALID_HID) {
 		if (DEBUG)
-    		fprintf(log_ptr, "Error opening object %ld %s\n", loc_id, name);
-    
-		return object_id;
+			fprintf(log_ptr, "Error fetching type of dataset %ld\n", dataset_id);
+		return data_type;
 	}
 
-	// Fetch id of parent object
-	hid_t *dest_parent_object_id = (hid_t *)opdata;
-	
-	if (dest_parent_object_id == NULL) {
-		if (DEBUG)
-    		fprintf(log_ptr, "Error due to NULL destination file parent object\n");
-
-		return -1;
+	// A committed datatype of the source file cannot be used in the carved file. Without a copy of it there, use a transient copy of it.
+	if (H5Tcommitted(data_type) > 0) {
+		hid_t transient_data_type = H5Tcopy(data_type);
+		H5Tclose(data_type);
+		data_type = transient_data_type;
 	}
 
-	// Fetch object type
-	H5I_type_t object_type = H5Iget_type(object_id);
+	// Create null dataspace for shallow copy
+	hid_t data_space = H5Dget_space(dataset_id);
 
-	if (object_type == H5I_BADID) {
+	if (data_space == H5I_INVALID_HID) {
 		if (DEBUG)
-    		fprintf(log_ptr, "Error fetching type of identifier %ld\n", object_id);
-
-		return object_type;
+			fprintf(log_ptr, "Error fetching data space of dataset %ld\n", dataset_id);
+		H5Tclose(data_type);
+		return data_space;
 	}
 
-	// Fetch length of name of object
+	// Fetch creation property list for the skeleton dataset
+	hid_t dest_dataset_create_plist = get_skeleton_create_plist(dataset_id, data_type, data_space);
+
+	if (dest_dataset_create_plist == H5I_INVALID_HID) {
+		if (DEBUG)
+			fprintf(log_ptr, "Error fetching creation property list of dataset %ld\n", dataset_id);
+		H5Sclose(data_space);
+		H5Tclose(data_type);
+		return dest_dataset_create_plist;
+	}
+
+	if (is_storage_deferred) {
+		defer_skeleton_storage(dest_dataset_create_plist);
+	}
+
+	// Create dataset in destination file
+	hid_t dest_dataset_id = H5Dcreate(dest_loc_id, name, carved_data_type >= 0 ? carved_data_type : data_type, data_space, H5P_DEFAULT, dest_dataset_create_plist, H5P_DEFAULT);
+	H5Pclose(dest_dataset_create_plist);
+
+	if (dest_dataset_id < 0) {
+		if (DEBUG)
+			fprintf(log_ptr, "Error creating shallow copy of dataset %s. dest_loc_id is %ld data_type %ld dataspace %ld\n", name, dest_loc_id, data_type, data_space);
+		H5Sclose(data_space);
+		H5Tclose(data_type);
+		return dest_dataset_id;
+	}
+
+	// Carved files created before the manifest mark empty datasets with an attribute
+	if (!add_empty_dataset_to_manifest(dest_dataset_id)) {
+		// Create a scalar dataspace for the attribute.
+		hid_t attr_dataspace_id = H5Screate(H5S_SCALAR);
+
+		// Create an attribute to indicate that the dataset is empty.
+		hid_t attr_id = H5Acreate2(dest_dataset_id, "CARVED_DATASET_IS_EMPTY", H5T_NATIVE_HBOOL, attr_dataspace_id, 
+								   H5P_DEFAULT, H5P_DEFAULT);
+
+		hbool_t is_empty = true;
+		H5Awrite(attr_id, H5T_NATIVE_HBOOL, &is_empty);
+
+		H5Aclose(attr_id);
+		H5Sclose(attr_dataspace_id);
+	}
+
+	H5Dclose(dest_dataset_id);
+	H5Sclose(data_space);
+	H5Tclose(data_type);
+
+	return 0;
+}
+
+herr_t create_empty_dataset(hid_t dataset_id, hid_t dest_loc_id, const char *name) {
+	return create_skeleton_dataset(dataset_id, dest_loc_id, name, H5I_INVALID_HID, is_skeleton_storage_deferred);
+}
+
+// Groups of the skeleton keep up to this many links in their object header before switching to dense storage
+#define SKELETON_GROUP_MAX_COMPACT 64
+#define SKELETON_GROUP_MIN_DENSE 48
+
+// Fetch the creation property list of skeleton groups, or H5P_DEFAULT
+static hid_t get_skeleton_group_create_plist(void) {
+	if (carved_file_page_size == 0) {
+		return H5P_DEFAULT;
+	}
+
+	hid_t create_plist = H5Pcreate(H5P_GROUP_CREATE);
+
+	if (create_plist < 0) {
+		return H5P_DEFAULT;
+	}
+
+	H5Pset_link_phase_change(create_plist, SKELETON_GROUP_MAX_COMPACT, SKELETON_GROUP_MIN_DENSE);
+
+	return create_plist;
+}
+
+// Open-addressing hash set of objects identified by their file number and token. Each object may carry a path.
+typedef struct {
+	carved_dataset_key *keys;
+	char **paths;
+	bool *slot_used;
+	size_t capacity;
+	size_t size;
+} object_key_set;
+
+static size_t hash_carved_dataset_key(const carved_dataset_key *key) {
+	// FNV-1a over the file number and the object token
+	uint64_t hash = 14695981039346656037ULL;
+	const unsigned char *bytes = (const unsigned char *)&key->fileno;
+
+	for (size_t i = 0; i < sizeof(key->fileno); i++) {
+		hash = (hash ^ bytes[i]) * 1099511628211ULL;
+	}
+
+	bytes = (const unsigned char *)&key->token;
+
+	for (size_t i = 0; i < sizeof(key->token); i++) {
+		hash = (hash ^ bytes[i]) * 1099511628211ULL;
+	}
+
+	return (size_t)hash;
+}
+
+static bool carved_dataset_keys_equal(const carved_dataset_key *a, const carved_dataset_key *b) {
+	return a->fileno == b->fileno && memcmp(&a->token, &b->token, sizeof(H5O_token_t)) == 0;
+}
+
+// Slot of an object in the set, or the free slot it would take
+static size_t find_object_key_slot(const object_key_set *set, const carved_dataset_key *key) {
+	size_t slot = hash_carved_dataset_key(key) & (set->capacity - 1);
+
+	while (set->slot_used[slot] && !carved_dataset_keys_equal(&set->keys[slot], key)) {
+		slot = (slot + 1) & (set->capacity - 1);
+	}
+
+	return slot;
+}
+
+static bool is_in_object_key_set(const object_key_set *set, const carved_dataset_key *key) {
+	return set->size > 0 && set->slot_used[find_object_key_slot(set, key)];
+}
+
+// Path an object was added with, NULL if it is not in the set or was added without one
+static const char *get_object_key_path(const object_key_set *set, const carved_dataset_key *key) {
+	if (set->size == 0) {
+		return NULL;
+	}
+
+	size_t slot = find_object_key_slot(set, key);
+
+	return set->slot_used[slot] ? set->paths[slot] : NULL;
+}
+
+// Add an object to the set with a copy of its path, or without one if path is NULL. An object already in the set keeps its path.
+static void add_to_object_key_set(object_key_set *set, const carved_dataset_key *key, const char *path) {
+	if (is_in_object_key_set(set, key)) {
+		return;
+	}
+
+	// Keep the load factor below one half, doubling and rehashing when exceeded
+	if ((set->size + 1) * 2 > set->capacity) {
+		object_key_set old_set = *set;
+
+		set->capacity = old_set.capacity == 0 ? 64 : old_set.capacity * 2;
+		set->keys = malloc(set->capacity * sizeof(carved_dataset_key));
+		set->paths = malloc(set->capacity * sizeof(char *));
+		set->slot_used = calloc(set->capacity, sizeof(bool));
+
+		for (size_t i = 0; i < old_set.capacity; i++) {
+			if (old_set.slot_used[i]) {
+				size_t slot = find_object_key_slot(set, &old_set.keys[i]);
+
+				set->keys[slot] = old_set.keys[i];
+				set->paths[slot] = old_set.paths[i];
+				set->slot_used[slot] = true;
+			}
+		}
+
+		free(old_set.keys);
+		free(old_set.paths);
+		free(old_set.slot_used);
+	}
+
+	size_t slot = find_object_key_slot(set, key);
+
+	set->keys[slot] = *key;
+	set->paths[slot] = NULL;
+	set->slot_used[slot] = true;
+	set->size += 1;
+
+	if (path != NULL) {
+		set->paths[slot] = malloc(strlen(path) + 1);
+		strcpy(set->paths[slot], path);
+	}
+}
+
+static void release_object_key_set(object_key_set *set) {
+	for (size_t i = 0; i < set->capacity; i++) {
+		if (set->slot_used[i]) {
+			free(set->paths[i]);
+		}
+	}
+
+	free(set->keys);
+	free(set->paths);
+	free(set->slot_used);
+	memset(set, 0, sizeof(object_key_set));
+}
+
+// Soft links followed on a path, as many as the library follows by default
+#define MAX_SOFT_LINKS_FOLLOWED 16
+
+// State of build_skeleton while it walks the links of the source file
+typedef struct {
+	hid_t src_root_group_id;
+	hid_t carved_file_id;
+	hid_t object_copy_plist;
+	hid_t dataset_copy_plist; // Also merges the committed datatypes of copied datasets with those already in the skeleton
+	object_key_set shared_objects; // Source objects reached through several hard links, with the path of the first one in the skeleton
+	object_key_set committed_types; // Committed datatypes of the source file, with their path in the skeleton
+	char **reference_objects; // Objects with attributes holding references, copied once the walk is complete
+	size_t reference_objects_size;
+	char **deferred_links; // Links to datasets reached before their committed datatype, added once the walk is complete
+	size_t deferred_links_size;
+	bool is_walk_complete;
+} skeleton_builder;
+
+/*
+	Whether the attributes of the source file are copied into its skeleton as it is built, rather than when the library terminates.
+	A lazily built skeleton gets its objects one by one, and a skeleton template is shared by files whose attributes differ.
+*/
+static bool are_attributes_copied_with_skeleton(void) {
+	return is_copying_all_attributes && !is_lazy_skeleton_mode && !is_skeleton_template_mode;
+}
+
+// Set while a skeleton template is built, which is cloned into carved files in other directories
+static bool is_building_skeleton_template;
+
+// Absolute path of a file, or its name if it has none. Identifies a file across the numbers the library gives it.
+static char *get_file_path(hid_t file_id) {
+	ssize_t filename_length = H5Fget_name(file_id, NULL, 0);
+
+	if (filename_length < 0) {
+		return NULL;
+	}
+
+	char *filename = malloc(filename_length + 1);
+	H5Fget_name(file_id, filename, filename_length + 1);
+
+	char *file_path = realpath(filename, NULL);
+
+	if (file_path == NULL) {
+		return filename;
+	}
+
+	free(filename);
+
+	return file_path;
+}
+
+// Absolute path of the directory holding a file, NULL if the file does not exist
+static char *get_file_directory(hid_t file_id) {
+	char *directory = get_file_path(file_id);
+
+	if (directory != NULL && directory[0] != '/') {
+		free(directory);
+		return NULL;
+	}
+
+	if (directory != NULL) {
+		*strrchr(directory, '/') = '\0';
+	}
+
+	return directory;
+}
+
+/*
+	File of an external link of the source file as seen from the carved file. The library resolves relative files from the directory of the file
+	holding the link, so relative files are rewritten relative to the directory of the carved file, to lead to the same file as in the source file.
+	Skeleton templates get the absolute path instead, since the directory of the carved files they are cloned into is not known.
+*/
+static char *get_carved_external_link_filename(hid_t src_loc_id, hid_t carved_file_id, const char *external_filename) {
+	char *src_directory = external_filename[0] == '/' ? NULL : get_file_directory(src_loc_id);
+	char *carved_directory_path = src_directory == NULL || is_building_skeleton_template ? NULL : get_file_directory(carved_file_id);
+
+	if (src_directory != NULL && is_building_skeleton_template) {
+		char *carved_external_filename = malloc(strlen(src_directory) + strlen(external_filename) + 2);
+		sprintf(carved_external_filename, "%s/%s", src_directory, external_filename);
+		free(src_directory);
+		return carved_external_filename;
+	}
+
+	if (carved_directory_path == NULL) {
+		char *carved_external_filename = malloc(strlen(external_filename) + 1);
+		strcpy(carved_external_filename, external_filename);
+		free(src_directory);
+		return carved_external_filename;
+	}
+
+	// Length of the leading directories the two paths share
+	size_t common_length = 0;
+
+	for (size_t i = 0; ; i++) {
+		bool is_src_boundary = src_directory[i] == '\0' || src_directory[i] == '/';
+		bool is_carved_boundary = carved_directory_path[i] == '\0' || carved_directory_path[i] == '/';
+
+		if (is_src_boundary && is_carved_boundary) {
+			common_length = i;
+		}
+
+		if (src_directory[i] != carved_directory_path[i] || src_directory[i] == '\0') {
+			break;
+		}
+	}
+
+	// Go up from the carved file to the shared directories, then down to the directory of the source file
+	size_t levels_up = 0;
+
+	for (const char *c = carved_directory_path + common_length; *c != '\0'; c++) {
+		if (*c == '/' && c[1] != '/' && c[1] != '\0') {
+			levels_up += 1;
+		}
+	}
+
+	const char *src_remainder = src_directory + common_length + (src_directory[common_length] == '/' ? 1 : 0);
+	char *carved_external_filename = malloc(levels_up * 3 + strlen(src_remainder) + strlen(external_filename) + 2);
+	carved_external_filename[0] = '\0';
+
+	for (size_t i = 0; i < levels_up; i++) {
+		strcat(carved_external_filename, "../");
+	}
+
+	if (src_remainder[0] != '\0') {
+		strcat(carved_external_filename, src_remainder);
+		strcat(carved_external_filename, "/");
+	}
+
+	strcat(carved_external_filename, external_filename);
+
+	free(src_directory);
+	free(carved_directory_path);
+
+	return carved_external_filename;
+}
+
+// Recreate a soft or external link of the source file in the carved file, instead of copying the object it points to
+static herr_t copy_symbolic_link(hid_t src_loc_id, hid_t carved_file_id, const char *name, const H5L_info2_t *link_info) {
+	char *link_value = malloc(link_info->u.val_size);
+	herr_t link_return_val = H5Lget_val(src_loc_id, name, link_value, link_info->u.val_size, H5P_DEFAULT);
+
+	if (link_return_val >= 0) {
+		if (link_info->type == H5L_TYPE_SOFT) {
+			link_return_val = H5Lcreate_soft(link_value, carved_file_id, name, H5P_DEFAULT, H5P_DEFAULT);
+		} else {
+			const char *external_filename, *external_object_name;
+			unsigned external_flags;
+
+			link_return_val = H5Lunpack_elink_val(link_value, link_info->u.val_size, &external_flags, &external_filename, &external_object_name);
+
+			if (link_return_val >= 0) {
+				char *carved_external_filename = get_carved_external_link_filename(src_loc_id, carved_file_id, external_filename);
+				link_return_val = H5Lcreate_external(carved_external_filename, external_object_name, carved_file_id, name, H5P_DEFAULT, H5P_DEFAULT);
+				free(carved_external_filename);
+			}
+		}
+	}
+
+	if (link_return_val < 0 && DEBUG)
+		fprintf(log_ptr, "Error copying link %s\n", name);
+
+	free(link_value);
+
+	return link_return_val < 0 ? link_return_val : 0;
+}
+
+// Pass over the attributes of an object added to the skeleton. Attributes holding references are copied in a pass of their own.
+typedef struct {
+	hid_t dest_object_id;
+	bool is_copying_references;
+	bool has_skipped_references;
+} skeleton_attribute_pass;
+
+static herr_t copy_skeleton_attribute(hid_t loc_id, const char *name, const H5A_info_t *ainfo, void *opdata) {
+	skeleton_attribute_pass *pass = (skeleton_attribute_pass *)opdata;
+	hid_t attribute_id = H5Aopen(loc_id, name, H5P_DEFAULT);
+	hid_t attribute_data_type = attribute_id < 0 ? H5I_INVALID_HID : H5Aget_type(attribute_id);
+	htri_t has_references = attribute_data_type < 0 ? -1 : H5Tdetect_class(attribute_data_type, H5T_REFERENCE);
+
+	if (attribute_data_type >= 0)
+		H5Tclose(attribute_data_type);
+	if (attribute_id >= 0)
+		H5Aclose(attribute_id);
+
+	if (has_references < 0) {
+		if (DEBUG)
+			fprintf(log_ptr, "Error fetching type of attribute %s\n", name);
+		return -1;
+	}
+
+	if ((has_references > 0) != pass->is_copying_references) {
+		pass->has_skipped_references = pass->has_skipped_references || has_references > 0;
+		return 0;
+	}
+
+	return copy_object_attributes(loc_id, name, ainfo, &pass->dest_object_id);
+}
+
+// Copy the attributes of an object of the source file onto the object at the same path in the skeleton, either those holding references or the others
+static herr_t copy_skeleton_object_attributes(skeleton_builder *builder, const char *name, bool is_copying_references, bool *has_skipped_references) {
+	skeleton_attribute_pass pass;
+	pass.dest_object_id = original_H5Oopen(builder->carved_file_id, name, H5P_DEFAULT);
+	pass.is_copying_references = is_copying_references;
+	pass.has_skipped_references = false;
+
+	hid_t src_object_id = original_H5Oopen(builder->src_root_group_id, name, H5P_DEFAULT);
+	herr_t return_val = -1;
+
+	if (src_object_id >= 0 && pass.dest_object_id >= 0) {
+		return_val = original_H5Aiterate2(src_object_id, H5_INDEX_NAME, H5_ITER_INC, NULL, copy_skeleton_attribute, &pass);
+	}
+
+	if (src_object_id >= 0)
+		H5Oclose(src_object_id);
+	if (pass.dest_object_id >= 0)
+		H5Oclose(pass.dest_object_id);
+
+	if (return_val < 0) {
+		if (DEBUG)
+			fprintf(log_ptr, "Error copying attributes of %s to skeleton\n", name);
+		return return_val;
+	}
+
+	// References may point to objects the walk has not reached yet
+	if (pass.has_skipped_references) {
+		builder->reference_objects = realloc(builder->reference_objects, (builder->reference_objects_size + 1) * sizeof(char *));
+		builder->reference_objects[builder->reference_objects_size] = malloc(strlen(name) + 1);
+		strcpy(builder->reference_objects[builder->reference_objects_size], name);
+		builder->reference_objects_size += 1;
+	}
+
+	return 0;
+}
+
+static void defer_skeleton_link(skeleton_builder *builder, const char *name) {
+	builder->deferred_links = realloc(builder->deferred_links, (builder->deferred_links_size + 1) * sizeof(char *));
+	builder->deferred_links[builder->deferred_links_size] = malloc(strlen(name) + 1);
+	strcpy(builder->deferred_links[builder->deferred_links_size], name);
+	builder->deferred_links_size += 1;
+}
+
+// Stop H5Ocopy from searching the whole carved file for a committed datatype to merge with, once the paths of the skeleton's committed datatypes are searched
+static H5O_mcdt_search_ret_t stop_committed_type_search(void *op_data) {
+	(void)op_data;
+
+	return H5O_MCDT_SEARCH_STOP;
+}
+
+/*
+	Add a dataset of the source file to the skeleton. A dataset with a committed datatype links to the copy of the datatype in the skeleton.
+	Returns 1 without adding it when the walk has not reached its committed datatype yet, 0 when it was added, and a negative value on error.
+*/
+static herr_t build_skeleton_dataset(skeleton_builder *builder, const char *name) {
+	hid_t dataset_id = H5Dopen(builder->src_root_group_id, name, H5P_DEFAULT);
+
+	if (dataset_id < 0) {
+		return -1;
+	}
+
+	hid_t data_type = H5Dget_type(dataset_id);
+	hid_t carved_data_type = H5I_INVALID_HID;
+	herr_t return_val = data_type < 0 ? -1 : 0;
+
+	if (return_val == 0 && H5Tcommitted(data_type) > 0) {
+		H5O_info2_t type_info;
+		const char *carved_type_path = NULL;
+
+		if (H5Oget_info3(data_type, &type_info, H5O_INFO_BASIC) >= 0) {
+			carved_dataset_key key;
+			memset(&key, 0, sizeof(carved_dataset_key));
+			key.fileno = type_info.fileno;
+			key.token = type_info.token;
+
+			carved_type_path = get_object_key_path(&builder->committed_types, &key);
+		}
+
+		// Committed datatypes without a link in the source file are never reached, their datasets use a transient copy
+		if (carved_type_path != NULL) {
+			carved_data_type = H5Topen2(builder->carved_file_id, carved_type_path, H5P_DEFAULT);
+		} else if (!builder->is_walk_complete) {
+			return_val = 1;
+		}
+	}
+
+	if (return_val == 0) {
+		// Datasets without allocated storage hold no raw data, so the library copies them as they are. There is nothing left to carve.
+		if (H5Dget_storage_size(dataset_id) == 0) {
+			return_val = H5Ocopy(builder->src_root_group_id, name, builder->carved_file_id, name, builder->dataset_copy_plist, H5P_DEFAULT);
+		} else {
+			return_val = create_skeleton_dataset(dataset_id, builder->carved_file_id, name, carved_data_type, is_skeleton_storage_deferred);
+		}
+	}
+
+	if (carved_data_type >= 0)
+		H5Tclose(carved_data_type);
+	if (data_type >= 0)
+		H5Tclose(data_type);
+
+	H5Dclose(dataset_id);
+
+	return return_val;
+}
+
+// H5Lvisit2 callback adding the object a link leads to, by its path from the root, to the skeleton
+static herr_t build_skeleton_link(hid_t group_id, const char *name, const H5L_info2_t *link_info, void *opdata) {
+	skeleton_builder *builder = (skeleton_builder *)opdata;
+
+	// When a lazily built skeleton is completed, links already added to it are left as they are
+	if (is_lazy_skeleton_mode && H5Lexists(builder->carved_file_id, name, H5P_DEFAULT) > 0) {
+		return 0;
+	}
+
+	if (link_info->type == H5L_TYPE_SOFT || link_info->type == H5L_TYPE_EXTERNAL) {
+		return copy_symbolic_link(builder->src_root_group_id, builder->carved_file_id, name, link_info);
+	}
+
+	if (link_info->type != H5L_TYPE_HARD) {
+		return 0;
+	}
+
+	H5O_info2_t object_info;
+
+	if (H5Oget_info_by_name3(builder->src_root_group_id, name, &object_info, H5O_INFO_BASIC, H5P_DEFAULT) < 0) {
+		if (DEBUG)
+			fprintf(log_ptr, "Error fetching object info of %s\n", name);
+		return -1;
+	}
+
+	// An object reached through several hard links is created once, the other links point to it
+	if (object_info.rc > 1) {
+		carved_dataset_key key;
+		memset(&key, 0, sizeof(carved_dataset_key));
+		key.fileno = object_info.fileno;
+		key.token = object_info.token;
+
+		const char *shared_object_path = get_object_key_path(&builder->shared_objects, &key);
+
+		if (shared_object_path != NULL && strcmp(shared_object_path, name) != 0) {
+			// The first link may lead to a dataset deferred until the walk is complete
+			if (!builder->is_walk_complete && H5Lexists(builder->carved_file_id, shared_object_path, H5P_DEFAULT) <= 0) {
+				defer_skeleton_link(builder, name);
+				return 0;
+			}
+
+			return H5Lcreate_hard(builder->carved_file_id, shared_object_path, builder->carved_file_id, name, H5P_DEFAULT, H5P_DEFAULT);
+		}
+
+		if (shared_object_path == NULL)
+			add_to_object_key_set(&builder->shared_objects, &key, name);
+	}
+
+	herr_t return_val = 0;
+
+	if (object_info.type == H5O_TYPE_GROUP) {
+		hid_t group_create_plist = get_skeleton_group_create_plist();
+		hid_t carved_group_id = H5Gcreate2(builder->carved_file_id, name, H5P_DEFAULT, group_create_plist, H5P_DEFAULT);
+
+		if (group_create_plist != H5P_DEFAULT)
+			H5Pclose(group_create_plist);
+
+		if (carved_group_id < 0) {
+			return_val = -1;
+		} else {
+			H5Gclose(carved_group_id);
+		}
+	} else if (object_info.type == H5O_TYPE_DATASET) {
+		return_val = build_skeleton_dataset(builder, name);
+
+		if (return_val == 1) {
+			defer_skeleton_link(builder, name);
+			return 0;
+		}
+	} else if (object_info.type == H5O_TYPE_NAMED_DATATYPE) {
+		// Committed datatypes hold no raw data either. Datasets using them link to the copy.
+		return_val = H5Ocopy(builder->src_root_group_id, name, builder->carved_file_id, name, builder->object_copy_plist, H5P_DEFAULT);
+
+		if (return_val >= 0) {
+			carved_dataset_key key;
+			memset(&key, 0, sizeof(carved_dataset_key));
+			key.fileno = object_info.fileno;
+			key.token = object_info.token;
+
+			add_to_object_key_set(&builder->committed_types, &key, name);
+			H5Padd_merge_committed_dtype_path(builder->dataset_copy_plist, name);
+		}
+	}
+
+	if (return_val < 0) {
+		if (DEBUG)
+			fprintf(log_ptr, "Error adding %s to skeleton\n", name);
+		return return_val;
+	}
+
+	// The attributes are copied along with the object
+	if (are_attributes_copied_with_skeleton()) {
+		return_val = copy_skeleton_object_attributes(builder, name, false, NULL);
+	}
+
+	return return_val;
+}
+
+/*
+	Make a copy of the structure of the source file in the carved file without its raw data, i.e. a "skeleton", in a single walk of the links of the source file.
+	Groups are created empty and datasets with their type, dataspace and a skeleton creation property list. Objects without raw data, 
+	i.e. committed datatypes and datasets with no storage allocated, are copied by the library. Datasets link to the copies of their committed datatypes,
+	and those reached before their datatype are added once the walk is complete. When every attribute is carved, attributes
+	are copied in the same walk, except those holding references, which are copied once all objects they may point to are in the skeleton.
+	Otherwise attributes are copied when the library terminates.
+*/
+herr_t build_skeleton(hid_t src_file, hid_t carved_file) {
+	skeleton_builder builder;
+	memset(&builder, 0, sizeof(skeleton_builder));
+	builder.src_root_group_id = H5Gopen(src_file, "/", H5P_DEFAULT);
+	builder.carved_file_id = carved_file;
+	builder.object_copy_plist = H5Pcreate(H5P_OBJECT_COPY);
+	builder.dataset_copy_plist = H5Pcreate(H5P_OBJECT_COPY);
+
+	if (builder.src_root_group_id == H5I_INVALID_HID) {
+		if (DEBUG)
+			fprintf(log_ptr, "Error opening source file root group %ld\n", src_file);
+		H5Pclose(builder.object_copy_plist);
+		H5Pclose(builder.dataset_copy_plist);
+		return -1;
+	}
+
+	// Attributes are copied by copy_object_attributes, so that references in them are remapped to the carved file
+	H5Pset_copy_object(builder.object_copy_plist, H5O_COPY_WITHOUT_ATTR_FLAG);
+	H5Pset_copy_object(builder.dataset_copy_plist, H5O_COPY_WITHOUT_ATTR_FLAG | H5O_COPY_MERGE_COMMITTED_DTYPE_FLAG);
+	H5Pset_mcdt_search_cb(builder.dataset_copy_plist, stop_committed_type_search, NULL);
+
+	// References in attributes are remapped through the global source and carved file
+	src_file_id = src_file;
+	dest_file_id = carved_file;
+
+	herr_t return_val = are_attributes_copied_with_skeleton() ? copy_skeleton_object_attributes(&builder, "/", false, NULL) : 0;
+
+	if (return_val >= 0) {
+		return_val = H5Lvisit2(builder.src_root_group_id, H5_INDEX_NAME, H5_ITER_INC, build_skeleton_link, &builder);
+	}
+
+	// Every committed datatype reachable by a link has been copied, the deferred datasets and their other links can be added
+	builder.is_walk_complete = true;
+
+	for (size_t i = 0; i < builder.deferred_links_size; i++) {
+		H5L_info2_t link_info;
+
+		if (return_val >= 0) {
+			return_val = H5Lget_info2(builder.src_root_group_id, builder.deferred_links[i], &link_info, H5P_DEFAULT);
+		}
+
+		if (return_val >= 0) {
+			return_val = build_skeleton_link(builder.src_root_group_id, builder.deferred_links[i], &link_info, &builder);
+		}
+
+		free(builder.deferred_links[i]);
+	}
+
+	for (size_t i = 0; i < builder.reference_objects_size; i++) {
+		if (return_val >= 0) {
+			return_val = copy_skeleton_object_attributes(&builder, builder.reference_objects[i], true, NULL);
+		}
+
+		free(builder.reference_objects[i]);
+	}
+
+	if (are_attributes_copied_with_skeleton()) {
+		release_reference_memo();
+		release_type_copy_plans();
+	}
+
+	free(builder.reference_objects);
+	free(builder.deferred_links);
+	release_object_key_set(&builder.shared_objects);
+	release_object_key_set(&builder.committed_types);
+	H5Pclose(builder.object_copy_plist);
+	H5Pclose(builder.dataset_copy_plist);
+	H5Gclose(builder.src_root_group_id);
+
+	return return_val;
+}
+
+// Copy structure of the HDF5 without copying contents. Essentially a DFS into the directed graph structure of an HDF5 file.
+// In the directed graph structure, datasets are leaf nodes and groups are sub-trees
+herr_t shallow_copy_object(hid_t loc_id, const char *name, const H5L_info_t *linfo, void *opdata) {
+	if (DEBUG)
+    	fprintf(log_ptr, "Creating shallow copy of object %ld %s\n", loc_id, name);
+
+	// Open the object
+	hid_t object_id = original_H5Oopen(loc_id, name, H5P_DEFAULT);
+
+	if (object_id < 0) {
+		if (DEBUG)
+    		fprintf(log_ptr, "Error opening object %ld %s\n", loc_id, name);
+    
+		return object_id;
+	}
+
+	// Fetch id of parent object
+	hid_t *dest_parent_object_id = (hid_t *)opdata;
+	
+	if (dest_parent_object_id == NULL) {
+		if (DEBUG)
+    		fprintf(log_ptr, "Error due to NULL destination file parent object\n");
+
+		return -1;
+	}
+
+	// Fetch object type
+	H5I_type_t object_type = H5Iget_type(object_id);
+
+	if (object_type == H5I_BADID) {
+		if (DEBUG)
+    		fprintf(log_ptr, "Error fetching type of identifier %ld\n", object_id);
+
+		return object_type;
+	}
+
+	// Fetch length of name of object
 	int size_of_name_buffer = H5Iget_name(object_id, NULL, 0) + 1; // Preliminary call to fetch length of object name
 
-	if (size_of_name_buffer == 0) {
+	if (size_of_name_buffer == 0) {
+		if (DEBUG)
+    		fprintf(log_ptr, "Error fetching size of name %ld\n", object_id);
+		return -1;
+	}
+	
+	// If object is a dataset, make shallow copy of dataset and terminate
+	if (object_type == H5I_DATASET) {
+		hid_t dataset_id;
+
+		// Create and populate buffer for name of dataset
+    	char *object_name = (char *)malloc(size_of_name_buffer);
+    	H5Iget_name(object_id, object_name, size_of_name_buffer); // Fill object_name buffer with the name
+
+		// When a lazily built skeleton is completed, datasets already added to it are left as they are
+		if (is_lazy_skeleton_mode && H5Lexists(*dest_parent_object_id, object_name, H5P_DEFAULT) > 0) {
+			H5Oclose(object_id);
+			free(object_name);
+			return 0;
+		}
+
+		// Open the dataset
+		dataset_id = H5Dopen(src_file_id, object_name, H5P_DEFAULT);
+
+		if (dataset_id == H5I_INVALID_HID) {
+			if (DEBUG)
+    			fprintf(log_ptr, "Error opening dataset %ld %s\n", src_file_id, object_name);
+
+			return dataset_id;
+		}
+
+		// Create the empty dataset in the destination file
+		herr_t create_return_val = create_empty_dataset(dataset_id, *dest_parent_object_id, object_name);
+
+		if (create_return_val < 0) {
+			return create_return_val;
+		}
+
+	    H5Dclose(dataset_id);
+	    free(object_name);
+
+	// If object is a group, make shallow copy of the group and recursively go down the tree
+	} else if (object_type == H5I_GROUP) {
+		// Create group in destination file. When a lazily built skeleton is completed, groups already added to it are completed in place.
+		hid_t dest_group_id;
+
+		if (is_lazy_skeleton_mode && H5Lexists(*dest_parent_object_id, name, H5P_DEFAULT) > 0) {
+			dest_group_id = H5Gopen(*dest_parent_object_id, name, H5P_DEFAULT);
+		} else {
+			dest_group_id = H5Gcreate1(*dest_parent_object_id, name, size_of_name_buffer);
+		}
+
+		if (dest_group_id < 0) {
+			if (DEBUG)
+    			fprintf(log_ptr, "Error creating shallow copy of group %s. dest_parent_object_id is %ld\n", name, *dest_parent_object_id);
+
+			return dest_group_id;
+		}
+
+		// Iterate over objects at this level in the source file, and make shallow copes in the destination file
+		herr_t link_iterate_return_val = H5Literate2(object_id, H5_INDEX_NAME, H5_ITER_INC, NULL, shallow_copy_object, &dest_group_id);
+
+		if (link_iterate_return_val < 0) {
+			if (DEBUG)
+    			fprintf(log_ptr, "Link iteration failed\n");
+			return link_iterate_return_val;
+		}	
+	}
+	
+	return 0;
+}
+
+char *get_carved_filename(const char *filename, char *is_netcdf4, char *use_carved) {
+	// Make a copy of the filename.
+	char *filename_copy;
+	filename_copy = malloc(strlen(filename) + 1);
+	strcpy(filename_copy, filename);
+
+	// If original file is a netCDF4 file and tool is being used in re-execution mode, interposed nc_open returns filename with the .carved suffix, leading to the carved file name being <filename>.carved.carved.
+	// Removes .carved suffix for netCDF4 files in re-execution mode.
+	if (strlen(filename_copy) >= 7 && strcmp(filename_copy + (strlen(filename_copy) - 7), ".carved") == 0) {
+                filename_copy[strlen(filename_copy) - 7] = '\0';
+        }
+
+	// Traverse the file path to get to the last occurrence of directory separtors to get to name of the file
+	char *filename_without_directories = strrchr(filename_copy, '/');
+
+	// If there are no directory separators in filename, strrchr returns NULL. 
+	// If it has returned NULL, replace variable back with the filename. 
+	// Otherwise, increment by 1 to skip the last directory separator
+	if (filename_without_directories != NULL) {
+	        filename_without_directories = filename_without_directories + 1;
+	} else {
+	        filename_without_directories = filename_copy;
+	}
+
+	char *carved_filename;
+	int carved_filename_length_without_suffix;
+
+	// If no directory is specified for the carved files, the length of the carved file directory path does not need to be considered.
+	// If a directory is specified for the carved files, the length of the carved file directory path needs to be included when allocating memory.
+	if (carved_directory == NULL) {
+		carved_filename_length_without_suffix = strlen(filename);
+	} else {
+		carved_filename_length_without_suffix = strlen(carved_directory) + strlen(filename_without_directories);
+	}
+
+	carved_filename = (char *)malloc(carved_filename_length_without_suffix + 7 + 1); // 7 + 1 is for the suffix .carved and null terminating character
+
+	// Construct the path of the carved file.
+	// If no directory for carved files is specified, carved files are created in the same location as the original files.
+	// If a directory for carved files is specified, carved files are created in the specified directory. 
+	if (carved_directory == NULL) {
+	    carved_filename[0] = '\0';
+		strcat(carved_filename, filename_copy);
+		strcat(carved_filename, ".carved");	
+	} else {
+		carved_filename[0] = '\0';
+		strcat(carved_filename, carved_directory);
+		strcat(carved_filename, filename_without_directories);
+		strcat(carved_filename, ".carved");
+	}
+
+	free(filename_copy);
+
+	return carved_filename;
+}
+
+bool does_dataset_exist(hid_t dataset_id) {
+	// Look the dataset up in the manifest of its carved file, which costs no file access
+	int manifest_status = get_manifest_status(dataset_id);
+
+	if (manifest_status >= 0) {
+		return manifest_status == 0;
+	}
+
+	// If the CARVED_DATASET_IS_EMPTY attribute does not exist, the dataset is not empty.
+	if (!H5Aexists(dataset_id, "CARVED_DATASET_IS_EMPTY")) {
+		return true;
+	}
+
+	hid_t attr_id = H5Aopen(dataset_id, "CARVED_DATASET_IS_EMPTY", H5P_DEFAULT);
+
+	if (attr_id < 0) {
+		if (DEBUG)
+    		fprintf(log_ptr, "Error opening CARVED_DATASET_IS_EMPTY attribute %ld\n", dataset_id);
+		return attr_id;
+	}
+
+	hbool_t is_empty;
+
+	herr_t attribute_read_ret = original_H5Aread(attr_id, H5T_NATIVE_UINT8, &is_empty);
+
+	if (attribute_read_ret < 0) {
+		if (DEBUG)
+    		fprintf(log_ptr, "Error reading CARVED_DATASET_IS_EMPTY attribute %ld\n", attr_id);
+		return attribute_read_ret;
+	}
+
+	return !(is_empty == true);
+}
+
+bool is_already_recorded(const char *filename) {
+	for (int i = 0; i < files_opened_current_size; i++) {
+		if (strcmp(files_opened[i], filename) == 0) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+herr_t create_fallback_metadata(const char *filename, hid_t destination_root_group) {
+	hsize_t dims[1] = {1};
+	hid_t fallback_attribute_dataspace = H5Screate(H5S_SIMPLE);
+    H5Sset_extent_simple(fallback_attribute_dataspace, 1, dims, dims);
+    char file_absolute_path[PATH_MAX];
+    realpath(filename, file_absolute_path);
+    int file_absolute_path_length = strlen(file_absolute_path);
+
+    hid_t fallback_compound_type = H5Tcreate(H5T_COMPOUND, sizeof(fallback_enum) + file_absolute_path_length);
+
+    hid_t enum_type = H5Tcreate(H5T_ENUM, sizeof(fallback_enum));
+
+    int enum_value;
+    enum_value = LOCAL;
+    H5Tenum_insert(enum_type, "LOCAL", &enum_value);
+    enum_value = REMOTE;
+    H5Tenum_insert(enum_type, "REMOTE", &enum_value);
+
+    H5Tinsert(fallback_compound_type, "FALLBACK_TYPE", 0, enum_type);
+    
+    hid_t string_dtype = H5Tcopy(H5T_C_S1);
+    H5Tset_size (string_dtype, file_absolute_path_length);
+    H5Tinsert(fallback_compound_type, "PATH", sizeof(fallback_enum), string_dtype);
+
+	hid_t dest_fallback_attribute_id = H5Acreate2(destination_root_group, "FALLBACK_METADATA", fallback_compound_type, fallback_attribute_dataspace, H5P_DEFAULT, H5P_DEFAULT);
+
+	fallback_enum value = LOCAL;
+	void *buffer = malloc(sizeof(fallback_enum) + file_absolute_path_length);
+	
+	memcpy(buffer, &value, sizeof(fallback_enum));
+	memcpy(buffer + sizeof(fallback_enum), file_absolute_path, file_absolute_path_length);
+
+	herr_t write_return_val = H5Awrite(dest_fallback_attribute_id, fallback_compound_type, buffer);
+	
+    if (write_return_val < 0) {
+		if (DEBUG)
+			fprintf(log_ptr, "Error writing attribute %ld %ld\n", dest_fallback_attribute_id, fallback_compound_type);
+		return write_return_val;
+	}
+
+	return 0;
+}
+
+// Look up the pooled handles of an original file. Returns NULL if the file has not been pooled yet.
+carved_file_handle *get_file_handle(const char *filename) {
+	for (int i = 0; i < file_handle_pool_current_size; i++) {
+		if (strcmp(file_handle_pool[i]->filename, filename) == 0) {
+			return file_handle_pool[i];
+		}
+	}
+
+	return NULL;
+}
+
+// Open the pooled source handle of an original file read-only with the file access properties of the application, unless it is already open
+static herr_t open_source_file(carved_file_handle *handle) {
+	if (handle->src_file_id != H5I_INVALID_HID) {
+		return 0;
+	}
+
+	handle->src_file_id = original_H5Fopen(handle->filename, H5F_ACC_RDONLY, handle->src_file_access_plist);
+
+	if (handle->src_file_id == H5I_INVALID_HID) {
+		if (DEBUG)
+			fprintf(log_ptr, "Error opening source file for handle pool %s\n", handle->filename);
+		return -1;
+	}
+
+	return 0;
+}
+
+// Close the pooled source handle of an original file, so that the application can open the file again with other flags
+static void close_source_file(carved_file_handle *handle) {
+	if (handle->src_file_id != H5I_INVALID_HID) {
+		H5Fclose(handle->src_file_id);
+		handle->src_file_id = H5I_INVALID_HID;
+	}
+}
+
+/*
+	Fetch the pooled handles of an original file, opening its carved file read-write on first use. The original file is opened read-only
+	whenever its pooled source handle has been closed. file_id is a handle of the application on the original file, or H5I_INVALID_HID.
+	The original file is then opened with the same file access properties, since the library refuses to open a file twice with conflicting ones.
+	The carved file stays open until release_file_handles is called from H5_term_library.
+*/
+carved_file_handle *acquire_file_handle(const char *filename, hid_t file_id) {
+	carved_file_handle *handle = get_file_handle(filename);
+
+	if (handle == NULL) {
+		char *carved_filename = get_carved_filename(filename, is_netcdf4, use_carved);
+		hid_t pooled_carved_file_id = open_carved_file(carved_filename, H5F_ACC_RDWR, H5P_DEFAULT);
+
+		if (pooled_carved_file_id == H5I_INVALID_HID) {
+			if (DEBUG)
+				fprintf(log_ptr, "Error opening carved file for handle pool %s\n", carved_filename);
+			free(carved_filename);
+			return NULL;
+		}
+
+		load_carving_manifest(pooled_carved_file_id);
+
+		handle = malloc(sizeof(carved_file_handle));
+		handle->filename = malloc(strlen(filename) + 1);
+		strcpy(handle->filename, filename);
+		handle->carved_filename = carved_filename;
+		handle->src_file_id = H5I_INVALID_HID;
+		handle->src_file_access_plist = H5P_DEFAULT;
+		handle->application_handle_count = 0;
+		handle->carved_file_id = pooled_carved_file_id;
+		handle->datasets_carved_since_flush = 0;
+		handle->carved_dataset_names = NULL;
+		handle->carved_dataset_names_size = 0;
+		handle->free_space_at_open = H5Fget_freespace(pooled_carved_file_id);
+
+		if (H5Fget_filesize(pooled_carved_file_id, &handle->file_size_at_open) < 0) {
+			handle->file_size_at_open = 0;
+		}
+
+		file_handle_pool = realloc(file_handle_pool, (file_handle_pool_current_size + 1) * sizeof(carved_file_handle *));
+		file_handle_pool[file_handle_pool_current_size] = handle;
+		file_handle_pool_current_size += 1;
+	}
+
+	if (handle->src_file_id == H5I_INVALID_HID && file_id != H5I_INVALID_HID) {
+		hid_t access_plist = H5Fget_access_plist(file_id);
+
+		if (access_plist != H5I_INVALID_HID) {
+			if (handle->src_file_access_plist != H5P_DEFAULT)
+				H5Pclose(handle->src_file_access_plist);
+			handle->src_file_access_plist = access_plist;
+		}
+	}
+
+	return open_source_file(handle) < 0 ? NULL : handle;
+}
+
+// Application handles on original files opened through the H5Fopen hook, with the pooled handles of their file
+typedef struct {
+	hid_t file_id;
+	carved_file_handle *handle;
+} application_file;
+
+static application_file *application_files;
+static int application_files_size;
+
+// Count a handle the application opened on the original file of a pooled handle
+void track_application_file(carved_file_handle *handle, hid_t file_id) {
+	application_files = realloc(application_files, (application_files_size + 1) * sizeof(application_file));
+	application_files[application_files_size].file_id = file_id;
+	application_files[application_files_size].handle = handle;
+	application_files_size += 1;
+
+	handle->application_handle_count += 1;
+}
+
+/*
+	Forget a handle of the application closed by the H5Fclose hook. Once the application has closed every handle on an original file,
+	the pooled source handle is closed too, so that a later H5Fopen of the application, read-write for instance, is not refused because of it.
+	It is opened again by acquire_file_handle when carving needs it.
+*/
+void release_application_file(hid_t file_id) {
+	for (int i = 0; i < application_files_size; i++) {
+		if (application_files[i].file_id != file_id) {
+			continue;
+		}
+
+		carved_file_handle *handle = application_files[i].handle;
+		application_files[i] = application_files[application_files_size - 1];
+		application_files_size -= 1;
+
+		handle->application_handle_count -= 1;
+
+		if (handle->application_handle_count == 0) {
+			close_source_file(handle);
+		}
+
+		return;
+	}
+}
+
+// Flush the carved file once every flush_interval carved datasets instead of after each one. 
+// An interval of 0 leaves flushing to release_file_handles. In direct read mode the path of the dataset is kept for its index.
+void record_dataset_carved(carved_file_handle *handle, const char *dataset_name) {
+	handle->datasets_carved_since_flush += 1;
+
+	if (is_direct_read_mode) {
+		handle->carved_dataset_names = realloc(handle->carved_dataset_names, (handle->carved_dataset_names_size + 1) * sizeof(char *));
+		handle->carved_dataset_names[handle->carved_dataset_names_size] = malloc(strlen(dataset_name) + 1);
+		strcpy(handle->carved_dataset_names[handle->carved_dataset_names_size], dataset_name);
+		handle->carved_dataset_names_size += 1;
+	}
+
+	if (flush_interval > 0 && handle->datasets_carved_since_flush >= flush_interval) {
+		if (H5Fflush(handle->carved_file_id, H5F_SCOPE_LOCAL) < 0) {
+			if (DEBUG)
+				fprintf(log_ptr, "Error flushing carved file %s\n", handle->carved_filename);
+		}
+
+		handle->datasets_carved_since_flush = 0;
+	}
+}
+
+/*
+	Log the space of a carved file before it is closed: its growth in this run, the free space it tracks,
+	and the free space found when it was opened that has since been reused. Only files that persist their free space
+	have free space when they are opened, so the reclaimed bytes are a lower bound, missing space freed and reused within the run.
+*/
+static void log_carved_file_space(carved_file_handle *handle) {
+	hsize_t file_size;
+	hssize_t free_space = H5Fget_freespace(handle->carved_file_id);
+
+	if (H5Fget_filesize(handle->carved_file_id, &file_size) < 0 || free_space < 0) {
+		return;
+	}
+
+	hssize_t reclaimed_bytes = handle->free_space_at_open > free_space ? handle->free_space_at_open - free_space : 0;
+
+	fprintf(log_ptr, "Carved file %s is %llu bytes (%+lld), %lld bytes free, %lld bytes of free space reclaimed\n", handle->carved_filename, 
+			(unsigned long long)file_size, (long long)file_size - (long long)handle->file_size_at_open, (long long)free_space, (long long)reclaimed_bytes);
+}
+
+// Close every pooled handle. Closing the carved file flushes whatever is still pending.
+void release_file_handles(void) {
+	for (int i = 0; i < file_handle_pool_current_size; i++) {
+		carved_file_handle *handle = file_handle_pool[i];
+
+		if (DEBUG)
+			log_carved_file_space(handle);
+
+		if (is_direct_read_mode)
+			write_direct_read_index(handle);
+
+		close_source_file(handle);
+		if (handle->src_file_access_plist != H5P_DEFAULT)
+			H5Pclose(handle->src_file_access_plist);
+		close_carving_manifest(handle->carved_file_id);
+		H5Fclose(handle->carved_file_id);
+
+		for (int j = 0; j < handle->carved_dataset_names_size; j++) {
+			free(handle->carved_dataset_names[j]);
+		}
+
+		free(handle->carved_dataset_names);
+		free(handle->filename);
+		free(handle->carved_filename);
+		free(handle);
+	}
+
+	free(file_handle_pool);
+	file_handle_pool = NULL;
+	file_handle_pool_current_size = 0;
+
+	free(application_files);
+	application_files = NULL;
+	application_files_size = 0;
+}
+
+// Datasets already carved in this process, so repeated reads of a dataset skip all carving work
+static object_key_set carved_set;
+
+herr_t get_carved_dataset_key(hid_t dataset_id, carved_dataset_key *key) {
+	H5O_info2_t object_info;
+
+	if (H5Oget_info3(dataset_id, &object_info, H5O_INFO_BASIC) < 0) {
+		if (DEBUG)
+			fprintf(log_ptr, "Error fetching object info %ld\n", dataset_id);
+		return -1;
+	}
+
+	memset(key, 0, sizeof(carved_dataset_key));
+	key->fileno = object_info.fileno;
+	key->token = object_info.token;
+
+	return 0;
+}
+
+bool is_in_carved_set(const carved_dataset_key *key) {
+	return is_in_object_key_set(&carved_set, key);
+}
+
+void add_to_carved_set(const carved_dataset_key *key) {
+	add_to_object_key_set(&carved_set, key, NULL);
+}
+
+// Replace the empty skeleton dataset with a complete copy of the dataset object from the source file
+herr_t copy_dataset_object(hid_t src_file, hid_t carved_file, const char *dataset_name) {
+	if (DEBUG)
+		fprintf(log_ptr, "Deleting empty dataset from carved file %s\n", dataset_name);
+
+	herr_t link_deletion_ret_value = H5Ldelete(carved_file, dataset_name, H5P_DEFAULT);
+
+	if (link_deletion_ret_value < 0) {
+		if (DEBUG)
+			fprintf(log_ptr, "Error deleting empty dataset object %ld %s\n", carved_file, dataset_name);
+		return link_deletion_ret_value;
+	}
+
+	if (DEBUG)
+		fprintf(log_ptr, "Copying complete dataset to carved file %s\n", dataset_name);
+
+	// Make copy of dataset in the destination file
+	herr_t object_copy_return_val = H5Ocopy(src_file, dataset_name, carved_file, dataset_name, H5P_DEFAULT, H5P_DEFAULT);
+
+	if (object_copy_return_val < 0) {
+		if (DEBUG)
+			fprintf(log_ptr, "Error copying object %ld %s %ld %s\n", src_file, dataset_name, carved_file, dataset_name);
+		return object_copy_return_val;
+	}
+
+	hid_t recent = original_H5Oopen(carved_file, dataset_name, H5P_DEFAULT);
+
+	if (recent < 0) {
+		if (DEBUG)
+			fprintf(log_ptr, "Error opening object after H5Ocopy %ld %s\n", carved_file, dataset_name);
+		return recent;
+	}
+
+	// Delete copied attributes (attributes may contain references to objects which would be invalid in carved file)
+	herr_t attribute_iterate_return_val = original_H5Aiterate2(recent, H5_INDEX_NAME, H5_ITER_INC, NULL, delete_attributes, NULL);
+
+	H5Oclose(recent);
+
+	if (attribute_iterate_return_val < 0) {
+		if (DEBUG)
+			fprintf(log_ptr, "Attribute iteration failed\n");
+		return attribute_iterate_return_val;
+	}
+
+	return 0;
+}
+
+// Record in the carved file that a dataset has been copied, so that attributes are copied when the library terminates
+herr_t mark_dataset_copied(hid_t carved_file) {
+	if (set_manifest_attributes_pending(carved_file, true)) {
+		return 0;
+	}
+
+	hid_t dataset_copy_check_attr_id = H5Aopen(carved_file, "WAS_DATASET_COPIED", H5P_DEFAULT);
+
+	if (dataset_copy_check_attr_id < 0) {
+		if (DEBUG)
+			fprintf(log_ptr, "Error opening dataset copy check attribute %ld\n", carved_file);
+		return -1;
+	}
+
+	hbool_t dataset_copy_check_attr_val = true;
+
+	herr_t dataset_copy_check_attr_write_status = H5Awrite(dataset_copy_check_attr_id, H5T_NATIVE_HBOOL, &dataset_copy_check_attr_val);
+
+	H5Aclose(dataset_copy_check_attr_id);
+
+	if (dataset_copy_check_attr_write_status < 0) {
+		if (DEBUG)
+			fprintf(log_ptr, "Error writing value to dataset copy check attribute %ld\n", carved_file);
+		return -1;
+	}
+
+	return 0;
+}
+
+// Check whether converting values from the file type to the memory type and back again reproduces them exactly
+bool is_lossless_conversion(hid_t file_type, hid_t mem_type) {
+	if (H5Tequal(file_type, mem_type) > 0) {
+		return true;
+	}
+
+	hid_t native_type = H5Tget_native_type(file_type, H5T_DIR_DEFAULT);
+	bool is_native_type = native_type >= 0 && H5Tequal(native_type, mem_type) > 0;
+
+	if (native_type >= 0) {
+		H5Tclose(native_type);
+	}
+
+	if (is_native_type) {
+		return true;
+	}
+
+	H5T_class_t file_class = H5Tget_class(file_type);
+
+	if (file_class != H5Tget_class(mem_type)) {
+		return false;
+	}
+
+	size_t file_size = H5Tget_size(file_type);
+	size_t mem_size = H5Tget_size(mem_type);
+
+	// Widening integer conversions are exact as long as the memory type can hold the sign of the file type
+	if (file_class == H5T_INTEGER) {
+		H5T_sign_t file_sign = H5Tget_sign(file_type);
+		H5T_sign_t mem_sign = H5Tget_sign(mem_type);
+
+		return mem_size >= file_size && (file_sign == mem_sign || (mem_sign == H5T_SGN_2 && mem_size > file_size));
+	}
+
+	// Widening floating point conversions are exact
+	if (file_class == H5T_FLOAT) {
+		return mem_size >= file_size;
+	}
+
+	return false;
+}
+
+/*
+	Carve a dataset from the buffer the application has just read it into, instead of copying it from the source file.
+	Applies when the file selection covers the whole dataset, the datatype holds no references or variable-length data 
+	and the memory type converts back to the file type without loss. The values are written into the skeleton dataset
+	and converted back to the file type by H5Dwrite.
+	Returns 0 when the dataset was carved, 1 when the buffer cannot be used, and a negative value on error.
+*/
+herr_t carve_dataset_from_buffer(hid_t dataset_id, hid_t carved_file, const char *dataset_name, hid_t mem_type_id, hid_t mem_space_id, hid_t file_space_id, hid_t dxpl_id, const void *buf) {
+	// Data transforms alter the values stored in the buffer
+	if (dxpl_id != H5P_DEFAULT && H5Pget_data_transform(dxpl_id, NULL, 0) > 0) {
+		return 1;
+	}
+
+	hid_t dataset_space = H5Dget_space(dataset_id);
+
+	if (dataset_space < 0) {
+		return 1;
+	}
+
+	hssize_t dataset_num_points = H5Sget_simple_extent_npoints(dataset_space);
+	H5Sclose(dataset_space);
+
+	if (dataset_num_points <= 0) {
+		return 1;
+	}
+
+	if (file_space_id != H5S_ALL && H5Sget_select_npoints(file_space_id) != dataset_num_points) {
+		return 1;
+	}
+
+	hid_t file_type = H5Dget_type(dataset_id);
+
+	if (file_type < 0) {
+		return 1;
+	}
+
+	bool is_buffer_usable = H5Tdetect_class(file_type, H5T_REFERENCE) == 0
+		&& H5Tdetect_class(file_type, H5T_VLEN) == 0
+		&& H5Tis_variable_str(file_type) == 0
+		&& is_lossless_conversion(file_type, mem_type_id);
+
+	H5Tclose(file_type);
+
+	if (!is_buffer_usable) {
+		return 1;
+	}
+
+	hid_t carved_dataset_id = H5Dopen(carved_file, dataset_name, H5P_DEFAULT);
+
+	if (carved_dataset_id < 0) {
+		if (DEBUG)
+			fprintf(log_ptr, "Error opening skeleton dataset %ld %s\n", carved_file, dataset_name);
+		return 1;
+	}
+
+	if (DEBUG)
+		fprintf(log_ptr, "Writing application buffer to carved file %s\n", dataset_name);
+
+	// The file selection covers the whole dataset and the extent of the skeleton matches the source dataset, so both dataspaces apply as is
+	herr_t write_return_val = H5Dwrite(carved_dataset_id, mem_type_id, mem_space_id, file_space_id, H5P_DEFAULT, buf);
+
+	// Leave it to the complete object copy, which replaces whatever was written
+	if (write_return_val < 0) {
+		if (DEBUG)
+			fprintf(log_ptr, "Error writing application buffer to carved dataset %s\n", dataset_name);
+		H5Dclose(carved_dataset_id);
+		return 1;
+	}
+
+	herr_t clear_return_val = clear_carving_status(carved_dataset_id);
+
+	H5Dclose(carved_dataset_id);
+
+	return clear_return_val;
+}
+
+/*
+	Compute the block dimensions tracked by the coverage map of a contiguous dataset in partial carving mode.
+	Trailing dimensions are kept whole while a block stays under partial_carving_block_size bytes, so that each block is one contiguous run in the original layout.
+	Returns false for scalar and empty dataspaces.
+*/
+bool get_coverage_block_dims(hid_t data_type, hid_t data_space, hsize_t *block_dims) {
+	hsize_t dims[H5S_MAX_RANK];
+	int rank = H5Sget_simple_extent_dims(data_space, dims, NULL);
+	size_t element_size = H5Tget_size(data_type);
+
+	if (rank <= 0 || element_size == 0 || H5Sget_simple_extent_npoints(data_space) <= 0) {
+		return false;
+	}
+
+	// Size in bytes of one element of dimension i, i.e. the product of the trailing dimensions
+	hsize_t inner_size = element_size;
+	int split_dimension = 0;
+
+	for (int i = rank - 1; i >= 0; i--) {
+		if (inner_size * dims[i] > partial_carving_block_size) {
+			split_dimension = i;
+			break;
+		}
+
+		inner_size *= dims[i];
+	}
+
+	for (int i = 0; i < rank; i++) {
+		if (i < split_dimension) {
+			block_dims[i] = 1;
+		} else if (i == split_dimension) {
+			hsize_t block_length = partial_carving_block_size / inner_size;
+			block_dims[i] = block_length == 0 ? 1 : (block_length > dims[i] ? dims[i] : block_length);
+		} else {
+			block_dims[i] = dims[i];
+		}
+	}
+
+	return true;
+}
+
+/*
+	Fetch the creation property list for the skeleton copy of a dataset.
+	In partial carving mode, contiguous datasets get a chunked skeleton whose chunks are the coverage blocks,
+	so the carved file only stores the blocks that have been carved.
+*/
+hid_t get_skeleton_create_plist(hid_t dataset_id, hid_t data_type, hid_t data_space) {
+	hid_t create_plist = H5Dget_create_plist(dataset_id);
+
+	if (create_plist == H5I_INVALID_HID || !is_partial_carving_mode) {
+		return create_plist;
+	}
+
+	hsize_t block_dims[H5S_MAX_RANK];
+
+	if (H5Pget_layout(create_plist) == H5D_CONTIGUOUS && H5Pget_external_count(create_plist) == 0 
+		&& H5Tdetect_class(data_type, H5T_REFERENCE) == 0 && H5Tdetect_class(data_type, H5T_VLEN) == 0 
+		&& get_coverage_block_dims(data_type, data_space, block_dims)) {
+		H5Pset_chunk(create_plist, H5Sget_simple_extent_ndims(data_space), block_dims);
+	}
+
+	return create_plist;
+}
+
+// Check whether the raw chunks of a dataset can be copied byte for byte into its skeleton: both chunked alike, and no references or variable-length data whose stored form points into the original file
+static bool can_copy_raw_chunks(hid_t src_dataset_id, hid_t carved_dataset_id, bool require_filters) {
+	hid_t src_create_plist = H5Dget_create_plist(src_dataset_id);
+	hid_t carved_create_plist = H5Dget_create_plist(carved_dataset_id);
+	hid_t data_type = H5Dget_type(src_dataset_id);
+	bool can_copy = false;
+
+	if (src_create_plist >= 0 && carved_create_plist >= 0 && data_type >= 0
+		&& H5Pget_layout(src_create_plist) == H5D_CHUNKED && H5Pget_layout(carved_create_plist) == H5D_CHUNKED
+		&& (!require_filters || H5Pget_nfilters(src_create_plist) > 0)
+		&& H5Tdetect_class(data_type, H5T_REFERENCE) == 0 && H5Tdetect_class(data_type, H5T_VLEN) == 0 && H5Tis_variable_str(data_type) == 0) {
+		hsize_t src_chunk_dims[H5S_MAX_RANK], carved_chunk_dims[H5S_MAX_RANK];
+		int src_rank = H5Pget_chunk(src_create_plist, H5S_MAX_RANK, src_chunk_dims);
+		int carved_rank = H5Pget_chunk(carved_create_plist, H5S_MAX_RANK, carved_chunk_dims);
+
+		can_copy = src_rank > 0 && src_rank == carved_rank && memcmp(src_chunk_dims, carved_chunk_dims, src_rank * sizeof(hsize_t)) == 0;
+	}
+
+	if (src_create_plist >= 0)
+		H5Pclose(src_create_plist);
+	if (carved_create_plist >= 0)
+		H5Pclose(carved_create_plist);
+	if (data_type >= 0)
+		H5Tclose(data_type);
+
+	return can_copy;
+}
+
+// Fetch the extent and block grid of the coverage map of a chunked carved dataset. Returns the number of blocks, or 0 if the dataset cannot be carved partially.
+static hsize_t get_coverage_grid(hid_t carved_dataset_id, int *rank, hsize_t *dims, hsize_t *block_dims, hsize_t *grid_dims) {
+	hid_t create_plist = H5Dget_create_plist(carved_dataset_id);
+
+	if (create_plist < 0) {
+		return 0;
+	}
+
+	int chunk_rank = H5Pget_layout(create_plist) == H5D_CHUNKED ? H5Pget_chunk(create_plist, H5S_MAX_RANK, block_dims) : -1;
+	H5Pclose(create_plist);
+
+	hid_t data_space = H5Dget_space(carved_dataset_id);
+	*rank = H5Sget_simple_extent_dims(data_space, dims, NULL);
+	H5Sclose(data_space);
+
+	if (chunk_rank <= 0 || *rank != chunk_rank) {
+		return 0;
+	}
+
+	hsize_t num_blocks = 1;
+
+	for (int i = 0; i < *rank; i++) {
+		grid_dims[i] = (dims[i] + block_dims[i] - 1) / block_dims[i];
+		num_blocks *= grid_dims[i];
+	}
+
+	return num_blocks;
+}
+
+// Read the coverage bitmap of a carved dataset, one bit per block in row-major order. Blocks are uncovered if the dataset has no map yet.
+static uint8_t *read_coverage_map(hid_t carved_dataset_id, hsize_t num_blocks) {
+	size_t coverage_map_size = (num_blocks + 7) / 8;
+	uint8_t *coverage_map = calloc(coverage_map_size, 1);
+
+	if (H5Aexists(carved_dataset_id, "CARVED_COVERAGE") > 0) {
+		hid_t attr_id = H5Aopen(carved_dataset_id, "CARVED_COVERAGE", H5P_DEFAULT);
+
+		if (attr_id < 0 || original_H5Aread(attr_id, H5T_NATIVE_UINT8, coverage_map) < 0) {
+			if (DEBUG)
+				fprintf(log_ptr, "Error reading CARVED_COVERAGE attribute %ld\n", carved_dataset_id);
+			memset(coverage_map, 0, coverage_map_size);
+		}
+
+		H5Aclose(attr_id);
+	}
+
+	return coverage_map;
+}
+
+static herr_t write_coverage_map(hid_t carved_dataset_id, uint8_t *coverage_map, hsize_t num_blocks) {
+	hsize_t coverage_map_size = (num_blocks + 7) / 8;
+	hid_t attr_id;
+
+	if (H5Aexists(carved_dataset_id, "CARVED_COVERAGE") > 0) {
+		attr_id = H5Aopen(carved_dataset_id, "CARVED_COVERAGE", H5P_DEFAULT);
+	} else {
+		hid_t attr_dataspace_id = H5Screate_simple(1, &coverage_map_size, NULL);
+		attr_id = H5Acreate2(carved_dataset_id, "CARVED_COVERAGE", H5T_NATIVE_UINT8, attr_dataspace_id, H5P_DEFAULT, H5P_DEFAULT);
+		H5Sclose(attr_dataspace_id);
+	}
+
+	if (attr_id < 0) {
+		if (DEBUG)
+			fprintf(log_ptr, "Error creating CARVED_COVERAGE attribute %ld\n", carved_dataset_id);
+		return -1;
+	}
+
+	herr_t write_return_val = H5Awrite(attr_id, H5T_NATIVE_UINT8, coverage_map);
+	H5Aclose(attr_id);
+
+	return write_return_val;
+}
+
+// Advance the block coordinates to the next block of the grid between low and high, in row-major order. Returns false once every block has been visited.
+static bool next_block(int rank, hsize_t *block_coords, const hsize_t *low, const hsize_t *high) {
+	for (int i = rank - 1; i >= 0; i--) {
+		if (block_coords[i] < high[i]) {
+			block_coords[i] += 1;
+			return true;
+		}
+
+		block_coords[i] = low[i];
+	}
+
+	return false;
+}
+
+/*
+	Carve the blocks of a dataset overlapping the selection read by the application, instead of the whole dataset.
+	Blocks are the chunks of the skeleton dataset. The blocks present in the carved file are recorded in the CARVED_COVERAGE
+	attribute of the dataset until all of them have been carved, at which point the dataset counts as completely carved.
+	Returns 0 when the selection was carved, 1 when the dataset has to be carved completely, and a negative value on error.
+*/
+herr_t carve_dataset_selection(hid_t dataset_id, hid_t carved_file, const char *dataset_name, hid_t file_space_id, bool *is_fully_carved) {
+	*is_fully_carved = false;
+
+	// Reads of the whole dataset carve the whole dataset
+	if (file_space_id == H5S_ALL || H5Sget_select_type(file_space_id) == H5S_SEL_ALL) {
+		return 1;
+	}
+
+	hid_t file_type = H5Dget_type(dataset_id);
+
+	if (file_type < 0) {
+		return 1;
+	}
+
+	if (H5Tdetect_class(file_type, H5T_REFERENCE) != 0 || H5Tdetect_class(file_type, H5T_VLEN) != 0) {
+		H5Tclose(file_type);
+		return 1;
+	}
+
+	hid_t carved_dataset_id = H5Dopen(carved_file, dataset_name, H5P_DEFAULT);
+
+	if (carved_dataset_id < 0) {
+		H5Tclose(file_type);
+		return 1;
+	}
+
+	int rank;
+	hsize_t dims[H5S_MAX_RANK], block_dims[H5S_MAX_RANK], grid_dims[H5S_MAX_RANK];
+	hsize_t num_blocks = get_coverage_grid(carved_dataset_id, &rank, dims, block_dims, grid_dims);
+	hsize_t selection_start[H5S_MAX_RANK], selection_end[H5S_MAX_RANK];
+
+	if (num_blocks == 0 || H5Sget_select_npoints(file_space_id) <= 0 || H5Sget_select_bounds(file_space_id, selection_start, selection_end) < 0) {
+		H5Dclose(carved_dataset_id);
+		H5Tclose(file_type);
+		return num_blocks == 0 ? 1 : 0;
+	}
+
+	uint8_t *coverage_map = read_coverage_map(carved_dataset_id, num_blocks);
+
+	size_t block_size = H5Tget_size(file_type);
+	hsize_t low[H5S_MAX_RANK], high[H5S_MAX_RANK], block_coords[H5S_MAX_RANK];
+
+	for (int i = 0; i < rank; i++) {
+		block_size *= block_dims[i];
+		low[i] = selection_start[i] / block_dims[i];
+		high[i] = selection_end[i] / block_dims[i];
+		block_coords[i] = low[i];
+	}
+
+	// Blocks of a dataset chunked like its skeleton are copied as stored, one raw chunk each
+	bool use_raw_chunks = can_copy_raw_chunks(dataset_id, carved_dataset_id, false);
+	size_t block_buffer_capacity = block_size;
+	void *block_buffer = malloc(block_buffer_capacity);
+	hid_t src_space = H5Dget_space(dataset_id);
+	hid_t carved_space = H5Dget_space(carved_dataset_id);
+	herr_t status = 0;
+	int blocks_carved = 0;
+
+	do {
+		hsize_t block_index = 0;
+		hsize_t block_start[H5S_MAX_RANK], block_count[H5S_MAX_RANK], block_end[H5S_MAX_RANK];
+
+		for (int i = 0; i < rank; i++) {
+			block_index = block_index * grid_dims[i] + block_coords[i];
+			block_start[i] = block_coords[i] * block_dims[i];
+			block_count[i] = (block_start[i] + block_dims[i] > dims[i]) ? dims[i] - block_start[i] : block_dims[i];
+			block_end[i] = block_start[i] + block_count[i] - 1;
+		}
+
+		// Skip blocks already carved, and blocks inside the bounding box that the selection does not touch
+		if ((coverage_map[block_index / 8] & (1 << (block_index % 8))) || H5Sselect_intersect_block(file_space_id, block_start, block_end) <= 0) {
+			continue;
+		}
+
+		if (use_raw_chunks) {
+			uint32_t filter_mask = 0;
+			haddr_t chunk_address;
+			hsize_t chunk_size;
+
+			status = H5Dget_chunk_info_by_coord(dataset_id, block_start, &filter_mask, &chunk_address, &chunk_size);
+
+			// Chunks never written in the original read as fill values, and so do their counterparts in the skeleton
+			if (status >= 0 && chunk_address != HADDR_UNDEF) {
+				if (chunk_size > block_buffer_capacity) {
+					block_buffer_capacity = chunk_size;
+					block_buffer = realloc(block_buffer, block_buffer_capacity);
+				}
+
+				status = H5Dread_chunk(dataset_id, H5P_DEFAULT, block_start, &filter_mask, block_buffer);
+
+				if (status >= 0) {
+					status = H5Dwrite_chunk(carved_dataset_id, H5P_DEFAULT, filter_mask, block_start, chunk_size, block_buffer);
+				}
+			}
+		} else {
+			// Copy the block from the original dataset to the carved dataset without type conversion
+			hid_t mem_space = H5Screate_simple(rank, block_count, NULL);
+			H5Sselect_hyperslab(src_space, H5S_SELECT_SET, block_start, NULL, block_count, NULL);
+			H5Sselect_hyperslab(carved_space, H5S_SELECT_SET, block_start, NULL, block_count, NULL);
+
+			status = original_H5Dread(dataset_id, file_type, mem_space, src_space, H5P_DEFAULT, block_buffer);
+
+			if (status >= 0) {
+				status = H5Dwrite(carved_dataset_id, file_type, mem_space, carved_space, H5P_DEFAULT, block_buffer);
+			}
+
+			H5Sclose(mem_space);
+		}
+
+		if (status < 0) {
+			if (DEBUG)
+				fprintf(log_ptr, "Error carving block %llu of dataset %s\n", (unsigned long long)block_index, dataset_name);
+			break;
+		}
+
+		coverage_map[block_index / 8] |= (1 << (block_index % 8));
+		blocks_carved += 1;
+	} while (next_block(rank, block_coords, low, high));
+
+	if (DEBUG)
+		fprintf(log_ptr, "Carved %d blocks of dataset %s\n", blocks_carved, dataset_name);
+
+	if (status >= 0 && blocks_carved > 0) {
+		hsize_t blocks_covered = 0;
+
+		for (hsize_t i = 0; i < num_blocks; i++) {
+			if (coverage_map[i / 8] & (1 << (i % 8))) {
+				blocks_covered += 1;
+			}
+		}
+
+		// Once every block is present the dataset is complete and needs no coverage map
+		if (blocks_covered == num_blocks) {
+			status = clear_carving_status(carved_dataset_id);
+			*is_fully_carved = status >= 0;
+		} else {
+			status = write_coverage_map(carved_dataset_id, coverage_map, num_blocks);
+		}
+	}
+
+	free(block_buffer);
+	free(coverage_map);
+	H5Sclose(src_space);
+	H5Sclose(carved_space);
+	H5Dclose(carved_dataset_id);
+	H5Tclose(file_type);
+
+	return status < 0 ? -1 : 0;
+}
+
+// Check whether a carved dataset holds some, but not all, of its blocks
+bool is_partially_carved(hid_t carved_dataset_id) {
+	return H5Aexists(carved_dataset_id, "CARVED_COVERAGE") > 0;
+}
+
+// Check whether every block of a partially carved dataset overlapping a selection is present in the carved file
+bool is_selection_carved(hid_t carved_dataset_id, hid_t file_space_id) {
+	if (file_space_id == H5S_ALL || H5Sget_select_type(file_space_id) == H5S_SEL_ALL) {
+		return false;
+	}
+
+	int rank;
+	hsize_t dims[H5S_MAX_RANK], block_dims[H5S_MAX_RANK], grid_dims[H5S_MAX_RANK];
+	hsize_t num_blocks = get_coverage_grid(carved_dataset_id, &rank, dims, block_dims, grid_dims);
+	hsize_t selection_start[H5S_MAX_RANK], selection_end[H5S_MAX_RANK];
+
+	if (num_blocks == 0) {
+		return false;
+	}
+
+	if (H5Sget_select_npoints(file_space_id) <= 0 || H5Sget_select_bounds(file_space_id, selection_start, selection_end) < 0) {
+		return true;
+	}
+
+	uint8_t *coverage_map = read_coverage_map(carved_dataset_id, num_blocks);
+	hsize_t low[H5S_MAX_RANK], high[H5S_MAX_RANK], block_coords[H5S_MAX_RANK];
+	bool is_carved = true;
+
+	for (int i = 0; i < rank; i++) {
+		low[i] = selection_start[i] / block_dims[i];
+		high[i] = selection_end[i] / block_dims[i];
+		block_coords[i] = low[i];
+	}
+
+	do {
+		hsize_t block_index = 0;
+		hsize_t block_start[H5S_MAX_RANK], block_end[H5S_MAX_RANK];
+
+		for (int i = 0; i < rank; i++) {
+			block_index = block_index * grid_dims[i] + block_coords[i];
+			block_start[i] = block_coords[i] * block_dims[i];
+			block_end[i] = (block_start[i] + block_dims[i] > dims[i]) ? dims[i] - 1 : block_start[i] + block_dims[i] - 1;
+		}
+
+		if (!(coverage_map[block_index / 8] & (1 << (block_index % 8))) && H5Sselect_intersect_block(file_space_id, block_start, block_end) > 0) {
+			is_carved = false;
+			break;
+		}
+	} while (next_block(rank, block_coords, low, high));
+
+	free(coverage_map);
+
+	return is_carved;
+}
+
+// Remove the attributes marking a skeleton dataset as empty or partially carved, once its contents have been written in place
+herr_t clear_carving_status(hid_t carved_dataset_id) {
+	H5O_info2_t object_info;
+
+	if (H5Oget_info3(carved_dataset_id, &object_info, H5O_INFO_BASIC) >= 0) {
+		mark_dataset_carved_in_manifest(object_info.fileno, &object_info.token);
+	}
+
+	if (H5Aexists(carved_dataset_id, "CARVED_COVERAGE") > 0 && H5Adelete(carved_dataset_id, "CARVED_COVERAGE") < 0) {
+		if (DEBUG)
+			fprintf(log_ptr, "Error deleting CARVED_COVERAGE attribute %ld\n", carved_dataset_id);
+		return -1;
+	}
+
+	if (H5Aexists(carved_dataset_id, "CARVED_DATASET_IS_EMPTY") > 0 && H5Adelete(carved_dataset_id, "CARVED_DATASET_IS_EMPTY") < 0) {
+		if (DEBUG)
+			fprintf(log_ptr, "Error deleting CARVED_DATASET_IS_EMPTY attribute %ld\n", carved_dataset_id);
+		return -1;
+	}
+
+	return 0;
+}
+
+// Chunks of a dataset collected by H5Dchunk_iter, copied once the iteration is over
+typedef struct {
+	int rank;
+	size_t num_chunks;
+	size_t capacity;
+	hsize_t *offsets;
+	hsize_t *sizes;
+} chunk_list;
+
+static int collect_chunk(const hsize_t *offset, unsigned filter_mask, haddr_t addr, hsize_t size, void *op_data) {
+	chunk_list *chunks = (chunk_list *)op_data;
+
+	if (chunks->num_chunks == chunks->capacity) {
+		chunks->capacity = chunks->capacity == 0 ? 256 : chunks->capacity * 2;
+		chunks->offsets = realloc(chunks->offsets, chunks->capacity * chunks->rank * sizeof(hsize_t));
+		chunks->sizes = realloc(chunks->sizes, chunks->capacity * sizeof(hsize_t));
+	}
+
+	memcpy(chunks->offsets + chunks->num_chunks * chunks->rank, offset, chunks->rank * sizeof(hsize_t));
+	chunks->sizes[chunks->num_chunks] = size;
+	chunks->num_chunks += 1;
+
+	return H5_ITER_CONT;
+}
+
+/*
+	Carve a chunked, filtered dataset by moving its compressed chunks byte for byte with direct chunk I/O,
+	instead of decompressing and recompressing every chunk through H5Ocopy. The skeleton dataset already has the creation property list
+	of the original, so the chunks keep their filters. Chunks are streamed one at a time through a buffer of at most chunk_buffer_size bytes.
+	Returns 0 when the dataset was carved, 1 when the chunks cannot be copied raw, and a negative value on error.
+*/
+herr_t carve_dataset_chunks(hid_t src_file, hid_t carved_file, const char *dataset_name) {
+	hid_t src_dataset_id = H5Dopen(src_file, dataset_name, H5P_DEFAULT);
+	hid_t carved_dataset_id = H5Dopen(carved_file, dataset_name, H5P_DEFAULT);
+
+	if (src_dataset_id < 0 || carved_dataset_id < 0 || !can_copy_raw_chunks(src_dataset_id, carved_dataset_id, true)) {
+		if (src_dataset_id >= 0)
+			H5Dclose(src_dataset_id);
+		if (carved_dataset_id >= 0)
+			H5Dclose(carved_dataset_id);
+		return 1;
+	}
+
+	hid_t data_space = H5Dget_space(src_dataset_id);
+	chunk_list chunks = {0};
+	chunks.rank = H5Sget_simple_extent_ndims(data_space);
+	H5Sclose(data_space);
+
+	// Collect the chunks first, so that no chunk is read or written while the chunk index is being iterated
+	herr_t status = H5Dchunk_iter(src_dataset_id, H5P_DEFAULT, collect_chunk, &chunks);
+
+	for (size_t i = 0; status >= 0 && i < chunks.num_chunks; i++) {
+		if (chunks.sizes[i] > chunk_buffer_size) {
+			status = 1;
+		}
+	}
+
+	if (status != 0) {
+		if (DEBUG)
+			fprintf(log_ptr, "Not copying raw chunks of dataset %s\n", dataset_name);
+		free(chunks.offsets);
+		free(chunks.sizes);
+		H5Dclose(src_dataset_id);
+		H5Dclose(carved_dataset_id);
+		return 1;
+	}
+
+	if (DEBUG)
+		fprintf(log_ptr, "Copying %zu raw chunks of dataset %s\n", chunks.num_chunks, dataset_name);
+
+	void *chunk_buffer = NULL;
+	size_t chunk_buffer_capacity = 0;
+
+	for (size_t i = 0; i < chunks.num_chunks; i++) {
+		hsize_t *offset = chunks.offsets + i * chunks.rank;
+		uint32_t filter_mask = 0;
+
+		if (chunks.sizes[i] > chunk_buffer_capacity) {
+			chunk_buffer_capacity = chunks.sizes[i];
+			chunk_buffer = realloc(chunk_buffer, chunk_buffer_capacity);
+		}
+
+		status = H5Dread_chunk(src_dataset_id, H5P_DEFAULT, offset, &filter_mask, chunk_buffer);
+
+		if (status >= 0) {
+			status = H5Dwrite_chunk(carved_dataset_id, H5P_DEFAULT, filter_mask, offset, chunks.sizes[i], chunk_buffer);
+		}
+
+		if (status < 0) {
+			if (DEBUG)
+				fprintf(log_ptr, "Error copying raw chunk %zu of dataset %s\n", i, dataset_name);
+			break;
+		}
+	}
+
+	if (status >= 0) {
+		status = clear_carving_status(carved_dataset_id);
+	}
+
+	free(chunk_buffer);
+	free(chunks.offsets);
+	free(chunks.sizes);
+	H5Dclose(src_dataset_id);
+	H5Dclose(carved_dataset_id);
+
+	return status;
+}
+
+// Check whether an HDF5 file is a plain single file, so that addresses in the file are byte offsets in the file on disk.
+// Without a page buffer either, since bytes written around the library would be overwritten when a buffered page is flushed.
+static bool is_plain_file(hid_t file_id) {
+	hid_t access_plist = H5Fget_access_plist(file_id);
+	hid_t create_plist = H5Fget_create_plist(file_id);
+	hsize_t userblock_size = 1;
+	size_t page_buffer_size = 1;
+	unsigned min_meta_percent, min_raw_percent;
+
+	bool is_plain = access_plist >= 0 && create_plist >= 0 && H5Pget_driver(access_plist) == H5FD_SEC2 
+		&& H5Pget_userblock(create_plist, &userblock_size) >= 0 && userblock_size == 0
+		&& H5Pget_page_buffer_size(access_plist, &page_buffer_size, &min_meta_percent, &min_raw_percent) >= 0 && page_buffer_size == 0;
+
+	if (access_plist >= 0)
+		H5Pclose(access_plist);
+	if (create_plist >= 0)
+		H5Pclose(create_plist);
+
+	return is_plain;
+}
+
+// Copy a byte range between two files inside the kernel. Shares the extents with a reflink where the file system supports it, otherwise copies with copy_file_range.
+static int copy_file_bytes(int src_fd, off_t src_offset, int dest_fd, off_t dest_offset, size_t length) {
+#ifdef FICLONERANGE
+	struct file_clone_range clone_range = {
+		.src_fd = src_fd,
+		.src_offset = src_offset,
+		.src_length = length,
+		.dest_offset = dest_offset,
+	};
+
+	// Reflinks require offsets aligned to the file system block size, and fail otherwise
+	if (ioctl(dest_fd, FICLONERANGE, &clone_range) == 0) {
+		return 0;
+	}
+#endif
+
+	while (length > 0) {
+		ssize_t bytes_copied = copy_file_range(src_fd, &src_offset, dest_fd, &dest_offset, length, 0);
+
+		if (bytes_copied <= 0) {
+			return -1;
+		}
+
+		length -= bytes_copied;
+	}
+
+	return 0;
+}
+
+// Write the first element of a dataset into its copy, so that the library allocates the storage of the copy with its own allocation and fill properties
+static herr_t write_first_element(hid_t src_dataset_id, hid_t dest_dataset_id, hid_t data_type, hid_t data_space) {
+	hid_t element_space = H5Scopy(data_space);
+	hid_t memory_space = H5Screate(H5S_SCALAR);
+	int rank = H5Sget_simple_extent_ndims(element_space);
+	hsize_t start[H5S_MAX_RANK] = {0};
+	hsize_t count[H5S_MAX_RANK];
+
+	for (int i = 0; i < rank; i++) {
+		count[i] = 1;
+	}
+
+	herr_t status = rank > 0 ? H5Sselect_hyperslab(element_space, H5S_SELECT_SET, start, NULL, count, NULL) : H5Sselect_all(element_space);
+	void *element = malloc(H5Tget_size(data_type));
+
+	if (status >= 0) {
+		status = original_H5Dread(src_dataset_id, data_type, memory_space, element_space, H5P_DEFAULT, element);
+	}
+
+	if (status >= 0) {
+		status = H5Dwrite(dest_dataset_id, data_type, memory_space, element_space, H5P_DEFAULT, element);
+	}
+
+	free(element);
+	H5Sclose(memory_space);
+	H5Sclose(element_space);
+
+	return status;
+}
+
+/*
+	Carve a contiguous, unfiltered dataset by copying its raw data as one byte range between the original and the carved file,
+	without passing it through user space or the HDF5 type conversion pipeline. The skeleton dataset keeps the creation properties of its source,
+	and its storage is allocated by writing its first element when it has none yet. Skeleton datasets of another layout, such as the chunked
+	ones of partial carving mode, are recreated with the creation properties of the source dataset.
+	Both offsets are found with H5Dget_offset, and the bytes are moved between the descriptors of the open files with a reflink or copy_file_range.
+	Returns 0 when the dataset was carved, 1 when the dataset or the files do not qualify, and a negative value on error.
+*/
+herr_t carve_dataset_contiguous(carved_file_handle *handle, const char *dataset_name) {
+	hid_t src_dataset_id = H5Dopen(handle->src_file_id, dataset_name, H5P_DEFAULT);
+
+	if (src_dataset_id < 0) {
+		return 1;
+	}
+
+	hid_t create_plist = H5Dget_create_plist(src_dataset_id);
+	hid_t data_type = H5Dget_type(src_dataset_id);
+	hid_t data_space = H5Dget_space(src_dataset_id);
+	haddr_t src_offset = H5Dget_offset(src_dataset_id);
+	hsize_t storage_size = H5Dget_storage_size(src_dataset_id);
+
+	// The stored bytes must mean the same in the carved file: no references or variable-length data pointing into the original file
+	bool qualifies = create_plist >= 0 && data_type >= 0 && data_space >= 0
+		&& H5Pget_layout(create_plist) == H5D_CONTIGUOUS && H5Pget_external_count(create_plist) == 0
+		&& H5Tdetect_class(data_type, H5T_REFERENCE) == 0 && H5Tdetect_class(data_type, H5T_VLEN) == 0 && H5Tis_variable_str(data_type) == 0
+		&& src_offset != HADDR_UNDEF && storage_size > 0
+		&& is_plain_file(handle->src_file_id) && is_plain_file(handle->carved_file_id);
+
+	hid_t carved_dataset_id = qualifies ? H5Dopen(handle->carved_file_id, dataset_name, H5P_DEFAULT) : H5I_INVALID_HID;
+	hid_t carved_create_plist = carved_dataset_id < 0 ? H5I_INVALID_HID : H5Dget_create_plist(carved_dataset_id);
+	bool is_carved_dataset_contiguous = carved_create_plist >= 0 && H5Pget_layout(carved_create_plist) == H5D_CONTIGUOUS && H5Pget_external_count(carved_create_plist) == 0;
+
+	if (carved_create_plist >= 0)
+		H5Pclose(carved_create_plist);
+
+	bool is_skeleton_dataset_lost = false;
+
+	if (qualifies && !is_carved_dataset_contiguous) {
+		// A committed datatype of the source file cannot be used in the carved file. Link to the copy the skeleton dataset links to, 
+		// or use a transient copy of it.
+		hid_t carved_data_type = carved_dataset_id >= 0 && H5Tcommitted(data_type) > 0 ? H5Dget_type(carved_dataset_id) : H5I_INVALID_HID;
+
+		if (carved_data_type >= 0 && H5Tcommitted(carved_data_type) <= 0) {
+			H5Tclose(carved_data_type);
+			carved_data_type = H5I_INVALID_HID;
+		}
+
+		if (carved_dataset_id >= 0)
+			H5Dclose(carved_dataset_id);
+
+		hid_t create_data_type = carved_data_type >= 0 ? carved_data_type : H5Tcommitted(data_type) > 0 ? H5Tcopy(data_type) : data_type;
+
+		carved_dataset_id = H5Ldelete(handle->carved_file_id, dataset_name, H5P_DEFAULT) < 0 ? H5I_INVALID_HID
+			: H5Dcreate2(handle->carved_file_id, dataset_name, create_data_type, data_space, H5P_DEFAULT, create_plist, H5P_DEFAULT);
+
+		if (create_data_type != data_type)
+			H5Tclose(create_data_type);
+
+		if (carved_dataset_id < 0) {
+			if (DEBUG)
+				fprintf(log_ptr, "Error recreating dataset %s with the creation properties of the original dataset\n", dataset_name);
+			qualifies = false;
+			is_skeleton_dataset_lost = true;
+		}
+	}
+
+	haddr_t dest_offset = HADDR_UNDEF;
+
+	if (qualifies) {
+		if (DEBUG)
+			fprintf(log_ptr, "Copying contiguous dataset %s as a byte range of %llu bytes\n", dataset_name, (unsigned long long)storage_size);
+
+		dest_offset = H5Dget_offset(carved_dataset_id);
+
+		if (dest_offset == HADDR_UNDEF && write_first_element(src_dataset_id, carved_dataset_id, data_type, data_space) >= 0) {
+			dest_offset = H5Dget_offset(carved_dataset_id);
+		}
+
+		if (H5Dget_storage_size(carved_dataset_id) != storage_size) {
+			dest_offset = HADDR_UNDEF;
+		}
+
+		// Closing the dataset flushes the element written out of its sieve buffer, before the bytes around it are replaced
+		H5Dclose(carved_dataset_id);
+	} else if (carved_dataset_id >= 0) {
+		H5Dclose(carved_dataset_id);
+	}
+
+	H5Dclose(src_dataset_id);
+
+	if (create_plist >= 0)
+		H5Pclose(create_plist);
+	if (data_type >= 0)
+		H5Tclose(data_type);
+	if (data_space >= 0)
+		H5Sclose(data_space);
+
+	if (is_skeleton_dataset_lost) {
+		return -1;
+	}
+
+	if (dest_offset == HADDR_UNDEF) {
+		return 1;
+	}
+
+	// Use the descriptors of the files the library has open, since the filenames may be relative to a directory the application has left.
+	// Both files use the sec2 driver, whose handle is a pointer to its file descriptor. The descriptors stay owned by the library.
+	int *src_fd = NULL;
+	int *dest_fd = NULL;
+	int copy_return_val = -1;
+
+	if (H5Fget_vfd_handle(handle->src_file_id, H5P_DEFAULT, (void **)&src_fd) >= 0 && H5Fget_vfd_handle(handle->carved_file_id, H5P_DEFAULT, (void **)&dest_fd) >= 0
+		&& src_fd != NULL && dest_fd != NULL) {
+		copy_return_val = copy_file_bytes(*src_fd, (off_t)src_offset, *dest_fd, (off_t)dest_offset, (size_t)storage_size);
+
+		if (copy_return_val < 0 && DEBUG)
+			fprintf(log_ptr, "Error copying byte range of dataset %s: %s\n", dataset_name, strerror(errno));
+	} else if (DEBUG) {
+		fprintf(log_ptr, "Error getting the file descriptors to copy dataset %s\n", dataset_name);
+	}
+
+	// Leave it to the complete object copy, which replaces the skeleton dataset
+	return copy_return_val < 0 ? 1 : 0;
+}
+
+/*
+	Give a skeleton dataset created without storage the allocation and fill properties of its source dataset back, before data is written into it.
+	Only skeleton datasets with the given layout are restored, or any with H5D_LAYOUT_ERROR. The dataset is recreated, so skeleton_info is updated to its new token.
+	Returns 1 if the dataset was recreated, 0 if it had nothing to restore, and a negative value on error.
+*/
+static herr_t restore_skeleton_dataset(carved_file_handle *handle, hid_t dataset_id, const char *dataset_name, H5D_layout_t layout, H5O_info2_t *skeleton_info) {
+	hid_t carved_dataset_id = H5Dopen(handle->carved_file_id, dataset_name, H5P_DEFAULT);
+
+	if (carved_dataset_id < 0) {
+		return 0;
+	}
+
+	hid_t data_type = H5Dget_type(dataset_id);
+	hid_t data_space = H5Dget_space(dataset_id);
+	hid_t expected_create_plist = data_type >= 0 && data_space >= 0 ? get_skeleton_create_plist(dataset_id, data_type, data_space) : H5I_INVALID_HID;
+	hid_t carved_create_plist = H5Dget_create_plist(carved_dataset_id);
+	H5D_alloc_time_t expected_alloc_time, carved_alloc_time;
+	H5D_fill_time_t expected_fill_time, carved_fill_time;
+
+	bool is_deferred = expected_create_plist >= 0 && carved_create_plist >= 0
+		&& (layout == H5D_LAYOUT_ERROR || H5Pget_layout(carved_create_plist) == layout)
+		&& H5Pget_alloc_time(expected_create_plist, &expected_alloc_time) >= 0 && H5Pget_alloc_time(carved_create_plist, &carved_alloc_time) >= 0
+		&& H5Pget_fill_time(expected_create_plist, &expected_fill_time) >= 0 && H5Pget_fill_time(carved_create_plist, &carved_fill_time) >= 0
+		&& (expected_alloc_time != carved_alloc_time || expected_fill_time != carved_fill_time);
+
+	// The recreated dataset links to the committed datatype the skeleton dataset links to
+	hid_t carved_data_type = is_deferred ? H5Dget_type(carved_dataset_id) : H5I_INVALID_HID;
+
+	if (carved_data_type >= 0 && H5Tcommitted(carved_data_type) <= 0) {
+		H5Tclose(carved_data_type);
+		carved_data_type = H5I_INVALID_HID;
+	}
+
+	H5Dclose(carved_dataset_id);
+
+	if (expected_create_plist >= 0)
+		H5Pclose(expected_create_plist);
+	if (carved_create_plist >= 0)
+		H5Pclose(carved_create_plist);
+	if (data_type >= 0)
+		H5Tclose(data_type);
+	if (data_space >= 0)
+		H5Sclose(data_space);
+
+	if (!is_deferred) {
+		return 0;
+	}
+
+	if (DEBUG)
+		fprintf(log_ptr, "Restoring creation properties of skeleton dataset %s\n", dataset_name);
+
+	// The deleted dataset leaves the manifest, since its address may be reused by the next object created.
+	// A dataset with other hard links outlives its link, and leaves the manifest once carve_dataset has relinked them.
+	if (H5Ldelete(handle->carved_file_id, dataset_name, H5P_DEFAULT) < 0) {
+		if (DEBUG)
+			fprintf(log_ptr, "Error deleting skeleton dataset %s\n", dataset_name);
+		if (carved_data_type >= 0)
+			H5Tclose(carved_data_type);
+		return -1;
+	}
+
+	if (skeleton_info->rc == 1) {
+		mark_dataset_carved_in_manifest(skeleton_info->fileno, &skeleton_info->token);
+	}
+
+	herr_t create_return_val = create_skeleton_dataset(dataset_id, handle->carved_file_id, dataset_name, carved_data_type, false);
+
+	if (carved_data_type >= 0)
+		H5Tclose(carved_data_type);
+
+	if (create_return_val < 0 || H5Oget_info_by_name3(handle->carved_file_id, dataset_name, skeleton_info, H5O_INFO_BASIC, H5P_DEFAULT) < 0) {
+		if (DEBUG)
+			fprintf(log_ptr, "Error recreating skeleton dataset %s\n", dataset_name);
+		return -1;
+	}
+
+	return 1;
+}
+
+// Path of an object through hard links only, with the soft links on its path replaced by their targets. Returns NULL on error or if the path leaves the file.
+static char *resolve_hard_link_path(hid_t file_id, const char *object_path, int soft_links_followed) {
+	if (soft_links_followed > MAX_SOFT_LINKS_FOLLOWED) {
+		if (DEBUG)
+			fprintf(log_ptr, "Too many soft links on path %s\n", object_path);
+		return NULL;
+	}
+
+	char *resolved_path = calloc(1, 1);
+	const char *component = object_path;
+
+	while (resolved_path != NULL && *component != '\0') {
+		if (*component == '/') {
+			component++;
+			continue;
+		}
+
+		size_t component_length = strcspn(component, "/");
+		size_t resolved_length = strlen(resolved_path);
+		char *link_path = malloc(resolved_length + component_length + 2);
+
+		sprintf(link_path, "%s/%.*s", resolved_path, (int)component_length, component);
+		component += component_length;
+
+		H5L_info2_t link_info;
+		free(resolved_path);
+		resolved_path = NULL;
+
+		if (H5Lget_info2(file_id, link_path, &link_info, H5P_DEFAULT) < 0) {
+			if (DEBUG)
+				fprintf(log_ptr, "Error fetching link info of %s\n", link_path);
+		} else if (link_info.type == H5L_TYPE_HARD) {
+			resolved_path = link_path;
+			link_path = NULL;
+		} else if (link_info.type == H5L_TYPE_SOFT) {
+			char *link_value = malloc(link_info.u.val_size);
+
+			if (H5Lget_val(file_id, link_path, link_value, link_info.u.val_size, H5P_DEFAULT) >= 0) {
+				// Relative targets are resolved from the group holding the link
+				char *target_path = malloc(resolved_length + strlen(link_value) + 2);
+
+				sprintf(target_path, "%.*s/%s", link_value[0] == '/' ? 0 : (int)resolved_length, link_path, link_value);
+				resolved_path = resolve_hard_link_path(file_id, target_path, soft_links_followed + 1);
+				free(target_path);
+			}
+
+			free(link_value);
+		}
+
+		free(link_path);
+	}
+
+	if (resolved_path != NULL && resolved_path[0] == '\0') {
+		free(resolved_path);
+		resolved_path = malloc(2);
+		strcpy(resolved_path, "/");
+	}
+
+	return resolved_path;
+}
+
+// Hard links of a carved file leading to an object, collected by H5Lvisit2
+typedef struct {
+	hid_t carved_file_id;
+	const H5O_token_t *token;
+	char **paths;
+	size_t paths_size;
+} shared_dataset_links;
+
+static herr_t collect_shared_dataset_link(hid_t group_id, const char *name, const H5L_info2_t *link_info, void *opdata) {
+	shared_dataset_links *links = (shared_dataset_links *)opdata;
+	int token_cmp;
+
+	if (link_info->type != H5L_TYPE_HARD || H5Otoken_cmp(links->carved_file_id, &link_info->u.token, links->token, &token_cmp) < 0 || token_cmp != 0) {
+		return 0;
+	}
+
+	links->paths = realloc(links->paths, (links->paths_size + 1) * sizeof(char *));
+	links->paths[links->paths_size] = malloc(strlen(name) + 1);
+	strcpy(links->paths[links->paths_size], name);
+	links->paths_size += 1;
+
+	return 0;
+}
+
+/*
+	Point the other hard links of a dataset replaced by carving to the dataset that replaced it. Carving replaces the link it was reached through,
+	so in repeat mode the other paths would otherwise open the skeleton dataset. The skeleton dataset is freed with its last link.
+*/
+static herr_t relink_shared_dataset(carved_file_handle *handle, const char *dataset_name, const H5O_token_t *skeleton_token) {
+	shared_dataset_links links;
+	links.carved_file_id = handle->carved_file_id;
+	links.token = skeleton_token;
+	links.paths = NULL;
+	links.paths_size = 0;
+
+	herr_t return_val = H5Lvisit2(handle->carved_file_id, H5_INDEX_NAME, H5_ITER_INC, collect_shared_dataset_link, &links);
+
+	for (size_t i = 0; i < links.paths_size; i++) {
+		if (DEBUG)
+			fprintf(log_ptr, "Relinking %s to carved dataset %s\n", links.paths[i], dataset_name);
+
+		if (return_val >= 0 && (H5Ldelete(handle->carved_file_id, links.paths[i], H5P_DEFAULT) < 0
+			|| H5Lcreate_hard(handle->carved_file_id, dataset_name, handle->carved_file_id, links.paths[i], H5P_DEFAULT, H5P_DEFAULT) < 0)) {
+			if (DEBUG)
+				fprintf(log_ptr, "Error relinking %s to carved dataset %s\n", links.paths[i], dataset_name);
+			return_val = -1;
+		}
+
+		free(links.paths[i]);
+	}
+
+	free(links.paths);
+
+	return return_val;
+}
+
+// Copy the attributes of a source dataset onto the dataset that replaced its skeleton dataset, for attributes copied with the skeleton
+static herr_t copy_replaced_dataset_attributes(carved_file_handle *handle, hid_t dataset_id, const char *dataset_name) {
+	hid_t carved_dataset_id = H5Dopen(handle->carved_file_id, dataset_name, H5P_DEFAULT);
+
+	if (carved_dataset_id < 0) {
+		if (DEBUG)
+			fprintf(log_ptr, "Error opening carved dataset %s\n", dataset_name);
+		return -1;
+	}
+
+	// References in attributes are remapped through the global source and carved file
+	src_file_id = handle->src_file_id;
+	dest_file_id = handle->carved_file_id;
+
+	herr_t attribute_iterate_return_val = original_H5Aiterate2(dataset_id, H5_INDEX_NAME, H5_ITER_INC, NULL, copy_object_attributes, &carved_dataset_id);
+
+	H5Dclose(carved_dataset_id);
+	release_reference_memo();
+	release_type_copy_plans();
+
+	if (attribute_iterate_return_val < 0 && DEBUG)
+		fprintf(log_ptr, "Error copying attributes of carved dataset %s\n", dataset_name);
+
+	return attribute_iterate_return_val;
+}
+
+static herr_t carve_dataset_at_path(carved_file_handle *handle, hid_t dataset_id, const char *dataset_name, hid_t mem_type_id, hid_t mem_space_id, hid_t file_space_id, hid_t dxpl_id, const void *buf, bool *is_fully_carved) {
+	herr_t carve_return_val = 1;
+
+	// Token of the skeleton dataset, which most paths replace with a new object. Restoring its creation properties replaces it before carving.
+	H5O_info2_t skeleton_info;
+	bool has_skeleton_info = H5Oget_info_by_name3(handle->carved_file_id, dataset_name, &skeleton_info, H5O_INFO_BASIC, H5P_DEFAULT) >= 0;
+	H5O_info2_t original_info = skeleton_info;
+
+	// In partial carving mode only the blocks overlapping the selection are carved
+	if (is_partial_carving_mode) {
+		carve_return_val = carve_dataset_selection(dataset_id, handle->carved_file_id, dataset_name, file_space_id, is_fully_carved);
+	}
+
+	// The remaining paths carve the complete dataset
+	if (carve_return_val > 0) {
+		*is_fully_carved = true;
+
+		// Raw chunks are written into the skeleton dataset itself, which first gets the creation properties of the source dataset back
+		if (is_skeleton_storage_deferred && has_skeleton_info && restore_skeleton_dataset(handle, dataset_id, dataset_name, H5D_CHUNKED, &skeleton_info) < 0) {
+			return -1;
+		}
+
+		// Filtered chunks are copied as stored, without decompressing and recompressing them
+		carve_return_val = carve_dataset_chunks(handle->src_file_id, handle->carved_file_id, dataset_name);
+	}
+
+	// Contiguous, unfiltered datasets are copied as a byte range by the kernel, into a skeleton dataset that first gets its creation properties back too
+	if (carve_return_val > 0) {
+		if (is_skeleton_storage_deferred && has_skeleton_info && restore_skeleton_dataset(handle, dataset_id, dataset_name, H5D_CONTIGUOUS, &skeleton_info) < 0) {
+			return -1;
+		}
+
+		carve_return_val = carve_dataset_contiguous(handle, dataset_name);
+	}
+
+	// When the application read the whole dataset, its buffer already holds the contents. Write it into the skeleton dataset instead of reading the original file again.
+	if (carve_return_val > 0 && buf != NULL && mem_type_id != H5I_INVALID_HID) {
+		if (is_skeleton_storage_deferred && has_skeleton_info && restore_skeleton_dataset(handle, dataset_id, dataset_name, H5D_LAYOUT_ERROR, &skeleton_info) < 0) {
+			return -1;
+		}
+
+		carve_return_val = carve_dataset_from_buffer(dataset_id, handle->carved_file_id, dataset_name, mem_type_id, mem_space_id, file_space_id, dxpl_id, buf);
+	}
+
+	// Otherwise make a copy of the complete dataset object
+	if (carve_return_val > 0) {
+		carve_return_val = copy_dataset_object(handle->src_file_id, handle->carved_file_id, dataset_name);
+	}
+
+	if (carve_return_val < 0) {
+		return carve_return_val;
+	}
+
+	H5O_info2_t carved_info;
+	bool has_carved_info = has_skeleton_info && H5Oget_info_by_name3(handle->carved_file_id, dataset_name, &carved_info, H5O_INFO_BASIC | H5O_INFO_NUM_ATTRS, H5P_DEFAULT) >= 0;
+
+	if (has_carved_info) {
+		int token_cmp = 0;
+		H5Otoken_cmp(handle->carved_file_id, &original_info.token, &carved_info.token, &token_cmp);
+
+		// The other links of a replaced dataset still lead to the skeleton dataset, which stays empty in the manifest until they are relinked
+		if (token_cmp != 0) {
+			if (original_info.rc > 1 && relink_shared_dataset(handle, dataset_name, &original_info.token) < 0) {
+				return -1;
+			}
+
+			mark_dataset_carved_in_manifest(original_info.fileno, &original_info.token);
+		}
+
+		if (*is_fully_carved) {
+			mark_dataset_carved_in_manifest(carved_info.fileno, &carved_info.token);
+		}
+	}
+
+	// Datasets carved in place keep the attributes of the skeleton. Replaced datasets get them again now, or when the library terminates.
+	if (are_attributes_copied_with_skeleton()) {
+		H5O_info2_t source_info;
+
+		if (has_carved_info && H5Oget_info3(dataset_id, &source_info, H5O_INFO_NUM_ATTRS) >= 0 && carved_info.num_attrs < source_info.num_attrs
+			&& copy_replaced_dataset_attributes(handle, dataset_id, dataset_name) < 0) {
+			return -1;
+		}
+	} else {
+		herr_t mark_return_val = mark_dataset_copied(handle->carved_file_id);
+
+		if (mark_return_val < 0) {
+			return mark_return_val;
+		}
+	}
+
+	record_dataset_carved(handle, dataset_name);
+
+	return 0;
+}
+
+/*
+	Carve a dataset read by the application into its carved file, trying the cheapest applicable path first.
+	Each path returns 1 when it does not apply to the dataset, handing it to the next one. The buffer holding what the application read is optional:
+	callers carving without a read pass NULL, and H5I_INVALID_HID for its memory type, memory dataspace and transfer property list.
+	is_fully_carved is set to false when only part of the dataset was carved. Datasets reached through soft links are carved at the path of their hard link,
+	since replacing the skeleton dataset through a soft link would replace the soft link itself.
+*/
+herr_t carve_dataset(carved_file_handle *handle, hid_t dataset_id, const char *dataset_name, hid_t mem_type_id, hid_t mem_space_id, hid_t file_space_id, hid_t dxpl_id, const void *buf, bool *is_fully_carved) {
+	char *hard_link_path = resolve_hard_link_path(handle->src_file_id, dataset_name, 0);
+
+	if (hard_link_path == NULL) {
+		if (DEBUG)
+			fprintf(log_ptr, "Error resolving path of dataset %s\n", dataset_name);
+		return -1;
+	}
+
+	herr_t return_val = carve_dataset_at_path(handle, dataset_id, hard_link_path, mem_type_id, mem_space_id, file_space_id, dxpl_id, buf, is_fully_carved);
+
+	free(hard_link_path);
+
+	return return_val;
+}
+
+/*
+	The hooks and the carving worker share the handle pool, the manifests, the skeletons, the carved set and the attribute records,
+	which are only touched with the carving state locked. The lock is recursive, since the hooks reach each other through the library.
+	An application thread may enter a hook from a callback of the library while holding its global lock, and then waits for the
+	carving state lock. The worker therefore never waits for the carving state lock while holding the global lock.
+*/
+static pthread_mutex_t carving_state_mutex = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+
+void lock_carving_state(void) {
+	pthread_mutex_lock(&carving_state_mutex);
+}
+
+void unlock_carving_state(void) {
+	pthread_mutex_unlock(&carving_state_mutex);
+}
+
+// Pause of the carving worker between attempts to take the locks
+#define CARVE_WORKER_BACKOFF_NS 50000
+
+static bool is_carve_queue_closing(void);
+
+/*
+	Lock the carving state for a job of the carving worker. The worker takes the global lock of the library first, so that the job
+	runs without interleaving with other calls into the library, then tries the carving state lock. When a hook holds it, the worker
+	releases the global lock again and backs off, so that the hook can complete. The worker is only started with a thread-safe build.
+	Once the queue is closed the worker gives up and returns false, since the thread closing it may hold the global lock.
+*/
+static bool lock_carving_state_for_worker(void) {
+	struct timespec backoff = {0, CARVE_WORKER_BACKOFF_NS};
+
+	while (true) {
+#ifdef H5_HAVE_THREADSAFE
+		bool is_acquired = false;
+
+		while (H5TSmutex_acquire(1, &is_acquired) < 0 || !is_acquired) {
+			if (is_carve_queue_closing()) {
+				return false;
+			}
+
+			nanosleep(&backoff, NULL);
+		}
+#endif
+
+		if (pthread_mutex_trylock(&carving_state_mutex) == 0) {
+			return true;
+		}
+
+#ifdef H5_HAVE_THREADSAFE
+		unsigned int lock_count;
+		H5TSmutex_release(&lock_count);
+#endif
+
+		if (is_carve_queue_closing()) {
+			return false;
+		}
+
+		nanosleep(&backoff, NULL);
+	}
+}
+
+static void unlock_carving_state_for_worker(void) {
+	pthread_mutex_unlock(&carving_state_mutex);
+
+#ifdef H5_HAVE_THREADSAFE
+	unsigned int lock_count;
+	H5TSmutex_release(&lock_count);
+#endif
+}
+
+// Dataset queued for the carving worker. The selection is a copy of the one read, or H5S_ALL.
+typedef struct carve_job {
+	carved_file_handle *handle;
+	char *dataset_name;
+	hid_t file_space_id;
+	struct carve_job *next;
+} carve_job;
+
+static pthread_mutex_t carve_queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t carve_queue_cond = PTHREAD_COND_INITIALIZER;
+static carve_job *carve_queue_head;
+static carve_job *carve_queue_tail;
+static bool is_carve_queue_closed;
+static bool is_carve_worker_running;
+static pthread_t carve_worker;
+
+static bool is_carve_queue_closing(void) {
+	pthread_mutex_lock(&carve_queue_mutex);
+	bool is_closing = is_carve_queue_closed;
+	pthread_mutex_unlock(&carve_queue_mutex);
+
+	return is_closing;
+}
+
+static void run_carve_job(carve_job *job) {
+	// The application may have closed the original file since the job was queued
+	hid_t dataset_id = open_source_file(job->handle) < 0 ? H5I_INVALID_HID : H5Dopen(job->handle->src_file_id, job->dataset_name, H5P_DEFAULT);
+
+	if (dataset_id < 0) {
+		if (DEBUG)
+			fprintf(log_ptr, "Error opening queued dataset %s\n", job->dataset_name);
+	} else {
+		bool is_fully_carved;
+
+		if (carve_dataset(job->handle, dataset_id, job->dataset_name, H5I_INVALID_HID, H5I_INVALID_HID, job->file_space_id, H5I_INVALID_HID, NULL, &is_fully_carved) < 0) {
+			if (DEBUG)
+				fprintf(log_ptr, "Error carving queued dataset %s\n", job->dataset_name);
+		}
+
+		H5Dclose(dataset_id);
+	}
+
+	// Once the application has closed the original file, the source handle is not kept open in its way
+	if (job->handle->application_handle_count == 0) {
+		close_source_file(job->handle);
+	}
+
+	if (job->file_space_id != H5S_ALL)
+		H5Sclose(job->file_space_id);
+	free(job->dataset_name);
+	free(job);
+}
+
+static void *carve_worker_main(void *arg) {
+	pthread_mutex_lock(&carve_queue_mutex);
+
+	while (true) {
+		while (carve_queue_head == NULL && !is_carve_queue_closed) {
+			pthread_cond_wait(&carve_queue_cond, &carve_queue_mutex);
+		}
+
+		// Jobs left in a closed queue are carved by the thread that closed it
+		if (is_carve_queue_closed) {
+			break;
+		}
+
+		carve_job *job = carve_queue_head;
+		carve_queue_head = job->next;
+
+		if (carve_queue_head == NULL) {
+			carve_queue_tail = NULL;
+		}
+
+		pthread_mutex_unlock(&carve_queue_mutex);
+
+		if (!lock_carving_state_for_worker()) {
+			pthread_mutex_lock(&carve_queue_mutex);
+			job->next = carve_queue_head;
+			carve_queue_head = job;
+
+			if (carve_queue_tail == NULL) {
+				carve_queue_tail = job;
+			}
+
+			break;
+		}
+
+		run_carve_job(job);
+		unlock_carving_state_for_worker();
+		pthread_mutex_lock(&carve_queue_mutex);
+	}
+
+	pthread_mutex_unlock(&carve_queue_mutex);
+
+	return NULL;
+}
+
+/*
+	Queue a dataset for the carving worker, starting the worker on first use.
+	The worker calls into HDF5 concurrently with the application, so it is only used with a thread-safe build of the library, 
+	whose global lock serializes the calls. Returns false when the dataset has to be carved synchronously instead.
+*/
+bool enqueue_carve_job(carved_file_handle *handle, const char *dataset_name, hid_t file_space_id) {
+	pthread_mutex_lock(&carve_queue_mutex);
+
+	if (!is_carve_worker_running && !is_carve_queue_closed) {
+		hbool_t is_threadsafe = false;
+		H5is_library_threadsafe(&is_threadsafe);
+
+		if (!is_threadsafe || pthread_create(&carve_worker, NULL, carve_worker_main, NULL) != 0) {
+			if (DEBUG)
+				fprintf(log_ptr, "Carving synchronously, HDF5 library is not thread-safe or worker could not be started\n");
+
+			// Do not try again
+			is_carve_queue_closed = true;
+		} else {
+			is_carve_worker_running = true;
+		}
+	}
+
+	if (!is_carve_worker_running || is_carve_queue_closed) {
+		pthread_mutex_unlock(&carve_queue_mutex);
+		return false;
+	}
+
+	carve_job *job = malloc(sizeof(carve_job));
+	job->handle = handle;
+	job->dataset_name = malloc(strlen(dataset_name) + 1);
+	strcpy(job->dataset_name, dataset_name);
+	job->file_space_id = file_space_id == H5S_ALL ? H5S_ALL : H5Scopy(file_space_id);
+	job->next = NULL;
+
+	if (carve_queue_tail == NULL) {
+		carve_queue_head = job;
+	} else {
+		carve_queue_tail->next = job;
+	}
+
+	carve_queue_tail = job;
+
+	pthread_cond_signal(&carve_queue_cond);
+	pthread_mutex_unlock(&carve_queue_mutex);
+
+	if (DEBUG)
+		fprintf(log_ptr, "Queued dataset %s for carving\n", dataset_name);
+
+	return true;
+}
+
+/*
+	Stop the carving worker and carve the datasets still queued. Called from H5_term_library before attributes are copied.
+	The application may call H5close itself, so H5_term_library can run inside an API call holding the global lock of the library,
+	which the worker needs for every job. The worker therefore only finishes the job it is running, and the remaining ones are carved by this thread.
+*/
+void drain_carve_queue(void) {
+	pthread_mutex_lock(&carve_queue_mutex);
+	is_carve_queue_closed = true;
+	bool was_worker_running = is_carve_worker_running;
+	is_carve_worker_running = false;
+	pthread_cond_signal(&carve_queue_cond);
+	pthread_mutex_unlock(&carve_queue_mutex);
+
+	if (was_worker_running) {
+		pthread_join(carve_worker, NULL);
+	}
+
+	carve_job *job = carve_queue_head;
+	carve_queue_head = NULL;
+	carve_queue_tail = NULL;
+
+	if (job != NULL && DEBUG)
+		fprintf(log_ptr, "Carving queued datasets left by the carving worker\n");
+
+	while (job != NULL) {
+		carve_job *next_job = job->next;
+
+		lock_carving_state();
+		run_carve_job(job);
+		unlock_carving_state();
+
+		job = next_job;
+	}
+}
+
+// Number of pages in the page buffer of carved files created with the paged layout
+#define CARVED_FILE_BUFFER_PAGES 64
+
+/*
+	Fetch the creation property list of carved files. With CARVE_PAGE_SIZE, file space is allocated in pages, which keep the metadata
+	of the skeleton together instead of interleaving it with raw data, and the root group keeps more links in its object header.
+*/
+static hid_t get_carved_file_create_plist(void) {
+	hid_t create_plist = H5Pcreate(H5P_FILE_CREATE);
+
+	// With CARVE_PERSIST_FREE_SPACE, space freed when skeleton datasets are replaced is tracked in the file and reused by later runs
+	if (create_plist >= 0 && (carved_file_page_size > 0 || is_free_space_persistent)) {
+		H5F_fspace_strategy_t strategy = carved_file_page_size > 0 ? H5F_FSPACE_STRATEGY_PAGE : H5F_FSPACE_STRATEGY_FSM_AGGR;
+		H5Pset_file_space_strategy(create_plist, strategy, is_free_space_persistent, 1);
+	}
+
+	if (create_plist >= 0 && carved_file_page_size > 0) {
+		H5Pset_file_space_page_size(create_plist, carved_file_page_size);
+		H5Pset_link_phase_change(create_plist, SKELETON_GROUP_MAX_COMPACT, SKELETON_GROUP_MIN_DENSE);
+	}
+
+	return create_plist;
+}
+
+// Fetch the access property list of carved files, with a page buffer for paged carved files
+static hid_t get_carved_file_access_plist(void) {
+	hid_t access_plist = H5Pcreate(H5P_FILE_ACCESS);
+
+	if (access_plist >= 0 && carved_file_page_size > 0) {
+		H5Pset_libver_bounds(access_plist, H5F_LIBVER_LATEST, H5F_LIBVER_LATEST);
+		H5Pset_page_buffer_size(access_plist, carved_file_page_size * CARVED_FILE_BUFFER_PAGES, 0, 0);
+	} else if (access_plist >= 0) {
+		H5Pset_libver_bounds(access_plist, H5F_LIBVER_V18, H5F_LIBVER_LATEST);
+	}
+
+	return access_plist;
+}
+
+// Growth increment of the memory image of carved files opened with the core driver
+#define CORE_FILE_INCREMENT (1024 * 1024)
+
+/*
+	Open a carved file with the access properties of the application, or the default ones.
+	In repeat mode, carved files opened read-only and no larger than CARVE_CORE_SIZE are read into memory with the core driver,
+	so later reads make no system calls. Otherwise a page buffer is added when CARVE_PAGE_SIZE is set.
+	Carved files created without pages cannot have a page buffer, and the application's properties are meant for the original file,
+	so an open that fails with them is retried with the default properties.
+*/
+hid_t open_carved_file(const char *carved_filename, unsigned flags, hid_t fapl_id) {
+	struct stat carved_file_stat;
+	bool is_in_memory = is_repeat_mode && core_file_size_limit > 0 && (flags & H5F_ACC_RDWR) == 0
+		&& stat(carved_filename, &carved_file_stat) == 0 && (hsize_t)carved_file_stat.st_size <= core_file_size_limit;
+
+	if (fapl_id == H5P_DEFAULT && carved_file_page_size == 0 && !is_in_memory) {
+		return original_H5Fopen(carved_filename, flags, H5P_DEFAULT);
+	}
+
+	hid_t access_plist = fapl_id == H5P_DEFAULT ? H5Pcreate(H5P_FILE_ACCESS) : H5Pcopy(fapl_id);
+	hid_t carved_file = H5I_INVALID_HID;
+
+	if (access_plist >= 0) {
+		if (is_in_memory) {
+			H5Pset_fapl_core(access_plist, CORE_FILE_INCREMENT, false);
+		} else if (carved_file_page_size > 0) {
+			H5Pset_page_buffer_size(access_plist, carved_file_page_size * CARVED_FILE_BUFFER_PAGES, 0, 0);
+		}
+
+		H5E_BEGIN_TRY {
+			carved_file = original_H5Fopen(carved_filename, flags, access_plist);
+		} H5E_END_TRY;
+
+		H5Pclose(access_plist);
+	}
+
+	if (carved_file == H5I_INVALID_HID) {
+		if (DEBUG)
+			fprintf(log_ptr, "Opening carved file %s with the default access properties\n", carved_filename);
+		carved_file = original_H5Fopen(carved_filename, flags, H5P_DEFAULT);
+	} else if (is_in_memory && DEBUG) {
+		fprintf(log_ptr, "Opened carved file %s in memory\n", carved_filename);
+	}
+
+	return carved_file;
+}
+
+/*
+	Create the carved file of a source file and make an identical skeleton copy of its structure in it.
+	The copy includes all groups, datasets, and attributes but excludes the contents of the datasets.
+	Returns the carved file, open read-write.
+*/
+hid_t create_skeleton_file(hid_t src_file, const char *carved_filename) {
+	// Open root group of source file
+	hid_t group_location_id = H5Gopen(src_file, "/", H5P_DEFAULT);
+
+	if (group_location_id == H5I_INVALID_HID) {
+		if (DEBUG)
+			fprintf(log_ptr, "Error opening source file root group %ld\n", src_file);
+		return H5I_INVALID_HID;
+	}
+
+	// Create destination (to-be carved) file and open the root group to duplicate the general structure of source file
+	// The carving manifest grows past the 64 KiB limit of attributes stored in the object header with many datasets, 
+	// so the carved file uses the 1.8 format or later, which stores large attributes densely. Paged files use the latest format.
+	hid_t carved_file_create_plist = get_carved_file_create_plist();
+	hid_t carved_file_access_plist = get_carved_file_access_plist();
+
+	hid_t carved_file = H5Fcreate(carved_filename, H5F_ACC_TRUNC, carved_file_create_plist, carved_file_access_plist);
+	H5Pclose(carved_file_create_plist);
+	H5Pclose(carved_file_access_plist);
+
+	if (carved_file == H5I_INVALID_HID) {
+		if (DEBUG)
+			fprintf(log_ptr, "Error creating destination file %s\n", carved_filename);
+		H5Gclose(group_location_id);
+		return H5I_INVALID_HID;
+	}
+
+	// Open root group of destination file
+	hid_t destination_group_location_id = H5Gopen(carved_file, "/", H5P_DEFAULT);
+
+	if (destination_group_location_id == H5I_INVALID_HID) {
+		if (DEBUG)
+			fprintf(log_ptr, "Error opening destination file root group %ld\n", carved_file);
+		H5Gclose(group_location_id);
+		H5Fclose(carved_file);
+		return H5I_INVALID_HID;
+	}
+
+	// herr_t fallback_metadata_ret_val = create_fallback_metadata(filename, destination_group_location_id);
+
+	// if (fallback_metadata_ret_val < 0) {
+	// 	if (DEBUG)
+	// 		fprintf(log_ptr, "Error creating fallback metadata");
+	// 	return fallback_metadata_ret_val;
+	// }
+
+	// Carving status is kept in the manifest, written once the skeleton is built
+	create_carving_manifest(carved_file);
+
+	herr_t link_iterate_return_val = 0;
+
+	// In lazy skeleton mode only the root is created here, objects are added as they are accessed
+	if (!is_lazy_skeleton_mode) {
+		if (DEBUG)
+			fprintf(log_ptr, "CARVING GROUPS AND EMPTY DATASETS\n");
+
+		// Walk the links of the source file to make a copy of its structure without populating contents i.e a "skeleton" 
+		link_iterate_return_val = build_skeleton(src_file, carved_file);
+	}
+
+	// Attributes left out of the skeleton are copied when the library terminates
+	if (is_copying_all_attributes && !are_attributes_copied_with_skeleton()) {
+		set_manifest_attributes_pending(carved_file, true);
+	}
+
+	H5Gclose(destination_group_location_id);
+	H5Gclose(group_location_id);
+
+	if (link_iterate_return_val < 0) {
+		if (DEBUG)
+			fprintf(log_ptr, "Link iteration failed %ld\n", src_file);
+		close_carving_manifest(carved_file);
+		H5Fclose(carved_file);
+		return H5I_INVALID_HID;
+	}
+
+	write_carving_manifest(carved_file);
+
+	return carved_file;
+}
+
+// Dataset read in deferred mode, with the bounds of the selection read. A rank of 0 stands for the whole dataset.
+// The file index and offset order the batch carved when the library terminates.
+typedef struct {
+	char *filename;
+	char *dataset_name;
+	int rank;
+	hsize_t start[H5S_MAX_RANK];
+	hsize_t end[H5S_MAX_RANK];
+	int file_index;
+	haddr_t offset;
+} deferred_dataset;
+
+static deferred_dataset *deferred_datasets;
+static size_t deferred_datasets_size;
+static size_t deferred_datasets_capacity;
+
+// Record a dataset read in deferred mode. Nothing is written until carve_deferred_datasets is called.
+void record_deferred_dataset(const char *filename, const char *dataset_name, int rank, const hsize_t *start, const hsize_t *end) {
+	if (deferred_datasets_size == deferred_datasets_capacity) {
+		deferred_datasets_capacity = deferred_datasets_capacity == 0 ? 64 : deferred_datasets_capacity * 2;
+		deferred_datasets = realloc(deferred_datasets, deferred_datasets_capacity * sizeof(deferred_dataset));
+	}
+
+	deferred_dataset *record = &deferred_datasets[deferred_datasets_size];
+	record->filename = malloc(strlen(filename) + 1);
+	strcpy(record->filename, filename);
+	record->dataset_name = malloc(strlen(dataset_name) + 1);
+	strcpy(record->dataset_name, dataset_name);
+	record->rank = rank;
+
+	for (int i = 0; i < rank; i++) {
+		record->start[i] = start[i];
+		record->end[i] = end[i];
+	}
+
+	record->file_index = 0;
+	record->offset = HADDR_UNDEF;
+
+	deferred_datasets_size += 1;
+
+	if (DEBUG)
+		fprintf(log_ptr, "Recorded dataset %s for deferred carving\n", dataset_name);
+}
+
+// Address of the data of a dataset in its file: the contiguous data or its first chunk. HADDR_UNDEF when nothing is allocated.
+static haddr_t get_dataset_data_offset(hid_t dataset_id) {
+	haddr_t offset = H5Dget_offset(dataset_id);
+
+	if (offset != HADDR_UNDEF) {
+		return offset;
+	}
+
+	hid_t dcpl_id = H5Dget_create_plist(dataset_id);
+
+	if (dcpl_id >= 0 && H5Pget_layout(dcpl_id) == H5D_CHUNKED) {
+		hsize_t chunk_offset[H5S_MAX_RANK];
+		unsigned filter_mask;
+		hsize_t chunk_size;
+
+		if (H5Dget_chunk_info(dataset_id, H5S_ALL, 0, chunk_offset, &filter_mask, &offset, &chunk_size) < 0) {
+			offset = HADDR_UNDEF;
+		}
+	}
+
+	if (dcpl_id >= 0)
+		H5Pclose(dcpl_id);
+
+	return offset;
+}
+
+// Fetch the bounds of a selection. Returns the rank of the dataspace, or 0 when the whole dataset is selected.
+int get_selection_bounds(hid_t file_space_id, hsize_t *start, hsize_t *end) {
+	if (file_space_id == H5S_ALL || H5Sget_select_type(file_space_id) == H5S_SEL_ALL) {
+		return 0;
+	}
+
+	int rank = H5Sget_simple_extent_ndims(file_space_id);
+
+	if (rank <= 0 || H5Sget_select_bounds(file_space_id, start, end) < 0) {
+		return 0;
+	}
+
+	return rank;
+}
+
+// Select the block between the bounds of a recorded selection in the dataspace of a dataset. Falls back to the whole dataset if the bounds do not fit it.
+static hid_t get_bounded_selection(hid_t dataset_id, int rank, const hsize_t *start, const hsize_t *end) {
+	hid_t file_space_id = H5Dget_space(dataset_id);
+	hsize_t dims[H5S_MAX_RANK], count[H5S_MAX_RANK];
+
+	if (file_space_id < 0) {
+		return H5S_ALL;
+	}
+
+	if (H5Sget_simple_extent_dims(file_space_id, dims, NULL) != rank) {
+		H5Sclose(file_space_id);
+		return H5S_ALL;
+	}
+
+	for (int i = 0; i < rank; i++) {
+		if (start[i] > end[i] || end[i] >= dims[i]) {
+			H5Sclose(file_space_id);
+			return H5S_ALL;
+		}
+
+		count[i] = end[i] - start[i] + 1;
+	}
+
+	if (H5Sselect_hyperslab(file_space_id, H5S_SELECT_SET, start, NULL, count, NULL) < 0) {
+		H5Sclose(file_space_id);
+		return H5S_ALL;
+	}
+
+	return file_space_id;
+}
+
+static int compare_deferred_datasets(const void *a, const void *b) {
+	const deferred_dataset *first = a;
+	const deferred_dataset *second = b;
+
+	if (first->file_index != second->file_index) {
+		return first->file_index < second->file_index ? -1 : 1;
+	}
+
+	if (first->offset != second->offset) {
+		return first->offset < second->offset ? -1 : 1;
+	}
+
+	return 0;
+}
+
+/*
+	Build the carved file of every file opened in deferred mode and carve the recorded datasets in one batch.
+	Datasets are carved file by file in the order of their data in the original file, so the original file is read sequentially.
+	Intermediate flushes are disabled for the batch, each carved file is flushed once when its handles are released.
+*/
+void carve_deferred_datasets(void) {
+	if (DEBUG)
+		fprintf(log_ptr, "CARVING %zu DEFERRED DATASETS\n", deferred_datasets_size);
+
+	for (int i = 0; i < files_opened_current_size; i++) {
+		if (get_file_handle(files_opened[i]) != NULL) {
+			continue;
+		}
+
+		char *carved_filename = get_carved_filename(files_opened[i], is_netcdf4, use_carved);
+
+		// The skeleton is built once, carved files left by a previous run are carved into as they are
+		if (access(carved_filename, F_OK) != 0) {
+			hid_t skeleton_src_file_id = original_H5Fopen(files_opened[i], H5F_ACC_RDONLY, H5P_DEFAULT);
+
+			if (skeleton_src_file_id == H5I_INVALID_HID) {
+				if (DEBUG)
+					fprintf(log_ptr, "Error opening source file for deferred carving %s\n", files_opened[i]);
+				free(carved_filename);
+				continue;
+			}
+
+			hid_t skeleton_carved_file_id = create_carved_file(skeleton_src_file_id, carved_filename);
+
+			H5Fclose(skeleton_src_file_id);
+
+			if (skeleton_carved_file_id == H5I_INVALID_HID) {
+				free(carved_filename);
+				continue;
+			}
+
+			close_carving_manifest(skeleton_carved_file_id);
+			H5Fclose(skeleton_carved_file_id);
+		}
+
+		free(carved_filename);
+
+		if (acquire_file_handle(files_opened[i], H5I_INVALID_HID) == NULL) {
+			if (DEBUG)
+				fprintf(log_ptr, "Error pooling file handles for deferred carving %s\n", files_opened[i]);
+		}
+	}
+
+	// Order the recorded datasets by file and by the offset of their data
+	for (size_t i = 0; i < deferred_datasets_size; i++) {
+		deferred_dataset *record = &deferred_datasets[i];
+		carved_file_handle *handle = get_file_handle(record->filename);
+
+		record->file_index = file_handle_pool_current_size;
+
+		if (handle == NULL) {
+			continue;
+		}
+
+		for (int j = 0; j < file_handle_pool_current_size; j++) {
+			if (file_handle_pool[j] == handle) {
+				record->file_index = j;
+			}
+		}
+
+		hid_t dataset_id = H5Dopen(handle->src_file_id, record->dataset_name, H5P_DEFAULT);
+
+		if (dataset_id >= 0) {
+			record->offset = get_dataset_data_offset(dataset_id);
+			H5Dclose(dataset_id);
+		}
+	}
+
+	qsort(deferred_datasets, deferred_datasets_size, sizeof(deferred_dataset), compare_deferred_datasets);
+
+	int configured_flush_interval = flush_interval;
+	flush_interval = 0;
+
+	for (size_t i = 0; i < deferred_datasets_size; i++) {
+		deferred_dataset *record = &deferred_datasets[i];
+		carved_file_handle *handle = get_file_handle(record->filename);
+
+		if (handle != NULL) {
+			if (is_lazy_skeleton_mode) {
+				ensure_skeleton_path(handle, record->dataset_name);
+			}
+
+			hid_t carved_dataset_id = H5Dopen(handle->carved_file_id, record->dataset_name, H5P_DEFAULT);
+			bool is_dataset_carved = does_dataset_exist(carved_dataset_id);
+			H5Dclose(carved_dataset_id);
+
+			hid_t dataset_id = is_dataset_carved ? H5I_INVALID_HID : H5Dopen(handle->src_file_id, record->dataset_name, H5P_DEFAULT);
+
+			if (dataset_id >= 0) {
+				bool is_fully_carved;
+				hid_t file_space_id = record->rank > 0 ? get_bounded_selection(dataset_id, record->rank, record->start, record->end) : H5S_ALL;
+
+				if (carve_dataset(handle, dataset_id, record->dataset_name, H5I_INVALID_HID, H5I_INVALID_HID, file_space_id, H5I_INVALID_HID, NULL, &is_fully_carved) < 0) {
+					if (DEBUG)
+						fprintf(log_ptr, "Error carving deferred dataset %s\n", record->dataset_name);
+				}
+
+				if (file_space_id != H5S_ALL)
+					H5Sclose(file_space_id);
+				H5Dclose(dataset_id);
+			}
+		}
+
+		free(record->filename);
+		free(record->dataset_name);
+	}
+
+	flush_interval = configured_flush_interval;
+
+	free(deferred_datasets);
+	deferred_datasets = NULL;
+	deferred_datasets_size = 0;
+	deferred_datasets_capacity = 0;
+}
+
+/*
+	Copy the attributes of the source file into its carved file if datasets were carved into it since the attributes were last copied.
+	Called for every carved file when the library terminates.
+*/
+void copy_carved_file_attributes(carved_file_handle *handle) {
+	src_file_id = handle->src_file_id;
+	dest_file_id = handle->carved_file_id;
+
+	hbool_t dataset_copy_check_attr_val = false;
+	hid_t dataset_copy_check_attr_id = H5I_INVALID_HID;
+	int attributes_pending = get_manifest_attributes_pending(dest_file_id);
+
+	// Carved files created before the manifest record pending attributes in the WAS_DATASET_COPIED attribute
+	if (attributes_pending >= 0) {
+		dataset_copy_check_attr_val = attributes_pending;
+	} else {
+		dataset_copy_check_attr_id = H5Aopen(dest_file_id, "WAS_DATASET_COPIED", H5P_DEFAULT);
+
+		if (dataset_copy_check_attr_id < 0) {
+			if (DEBUG)
+				fprintf(log_ptr, "Error opening dataset copy check attribute %ld\n", dest_file_id);
+			return;
+		}
+
+		herr_t dataset_copy_check_attr_return_val = original_H5Aread(dataset_copy_check_attr_id, H5T_NATIVE_HBOOL, &dataset_copy_check_attr_val);
+
+		if (dataset_copy_check_attr_return_val < 0) {
+			if (DEBUG)
+				fprintf(log_ptr, "Error reading dataset copy check attribute data %ld\n", dataset_copy_check_attr_id);
+		}
+	}
+
+	if (dataset_copy_check_attr_val == true) {
+		hid_t original_file_group_location_id = H5Gopen(src_file_id, "/", H5P_DEFAULT);
+
+		if (original_file_group_location_id == H5I_INVALID_HID) {
+			if (DEBUG)
+				fprintf(log_ptr, "Error opening source file root group %ld\n", src_file_id);
+		}
+
+		hid_t carved_file_group_location_id = H5Gopen(dest_file_id, "/", H5P_DEFAULT);
+
+		if (carved_file_group_location_id == H5I_INVALID_HID) {
+			if (DEBUG)
+				fprintf(log_ptr, "Error opening carved file root group %ld\n", dest_file_id);
+		}
+
+		if (DEBUG)
+			fprintf(log_ptr, "CARVING ATTRIBUTES\n");
+
+		// Iterate over attributes at this level in the source file and make non-shallow copies in the destination file
+		herr_t attribute_iterate_return_val = original_H5Aiterate2(original_file_group_location_id, H5_INDEX_NAME, H5_ITER_INC, NULL, copy_object_attributes, &carved_file_group_location_id); // Iterate through each attribute and create a copy
+
+		if (attribute_iterate_return_val < 0) {
+			if (DEBUG)
+				fprintf(log_ptr, "Attribute iteration failed\n");
+		}
+
+		// Start DFS to make a copy of attributes
+		herr_t link_iterate_return_val = H5Literate2(original_file_group_location_id, H5_INDEX_NAME, H5_ITER_INC, NULL, copy_attributes, &carved_file_group_location_id);
+
+		if (link_iterate_return_val < 0) {
+			if (DEBUG)
+				fprintf(log_ptr, "Link iteration failed\n");
+		}
+
+		if (original_file_group_location_id >= 0)
+			H5Gclose(original_file_group_location_id);
+		if (carved_file_group_location_id >= 0)
+			H5Gclose(carved_file_group_location_id);
+
+		dataset_copy_check_attr_val = false;
+
+		if (dataset_copy_check_attr_id < 0) {
+			set_manifest_attributes_pending(dest_file_id, false);
+		} else if (H5Awrite(dataset_copy_check_attr_id, H5T_NATIVE_HBOOL, &dataset_copy_check_attr_val) < 0) {
+			if (DEBUG)
+				fprintf(log_ptr, "Error writing value to dataset copy check ttribute %ld\n", dataset_copy_check_attr_id);
+		}
+	}
+
+	if (dataset_copy_check_attr_id >= 0)
+		H5Aclose(dataset_copy_check_attr_id);
+
+	release_reference_memo();
+	release_type_copy_plans();
+	log_attribute_arena_peak();
+}
+
+static int trace_fd = -1;
+
+// Trace identities of the files traced by this process, by path as opened by the application, so that each path is resolved once
+typedef struct {
+	char *filename;
+	uint64_t file_id;
+} trace_file_id;
+
+static trace_file_id *trace_file_ids;
+static size_t trace_file_ids_size;
+
+/*
+	Open the access trace for appending. Each record is appended with a single write, so the processes of a job can share one trace.
+	Returns false if the trace cannot be opened.
+*/
+bool open_carve_trace(const char *trace_filename) {
+	trace_fd = open(trace_filename, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+
+	if (trace_fd < 0) {
+		if (DEBUG)
+			fprintf(log_ptr, "Error opening access trace %s: %s\n", trace_filename, strerror(errno));
+		return false;
+	}
+
+	return true;
+}
+
+void close_carve_trace(void) {
+	if (trace_fd >= 0) {
+		close(trace_fd);
+		trace_fd = -1;
+	}
+
+	for (size_t i = 0; i < trace_file_ids_size; i++) {
+		free(trace_file_ids[i].filename);
+	}
+
+	free(trace_file_ids);
+	trace_file_ids = NULL;
+	trace_file_ids_size = 0;
+}
+
+/*
+	Identity of a file in the trace: the 64-bit FNV-1a hash of its absolute path, the path the CARVE_TRACE_FILE record holds.
+	Processes opening the same file through different relative paths or symbolic links then agree on its identity.
+*/
+uint64_t get_trace_file_id(const char *filename) {
+	for (size_t i = 0; i < trace_file_ids_size; i++) {
+		if (strcmp(trace_file_ids[i].filename, filename) == 0) {
+			return trace_file_ids[i].file_id;
+		}
+	}
+
+	char *absolute_filename = realpath(filename, NULL);
+	uint64_t hash = 14695981039346656037ULL;
+
+	for (const unsigned char *c = (const unsigned char *)(absolute_filename != NULL ? absolute_filename : filename); *c != '\0'; c++) {
+		hash ^= *c;
+		hash *= 1099511628211ULL;
+	}
+
+	free(absolute_filename);
+
+	trace_file_ids = realloc(trace_file_ids, (trace_file_ids_size + 1) * sizeof(trace_file_id));
+	trace_file_ids[trace_file_ids_size].filename = malloc(strlen(filename) + 1);
+	strcpy(trace_file_ids[trace_file_ids_size].filename, filename);
+	trace_file_ids[trace_file_ids_size].file_id = hash;
+	trace_file_ids_size += 1;
+
+	return hash;
+}
+
+static void append_trace_record(uint16_t kind, uint64_t file_id, const char *name, int rank, const hsize_t *start, const hsize_t *end) {
+	if (trace_fd < 0) {
+		return;
+	}
+
+	size_t name_length = strlen(name) + 1;
+	size_t payload_length = 2 * rank * sizeof(uint64_t) + name_length;
+	size_t record_length = (sizeof(carve_trace_record) + payload_length + 7) & ~(size_t)7;
+
+	char *record_buffer = calloc(1, record_length);
+	carve_trace_record *record = (carve_trace_record *)record_buffer;
+	record->magic = CARVE_TRACE_MAGIC;
+	record->kind = kind;
+	record->rank = rank;
+	record->name_length = name_length;
+	record->record_length = record_length;
+	record->file_id = file_id;
+
+	uint64_t *bounds = (uint64_t *)(record_buffer + sizeof(carve_trace_record));
+
+	for (int i = 0; i < rank; i++) {
+		bounds[i] = start[i];
+		bounds[rank + i] = end[i];
+	}
+
+	memcpy(record_buffer + sizeof(carve_trace_record) + 2 * rank * sizeof(uint64_t), name, name_length);
+
+	if (write(trace_fd, record_buffer, record_length) != (ssize_t)record_length) {
+		if (DEBUG)
+			fprintf(log_ptr, "Error appending to access trace: %s\n", strerror(errno));
+	}
+
+	free(record_buffer);
+}
+
+// Append an original file to the trace, under its absolute path so the trace can be materialized from another directory
+void append_trace_file(const char *filename) {
+	char *absolute_filename = realpath(filename, NULL);
+
+	append_trace_record(CARVE_TRACE_FILE, get_trace_file_id(filename), absolute_filename != NULL ? absolute_filename : filename, 0, NULL, NULL);
+
+	free(absolute_filename);
+}
+
+// Append a dataset read to the trace, with the bounds of the selection read
+void append_trace_dataset(const char *filename, const char *dataset_name, int rank, const hsize_t *start, const hsize_t *end) {
+	append_trace_record(CARVE_TRACE_DATASET, get_trace_file_id(filename), dataset_name, rank, start, end);
+}
+
+static herr_t ensure_skeleton_path_through_links(carved_file_handle *handle, const char *object_path, int soft_links_followed);
+
+// Add the target of a soft link of the source file to a lazily built skeleton, so that the path through the link resolves in the carved file
+static herr_t ensure_soft_link_target(carved_file_handle *handle, const char *link_path, size_t val_size, int soft_links_followed) {
+	char *link_value = malloc(val_size);
+
+	if (H5Lget_val(handle->src_file_id, link_path, link_value, val_size, H5P_DEFAULT) < 0) {
+		if (DEBUG)
+			fprintf(log_ptr, "Error fetching value of soft link %s\n", link_path);
+		free(link_value);
+		return -1;
+	}
+
+	// Relative targets are resolved from the group holding the link
+	const char *last_separator = strrchr(link_path, '/');
+	size_t parent_length = link_value[0] == '/' || last_separator == NULL ? 0 : (size_t)(last_separator - link_path);
+	char *target_path = malloc(parent_length + strlen(link_value) + 2);
+
+	memcpy(target_path, link_path, parent_length);
+	target_path[parent_length] = '/';
+	strcpy(target_path + parent_length + (link_value[0] == '/' ? 0 : 1), link_value);
+
+	herr_t return_val = ensure_skeleton_path_through_links(handle, target_path, soft_links_followed + 1);
+
+	free(target_path);
+	free(link_value);
+
+	return return_val;
+}
+
+static herr_t ensure_skeleton_path_through_links(carved_file_handle *handle, const char *object_path, int soft_links_followed) {
+	if (soft_links_followed > MAX_SOFT_LINKS_FOLLOWED) {
+		if (DEBUG)
+			fprintf(log_ptr, "Too many soft links on path %s\n", object_path);
+		return -1;
+	}
+
+	size_t path_length = strlen(object_path);
+	char *path_prefix = malloc(path_length + 1);
+	herr_t return_val = 0;
+
+	hid_t carved_root_group_id = H5Gopen(handle->carved_file_id, "/", H5P_DEFAULT);
+
+	if (carved_root_group_id == H5I_INVALID_HID) {
+		if (DEBUG)
+			fprintf(log_ptr, "Error opening carved file root group %s\n", handle->carved_filename);
+		free(path_prefix);
+		return -1;
+	}
+
+	// shallow_copy_object opens the datasets through the global source file
+	src_file_id = handle->src_file_id;
+
+	for (size_t i = 1; i <= path_length && return_val >= 0; i++) {
+		if (object_path[i] != '/' && object_path[i] != '\0') {
+			continue;
+		}
+
+		memcpy(path_prefix, object_path, i);
+		path_prefix[i] = '\0';
+
+		if (H5Lexists(handle->carved_file_id, path_prefix, H5P_DEFAULT) > 0) {
+			continue;
+		}
+
+		// The link itself is looked up, so that soft and external links on the path are recreated rather than replaced by groups
+		H5L_info2_t link_info;
+
+		if (H5Lget_info2(handle->src_file_id, path_prefix, &link_info, H5P_DEFAULT) < 0) {
+			if (DEBUG)
+				fprintf(log_ptr, "Error fetching link info of %s\n", path_prefix);
+			return_val = -1;
+			break;
+		}
+
+		if (DEBUG)
+			fprintf(log_ptr, "Adding %s to skeleton\n", path_prefix);
+
+		if (link_info.type == H5L_TYPE_SOFT) {
+			return_val = ensure_soft_link_target(handle, path_prefix, link_info.u.val_size, soft_links_followed);
+
+			// The target may have created the link on its way, when the link points into its own path
+			if (return_val >= 0 && H5Lexists(handle->carved_file_id, path_prefix, H5P_DEFAULT) <= 0) {
+				return_val = copy_symbolic_link(handle->src_file_id, handle->carved_file_id, path_prefix, &link_info);
+			}
+
+			continue;
+		}
+
+		// The rest of the path lies in another file, which has no part in this skeleton
+		if (link_info.type == H5L_TYPE_EXTERNAL) {
+			return_val = copy_symbolic_link(handle->src_file_id, handle->carved_file_id, path_prefix, &link_info);
+			break;
+		}
+
+		if (link_info.type != H5L_TYPE_HARD) {
+			break;
+		}
+
+		H5O_info2_t object_info;
+
+		if (H5Oget_info_by_name3(handle->src_file_id, path_prefix, &object_info, H5O_INFO_BASIC, H5P_DEFAULT) < 0) {
+			if (DEBUG)
+				fprintf(log_ptr, "Error fetching object info of %s\n", path_prefix);
+			return_val = -1;
+			break;
+		}
+
+		if (object_info.type == H5O_TYPE_GROUP) {
+			hid_t group_create_plist = get_skeleton_group_create_plist();
+			hid_t carved_group_id = H5Gcreate2(handle->carved_file_id, path_prefix, H5P_DEFAULT, group_create_plist, H5P_DEFAULT);
+
+			if (group_create_plist != H5P_DEFAULT)
+				H5Pclose(group_create_plist);
+
+			if (carved_group_id == H5I_INVALID_HID) {
+				if (DEBUG)
+					fprintf(log_ptr, "Error creating group %s in skeleton\n", path_prefix);
+				return_val = -1;
+			} else {
+				H5Gclose(carved_group_id);
+			}
+		} else if (object_info.type == H5O_TYPE_DATASET) {
+			return_val = shallow_copy_object(handle->src_file_id, path_prefix, NULL, &carved_root_group_id);
+		}
+	}
+
+	H5Gclose(carved_root_group_id);
+	free(path_prefix);
+
+	return return_val;
+}
+
+/*
+	Add an object of the source file to a lazily built skeleton, along with the groups on its path.
+	Groups are created empty and datasets as in the full skeleton. Objects already in the skeleton are left as they are.
+	Soft and external links on the path are recreated as links, and the targets of soft links are added to the skeleton first.
+*/
+herr_t ensure_skeleton_path(carved_file_handle *handle, const char *object_path) {
+	return ensure_skeleton_path_through_links(handle, object_path, 0);
+}
+
+// Objects with a single hard link already added to a lazily built skeleton. Objects with several are looked up by path, since each path needs its link.
+static object_key_set skeleton_objects;
+
+// Add an object opened by the application in the source file to the lazily built skeleton of its carved file
+herr_t add_object_to_skeleton(hid_t object_id) {
+	H5O_info2_t object_info;
+	carved_dataset_key key;
+	bool has_single_link = H5Oget_info3(object_id, &object_info, H5O_INFO_BASIC) >= 0 && object_info.rc == 1;
+
+	if (has_single_link) {
+		memset(&key, 0, sizeof(carved_dataset_key));
+		key.fileno = object_info.fileno;
+		key.token = object_info.token;
+
+		if (is_in_object_key_set(&skeleton_objects, &key)) {
+			return 0;
+		}
+	}
+
+	int size_of_name_buffer = H5Iget_name(object_id, NULL, 0) + 1;
+
+	if (size_of_name_buffer <= 1) {
+		return 0;
+	}
+
+	char *object_name = malloc(size_of_name_buffer);
+	H5Iget_name(object_id, object_name, size_of_name_buffer);
+
+	hid_t object_file_id = H5Iget_file_id(object_id);
+	int object_filename_len = H5Fget_name(object_file_id, NULL, 0) + 1;
+	char *object_filename = malloc(object_filename_len);
+	H5Fget_name(object_file_id, object_filename, object_filename_len);
+
+	// Objects of files not opened through the H5Fopen hook have no carved file
+	carved_file_handle *handle = is_already_recorded(object_filename) ? acquire_file_handle(object_filename, object_file_id) : NULL;
+	H5Fclose(object_file_id);
+	herr_t return_val = handle == NULL ? 0 : ensure_skeleton_path(handle, object_name);
+
+	if (return_val >= 0 && has_single_link) {
+		add_to_object_key_set(&skeleton_objects, &key, NULL);
+	}
+
+	free(object_filename);
+	free(object_name);
+
+	return return_val;
+}
+
+// Add the objects of the source file missing from a lazily built skeleton, so that the carved file has the full structure
+herr_t complete_skeleton(carved_file_handle *handle) {
+	if (DEBUG)
+		fprintf(log_ptr, "COMPLETING SKELETON %s\n", handle->carved_filename);
+
+	herr_t return_val = build_skeleton(handle->src_file_id, handle->carved_file_id);
+
+	if (return_val < 0) {
+		if (DEBUG)
+			fprintf(log_ptr, "Error completing skeleton %s\n", handle->carved_filename);
+	} else {
+		set_manifest_skeleton_complete(handle->carved_file_id);
+	}
+
+	return return_val;
+}
+
+// 128-bit FNV-1a hash of the structure of a file, updated as build_fingerprint walks it
+typedef unsigned __int128 structure_fingerprint;
+
+static void update_fingerprint(structure_fingerprint *fingerprint, const void *data, size_t length) {
+	const structure_fingerprint fnv_prime = ((structure_fingerprint)1 << 88) + 0x13b;
+
+	for (size_t i = 0; i < length; i++) {
+		*fingerprint ^= ((const unsigned char *)data)[i];
+		*fingerprint *= fnv_prime;
+	}
+}
+
+// Hash an encoded datatype or property list
+static void update_fingerprint_encoded(structure_fingerprint *fingerprint, hid_t id, bool is_plist) {
+	size_t encoded_size = 0;
+
+	if ((is_plist ? H5Pencode2(id, NULL, &encoded_size, H5P_DEFAULT) : H5Tencode(id, NULL, &encoded_size)) < 0) {
+		return;
+	}
+
+	unsigned char *encoded = malloc(encoded_size);
+
+	if ((is_plist ? H5Pencode2(id, encoded, &encoded_size, H5P_DEFAULT) : H5Tencode(id, encoded, &encoded_size)) >= 0) {
+		update_fingerprint(fingerprint, encoded, encoded_size);
+	}
+
+	free(encoded);
+}
+
+/*
+	H5Lvisit2 callback hashing everything build_skeleton puts in the skeleton for a link: 
+	its path and type, the value of soft and external links, the directory relative external links are resolved from,
+	the first path of objects reached through several hard links, and the type, shape and skeleton creation property list of datasets.
+*/
+// State of get_skeleton_template_filename while it walks the links of the source file
+typedef struct {
+	structure_fingerprint fingerprint;
+	object_key_set shared_objects; // Objects reached through several hard links, with the first path that reached them
+} fingerprint_builder;
+
+static herr_t fingerprint_link(hid_t group_id, const char *name, const H5L_info2_t *link_info, void *opdata) {
+	fingerprint_builder *builder = (fingerprint_builder *)opdata;
+	structure_fingerprint *fingerprint = &builder->fingerprint;
+
+	update_fingerprint(fingerprint, name, strlen(name) + 1);
+	update_fingerprint(fingerprint, &link_info->type, sizeof(link_info->type));
+
+	if (link_info->type == H5L_TYPE_SOFT || link_info->type == H5L_TYPE_EXTERNAL) {
+		char *link_value = malloc(link_info->u.val_size);
+
+		if (H5Lget_val(group_id, name, link_value, link_info->u.val_size, H5P_DEFAULT) < 0) {
+			free(link_value);
+			return -1;
+		}
+
+		update_fingerprint(fingerprint, link_value, link_info->u.val_size);
+
+		// Relative external links of templates lead to the file next to the source file
+		const char *external_filename, *external_object_name;
+		unsigned external_flags;
+
+		if (link_info->type == H5L_TYPE_EXTERNAL && H5Lunpack_elink_val(link_value, link_info->u.val_size, &external_flags, &external_filename, &external_object_name) >= 0 && external_filename[0] != '/') {
+			char *src_directory = get_file_directory(group_id);
+
+			if (src_directory != NULL) {
+				update_fingerprint(fingerprint, src_directory, strlen(src_directory) + 1);
+				free(src_directory);
+			}
+		}
+
+		free(link_value);
+
+		return 0;
+	}
+
+	H5O_info2_t object_info;
+
+	if (H5Oget_info_by_name3(group_id, name, &object_info, H5O_INFO_BASIC, H5P_DEFAULT) < 0) {
+		return -1;
+	}
+
+	update_fingerprint(fingerprint, &object_info.type, sizeof(object_info.type));
+	update_fingerprint(fingerprint, &object_info.rc, sizeof(object_info.rc));
+
+	// The skeleton links the later paths of an object to the first one, so which paths share an object is part of the structure
+	if (object_info.rc > 1) {
+		carved_dataset_key key;
+		memset(&key, 0, sizeof(carved_dataset_key));
+		key.fileno = object_info.fileno;
+		key.token = object_info.token;
+
+		const char *shared_object_path = get_object_key_path(&builder->shared_objects, &key);
+
+		if (shared_object_path != NULL) {
+			update_fingerprint(fingerprint, shared_object_path, strlen(shared_object_path) + 1);
+			return 0;
+		}
+
+		add_to_object_key_set(&builder->shared_objects, &key, name);
+	}
+
+	if (object_info.type == H5O_TYPE_NAMED_DATATYPE) {
+		hid_t data_type = H5Topen(group_id, name, H5P_DEFAULT);
+
+		if (data_type < 0) {
+			return -1;
+		}
+
+		update_fingerprint_encoded(fingerprint, data_type, false);
+		H5Tclose(data_type);
+	} else if (object_info.type == H5O_TYPE_DATASET) {
+		hid_t dataset_id = H5Dopen(group_id, name, H5P_DEFAULT);
+
+		if (dataset_id < 0) {
+			return -1;
+		}
+
+		hid_t data_type = H5Dget_type(dataset_id);
+		hid_t data_space = H5Dget_space(dataset_id);
+		hid_t create_plist = get_skeleton_create_plist(dataset_id, data_type, data_space);
+		hsize_t dims[H5S_MAX_RANK], maxdims[H5S_MAX_RANK];
+		int rank = H5Sget_simple_extent_dims(data_space, dims, maxdims);
+		bool is_allocated = H5Dget_storage_size(dataset_id) > 0;
+
+		update_fingerprint_encoded(fingerprint, data_type, false);
+		update_fingerprint(fingerprint, &rank, sizeof(rank));
+
+		if (rank > 0) {
+			update_fingerprint(fingerprint, dims, rank * sizeof(hsize_t));
+			update_fingerprint(fingerprint, maxdims, rank * sizeof(hsize_t));
+		}
+
+		if (create_plist >= 0) {
+			update_fingerprint_encoded(fingerprint, create_plist, true);
+			H5Pclose(create_plist);
+		}
+
+		update_fingerprint(fingerprint, &is_allocated, sizeof(is_allocated));
+
+		H5Sclose(data_space);
+		H5Tclose(data_type);
+		H5Dclose(dataset_id);
+	}
+
+	return 0;
+}
+
+// Path of the skeleton template of a source file: <CARVED_DIRECTORY>/.skeletons/<structural fingerprint>.h5. Returns NULL on error.
+static char *get_skeleton_template_filename(hid_t src_file) {
+	hid_t src_root_group_id = H5Gopen(src_file, "/", H5P_DEFAULT);
+
+	if (src_root_group_id == H5I_INVALID_HID) {
+		return NULL;
+	}
+
+	fingerprint_builder builder;
+	memset(&builder, 0, sizeof(fingerprint_builder));
+	builder.fingerprint = ((structure_fingerprint)0x6c62272e07bb0142ULL << 64) | 0x62b821756295c58dULL;
+
+	herr_t visit_return_val = H5Lvisit2(src_root_group_id, H5_INDEX_NAME, H5_ITER_INC, fingerprint_link, &builder);
+	structure_fingerprint fingerprint = builder.fingerprint;
+
+	release_object_key_set(&builder.shared_objects);
+	H5Gclose(src_root_group_id);
+
+	if (visit_return_val < 0) {
+		if (DEBUG)
+			fprintf(log_ptr, "Error computing structural fingerprint %ld\n", src_file);
+		return NULL;
+	}
+
+	// The skeleton also depends on the options shaping it
+	update_fingerprint(&fingerprint, &is_partial_carving_mode, sizeof(is_partial_carving_mode));
+	update_fingerprint(&fingerprint, &partial_carving_block_size, sizeof(partial_carving_block_size));
+	update_fingerprint(&fingerprint, &is_skeleton_storage_deferred, sizeof(is_skeleton_storage_deferred));
+	update_fingerprint(&fingerprint, &carved_file_page_size, sizeof(carved_file_page_size));
+	update_fingerprint(&fingerprint, &is_free_space_persistent, sizeof(is_free_space_persistent));
+
+	char *template_directory = malloc(strlen(carved_directory) + strlen("/.skeletons") + 1);
+	sprintf(template_directory, "%s/.skeletons", carved_directory);
+
+	if (mkdir(template_directory, 0755) < 0 && errno != EEXIST) {
+		if (DEBUG)
+			fprintf(log_ptr, "Error creating skeleton template directory %s\n", template_directory);
+		free(template_directory);
+		return NULL;
+	}
+
+	char *template_filename = malloc(strlen(template_directory) + 32 + strlen("/.h5") + 1);
+	sprintf(template_filename, "%s/%016llx%016llx.h5", template_directory, (unsigned long long)(fingerprint >> 64), (unsigned long long)fingerprint);
+	free(template_directory);
+
+	return template_filename;
+}
+
+// Clone a file into a new file, sharing its extents where the file system supports reflinks
+static int clone_file(const char *src_filename, const char *dest_filename) {
+	int src_fd = open(src_filename, O_RDONLY);
+	struct stat src_stat;
+
+	if (src_fd < 0 || fstat(src_fd, &src_stat) < 0) {
+		if (src_fd >= 0)
+			close(src_fd);
+		return -1;
+	}
+
+	int dest_fd = open(dest_filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+	if (dest_fd < 0) {
+		close(src_fd);
+		return -1;
+	}
+
+	int return_val = copy_file_bytes(src_fd, 0, dest_fd, 0, src_stat.st_size);
+
+	close(src_fd);
+	close(dest_fd);
+
+	return return_val;
+}
+
+/*
+	Create the carved file of a source file with its skeleton. 
+	With CARVE_SKELETON_TEMPLATES set, skeletons are cached under CARVED_DIRECTORY by the structural fingerprint of the source file,
+	so the carved files of a series of files with the same layout are cloned from a single skeleton instead of each being built.
+*/
+hid_t create_carved_file(hid_t src_file, const char *carved_filename) {
+	if (!is_skeleton_template_mode || is_lazy_skeleton_mode || carved_directory == NULL) {
+		return create_skeleton_file(src_file, carved_filename);
+	}
+
+	char *template_filename = get_skeleton_template_filename(src_file);
+
+	if (template_filename == NULL) {
+		return create_skeleton_file(src_file, carved_filename);
+	}
+
+	// Build the template under a unique temporary name and rename it into place, so concurrent processes, on any host sharing the directory, never clone a partial template
+	if (access(template_filename, F_OK) != 0) {
+		char *temporary_filename = malloc(strlen(template_filename) + strlen(".XXXXXX") + 1);
+		sprintf(temporary_filename, "%s.XXXXXX", template_filename);
+
+		int temporary_fd = mkstemp(temporary_filename);
+
+		if (temporary_fd < 0) {
+			if (DEBUG)
+				fprintf(log_ptr, "Error creating temporary skeleton template %s\n", temporary_filename);
+			free(temporary_filename);
+			free(template_filename);
+			return create_skeleton_file(src_file, carved_filename);
+		}
+
+		// Templates are shared like the directory, mkstemp creates files readable by their owner only
+		fchmod(temporary_fd, 0644);
+		close(temporary_fd);
+
+		if (DEBUG)
+			fprintf(log_ptr, "Building skeleton template %s\n", template_filename);
+
+		is_building_skeleton_template = true;
+		hid_t template_file_id = create_skeleton_file(src_file, temporary_filename);
+		is_building_skeleton_template = false;
+
+		if (template_file_id != H5I_INVALID_HID) {
+			close_carving_manifest(template_file_id);
+		}
+
+		if (template_file_id == H5I_INVALID_HID || H5Fclose(template_file_id) < 0 || rename(temporary_filename, template_filename) < 0) {
+			if (DEBUG)
+				fprintf(log_ptr, "Error building skeleton template %s\n", template_filename);
+			unlink(temporary_filename);
+			free(temporary_filename);
+			free(template_filename);
+			return create_skeleton_file(src_file, carved_filename);
+		}
+
+		free(temporary_filename);
+	}
+
+	if (clone_file(template_filename, carved_filename) < 0) {
+		if (DEBUG)
+			fprintf(log_ptr, "Error cloning skeleton template %s\n", template_filename);
+		free(template_filename);
+		return create_skeleton_file(src_file, carved_filename);
+	}
+
+	if (DEBUG)
+		fprintf(log_ptr, "Cloned skeleton template %s into %s\n", template_filename, carved_filename);
+
+	free(template_filename);
+
+	hid_t carved_file = open_carved_file(carved_filename, H5F_ACC_RDWR, H5P_DEFAULT);
+
+	if (carved_file != H5I_INVALID_HID) {
+		load_carving_manifest(carved_file);
+	}
+
+	return carved_file;
+}
+
+/*
+	Open-addressing hash map from the file numbers of open files to the state kept per file. The library numbers a file anew each time it is opened,
+	so the state of a file reopened is found by its path and added under the new number as well.
+*/
+typedef struct {
+	unsigned long *filenos;
+	void **values;
+	size_t capacity;
+	size_t size;
+} fileno_map;
+
+static size_t find_fileno_slot(const fileno_map *map, unsigned long fileno) {
+	size_t slot = (size_t)(fileno * 11400714819323198485ULL) & (map->capacity - 1);
+
+	while (map->values[slot] != NULL && map->filenos[slot] != fileno) {
+		slot = (slot + 1) & (map->capacity - 1);
+	}
+
+	return slot;
+}
+
+static void *get_fileno_map(const fileno_map *map, unsigned long fileno) {
+	return map->size == 0 ? NULL : map->values[find_fileno_slot(map, fileno)];
+}
+
+static void put_fileno_map(fileno_map *map, unsigned long fileno, void *value) {
+	// Keep the load factor below one half, doubling and rehashing when exceeded
+	if ((map->size + 1) * 2 > map->capacity) {
+		fileno_map old_map = *map;
+
+		map->capacity = old_map.capacity == 0 ? 16 : old_map.capacity * 2;
+		map->filenos = malloc(map->capacity * sizeof(unsigned long));
+		map->values = calloc(map->capacity, sizeof(void *));
+		map->size = 0;
+
+		for (size_t i = 0; i < old_map.capacity; i++) {
+			if (old_map.values[i] != NULL) {
+				put_fileno_map(map, old_map.filenos[i], old_map.values[i]);
+			}
+		}
+
+		free(old_map.filenos);
+		free(old_map.values);
+	}
+
+	size_t slot = find_fileno_slot(map, fileno);
+
+	if (map->values[slot] == NULL) {
+		map->filenos[slot] = fileno;
+		map->size += 1;
+	}
+
+	map->values[slot] = value;
+}
+
+// Remove every file number mapped to a value. Rare enough that the map is rebuilt without them.
+static void remove_fileno_map_value(fileno_map *map, const void *value) {
+	fileno_map old_map = *map;
+	memset(map, 0, sizeof(fileno_map));
+
+	for (size_t i = 0; i < old_map.capacity; i++) {
+		if (old_map.values[i] != NULL && old_map.values[i] != value) {
+			put_fileno_map(map, old_map.filenos[i], old_map.values[i]);
+		}
+	}
+
+	free(old_map.filenos);
+	free(old_map.values);
+}
+
+static void release_fileno_map(fileno_map *map) {
+	free(map->filenos);
+	free(map->values);
+	memset(map, 0, sizeof(fileno_map));
+}
+
+/*
+	Carving manifest of a carved file: the object tokens of its skeleton datasets that are still empty, and whether attributes are pending.
+	It replaces the CARVED_DATASET_IS_EMPTY attribute of every skeleton dataset and the WAS_DATASET_COPIED attribute of the root group.
+	The manifest is kept in the CARVED_MANIFEST attribute of the root group: a header and the tokens of the empty datasets, sorted.
+	It is loaded into a hash set when a carved file is opened and written back when it is closed. Datasets are keyed by token, which all hard links
+	of a dataset share only as long as carving keeps them on one object: see relink_shared_dataset.
+	Carved files without a manifest, created before it was introduced, keep using the attributes.
+*/
+#define CARVED_MANIFEST_ATTRIBUTE "CARVED_MANIFEST"
+#define CARVED_MANIFEST_ATTRIBUTES_PENDING 0x1
+#define CARVED_MANIFEST_SKELETON_INCOMPLETE 0x2
+
+typedef struct {
+	char magic[4];
+	uint32_t flags;
+	uint64_t num_tokens;
+} carving_manifest_header;
+
+enum {
+	MANIFEST_SLOT_UNUSED = 0,
+	MANIFEST_SLOT_EMPTY = 1,
+	MANIFEST_SLOT_CARVED = 2,
+};
+
+typedef struct {
+	char *carved_path;
+	H5O_token_t *tokens;
+	uint8_t *slot_states;
+	size_t capacity;
+	size_t size;
+	bool are_attributes_pending;
+	bool is_skeleton_incomplete; // Lazily built skeleton, which may lack objects of the original file
+	bool is_dirty;
+} carving_manifest;
+
+// Manifests of the carved files opened in this process, and the file numbers each was opened under
+static carving_manifest **manifests;
+static int manifests_size;
+static fileno_map manifest_filenos;
+
+static carving_manifest *get_manifest_by_fileno(unsigned long fileno) {
+	return get_fileno_map(&manifest_filenos, fileno);
+}
+
+static carving_manifest *get_manifest(hid_t carved_file) {
+	unsigned long fileno;
+
+	if (H5Fget_fileno(carved_file, &fileno) < 0) {
+		return NULL;
+	}
+
+	return get_manifest_by_fileno(fileno);
+}
+
+static size_t hash_token(const H5O_token_t *token) {
+	uint64_t hash = 14695981039346656037ULL;
+
+	for (size_t i = 0; i < sizeof(H5O_token_t); i++) {
+		hash ^= ((const unsigned char *)token)[i];
+		hash *= 1099511628211ULL;
+	}
+
+	return (size_t)hash;
+}
+
+// Slot of a token in the hash set of a manifest, or of the unused slot where it would be inserted
+static size_t find_manifest_slot(const carving_manifest *manifest, const H5O_token_t *token) {
+	size_t slot = hash_token(token) & (manifest->capacity - 1);
+
+	while (manifest->slot_states[slot] != MANIFEST_SLOT_UNUSED && memcmp(&manifest->tokens[slot], token, sizeof(H5O_token_t)) != 0) {
+		slot = (slot + 1) & (manifest->capacity - 1);
+	}
+
+	return slot;
+}
+
+static void set_manifest_state(carving_manifest *manifest, const H5O_token_t *token, uint8_t state) {
+	// Keep the load factor at or below one half
+	if ((manifest->size + 1) * 2 > manifest->capacity) {
+		H5O_token_t *old_tokens = manifest->tokens;
+		uint8_t *old_slot_states = manifest->slot_states;
+		size_t old_capacity = manifest->capacity;
+
+		manifest->capacity = old_capacity == 0 ? 64 : old_capacity * 2;
+		manifest->tokens = malloc(manifest->capacity * sizeof(H5O_token_t));
+		manifest->slot_states = calloc(manifest->capacity, sizeof(uint8_t));
+
+		for (size_t i = 0; i < old_capacity; i++) {
+			if (old_slot_states[i] != MANIFEST_SLOT_UNUSED) {
+				size_t slot = find_manifest_slot(manifest, &old_tokens[i]);
+				manifest->tokens[slot] = old_tokens[i];
+				manifest->slot_states[slot] = old_slot_states[i];
+			}
+		}
+
+		free(old_tokens);
+		free(old_slot_states);
+	}
+
+	size_t slot = find_manifest_slot(manifest, token);
+
+	if (manifest->slot_states[slot] == MANIFEST_SLOT_UNUSED) {
+		manifest->tokens[slot] = *token;
+		manifest->size += 1;
+	}
+
+	manifest->slot_states[slot] = state;
+	manifest->is_dirty = true;
+}
+
+static carving_manifest *register_manifest(hid_t carved_file) {
+	unsigned long fileno;
+
+	if (H5Fget_fileno(carved_file, &fileno) < 0) {
+		return NULL;
+	}
+
+	carving_manifest *manifest = calloc(1, sizeof(carving_manifest));
+	manifest->carved_path = get_file_path(carved_file);
+
+	manifests = realloc(manifests, (manifests_size + 1) * sizeof(carving_manifest *));
+	manifests[manifests_size] = manifest;
+	manifests_size += 1;
+	put_fileno_map(&manifest_filenos, fileno, manifest);
+
+	return manifest;
+}
+
+// Start an empty manifest for a newly created carved file
+void create_carving_manifest(hid_t carved_file) {
+	carving_manifest *manifest = register_manifest(carved_file);
+
+	if (manifest != NULL) {
+		manifest->is_skeleton_incomplete = is_lazy_skeleton_mode;
+		manifest->is_dirty = true;
+	}
+}
+
+/*
+	Load the manifest of a carved file that has been opened. Does nothing if the file has no manifest or its manifest is already loaded.
+	A file reopened shares the manifest loaded when it was first opened, which holds the changes made since.
+*/
+herr_t load_carving_manifest(hid_t carved_file) {
+	unsigned long fileno;
+
+	if (H5Fget_fileno(carved_file, &fileno) < 0 || get_manifest_by_fileno(fileno) != NULL) {
+		return 0;
+	}
+
+	char *carved_path = get_file_path(carved_file);
+
+	for (int i = 0; carved_path != NULL && i < manifests_size; i++) {
+		if (manifests[i]->carved_path != NULL && strcmp(manifests[i]->carved_path, carved_path) == 0) {
+			put_fileno_map(&manifest_filenos, fileno, manifests[i]);
+			free(carved_path);
+			return 0;
+		}
+	}
+
+	free(carved_path);
+
+	if (H5Aexists(carved_file, CARVED_MANIFEST_ATTRIBUTE) <= 0) {
+		return 0;
+	}
+
+	hid_t attr_id = H5Aopen(carved_file, CARVED_MANIFEST_ATTRIBUTE, H5P_DEFAULT);
+	hid_t attr_space_id = H5Aget_space(attr_id);
+	hssize_t manifest_size = H5Sget_simple_extent_npoints(attr_space_id);
+	uint8_t *manifest_buffer = manifest_size > 0 ? malloc(manifest_size) : NULL;
+
+	herr_t read_return_val = manifest_buffer == NULL ? -1 : original_H5Aread(attr_id, H5T_NATIVE_UINT8, manifest_buffer);
+
+	H5Sclose(attr_space_id);
+	H5Aclose(attr_id);
+
+	carving_manifest_header *header = (carving_manifest_header *)manifest_buffer;
+
+	if (read_return_val < 0 || (size_t)manifest_size < sizeof(carving_manifest_header) || memcmp(header->magic, "CMF1", 4) != 0 ||
+		(size_t)manifest_size < sizeof(carving_manifest_header) + header->num_tokens * sizeof(H5O_token_t)) {
+		if (DEBUG)
+			fprintf(log_ptr, "Error reading carving manifest %ld\n", carved_file);
+		free(manifest_buffer);
+		return -1;
+	}
+
+	carving_manifest *manifest = register_manifest(carved_file);
+
+	if (manifest == NULL) {
+		free(manifest_buffer);
+		return -1;
+	}
+
+	H5O_token_t *tokens = (H5O_token_t *)(manifest_buffer + sizeof(carving_manifest_header));
+	for (uint64_t i = 0; i < header->num_tokens; i++) {
+		set_manifest_state(manifest, &tokens[i], MANIFEST_SLOT_EMPTY);
+	}
+
+	manifest->are_attributes_pending = (header->flags & CARVED_MANIFEST_ATTRIBUTES_PENDING) != 0;
+	manifest->is_skeleton_incomplete = (header->flags & CARVED_MANIFEST_SKELETON_INCOMPLETE) != 0;
+	manifest->is_dirty = false;
+
+	free(manifest_buffer);
+
+	return 0;
+}
+
+static int compare_tokens(const void *a, const void *b) {
+	return memcmp(a, b, sizeof(H5O_token_t));
+}
+
+// Write the manifest of a carved file back to it if it changed since it was loaded
+herr_t write_carving_manifest(hid_t carved_file) {
+	carving_manifest *manifest = get_manifest(carved_file);
+
+	if (manifest == NULL || !manifest->is_dirty) {
+		return 0;
+	}
+
+	// Carved datasets have been replaced by objects with other tokens, so only the tokens still empty are kept
+	size_t num_tokens = 0;
+	H5O_token_t *tokens = malloc((manifest->size + 1) * sizeof(H5O_token_t));
+
+	for (size_t i = 0; i < manifest->capacity; i++) {
+		if (manifest->slot_states[i] == MANIFEST_SLOT_EMPTY) {
+			tokens[num_tokens++] = manifest->tokens[i];
+		}
+	}
+
+	qsort(tokens, num_tokens, sizeof(H5O_token_t), compare_tokens);
+
+	hsize_t manifest_size = sizeof(carving_manifest_header) + num_tokens * sizeof(H5O_token_t);
+	uint8_t *manifest_buffer = calloc(1, manifest_size);
+	carving_manifest_header *header = (carving_manifest_header *)manifest_buffer;
+
+	memcpy(header->magic, "CMF1", 4);
+	header->flags = (manifest->are_attributes_pending ? CARVED_MANIFEST_ATTRIBUTES_PENDING : 0) | (manifest->is_skeleton_incomplete ? CARVED_MANIFEST_SKELETON_INCOMPLETE : 0);
+	header->num_tokens = num_tokens;
+	memcpy(manifest_buffer + sizeof(carving_manifest_header), tokens, num_tokens * sizeof(H5O_token_t));
+	free(tokens);
+
+	// The size of the manifest changes as datasets are carved, so the attribute is recreated
+	if (H5Aexists(carved_file, CARVED_MANIFEST_ATTRIBUTE) > 0) {
+		H5Adelete(carved_file, CARVED_MANIFEST_ATTRIBUTE);
+	}
+
+	hid_t attr_space_id = H5Screate_simple(1, &manifest_size, NULL);
+	hid_t attr_id = H5Acreate2(carved_file, CARVED_MANIFEST_ATTRIBUTE, H5T_NATIVE_UINT8, attr_space_id, H5P_DEFAULT, H5P_DEFAULT);
+	herr_t write_return_val = attr_id < 0 ? -1 : H5Awrite(attr_id, H5T_NATIVE_UINT8, manifest_buffer);
+
+	if (attr_id >= 0)
+		H5Aclose(attr_id);
+	H5Sclose(attr_space_id);
+	free(manifest_buffer);
+
+	if (write_return_val < 0) {
 		if (DEBUG)
-    		fprintf(log_ptr, "Error fetching size of name %ld\n", object_id);
+			fprintf(log_ptr, "Error writing carving manifest %ld\n", carved_file);
+		return -1;
+	}
+
+	manifest->is_dirty = false;
+
+	return 0;
+}
+
+// Write the manifest of a carved file about to be closed and forget it
+herr_t close_carving_manifest(hid_t carved_file) {
+	herr_t return_val = write_carving_manifest(carved_file);
+	carving_manifest *manifest = get_manifest(carved_file);
+
+	for (int i = 0; i < manifests_size; i++) {
+		if (manifests[i] == manifest) {
+			remove_fileno_map_value(&manifest_filenos, manifest);
+			free(manifest->carved_path);
+			free(manifest->tokens);
+			free(manifest->slot_states);
+			free(manifest);
+			manifests[i] = manifests[manifests_size - 1];
+			manifests_size -= 1;
+			break;
+		}
+	}
+
+	return return_val;
+}
+
+// Record a skeleton dataset as empty in the manifest of its file. Returns false if the file has no manifest.
+bool add_empty_dataset_to_manifest(hid_t carved_dataset_id) {
+	H5O_info2_t object_info;
+
+	if (H5Oget_info3(carved_dataset_id, &object_info, H5O_INFO_BASIC) < 0) {
+		return false;
+	}
+
+	carving_manifest *manifest = get_manifest_by_fileno(object_info.fileno);
+
+	if (manifest == NULL) {
+		return false;
+	}
+
+	set_manifest_state(manifest, &object_info.token, MANIFEST_SLOT_EMPTY);
+
+	return true;
+}
+
+// Record a skeleton dataset as carved in the manifest of its file
+void mark_dataset_carved_in_manifest(unsigned long fileno, const H5O_token_t *token) {
+	carving_manifest *manifest = get_manifest_by_fileno(fileno);
+
+	if (manifest != NULL && manifest->capacity > 0 && manifest->slot_states[find_manifest_slot(manifest, token)] == MANIFEST_SLOT_EMPTY) {
+		set_manifest_state(manifest, token, MANIFEST_SLOT_CARVED);
+	}
+}
+
+// Look up a dataset of a carved file in its manifest. Returns 1 if it is an empty skeleton dataset, 0 if not, and -1 if the file has no manifest.
+int get_manifest_status(hid_t carved_dataset_id) {
+	H5O_info2_t object_info;
+
+	if (H5Oget_info3(carved_dataset_id, &object_info, H5O_INFO_BASIC) < 0) {
+		return -1;
+	}
+
+	carving_manifest *manifest = get_manifest_by_fileno(object_info.fileno);
+
+	if (manifest == NULL) {
 		return -1;
 	}
-	
-	// If object is a dataset, make shallow copy of dataset and terminate
-	if (object_type == H5I_DATASET) {
-		hid_t dataset_id, data_type, data_space;
 
-		// Create and populate buffer for name of dataset
-    	char *object_name = (char *)malloc(size_of_name_buffer);
-    	H5Iget_name(object_id, object_name, size_of_name_buffer); // Fill object_name buffer with the name
+	return manifest->capacity > 0 && manifest->slot_states[find_manifest_slot(manifest, &object_info.token)] == MANIFEST_SLOT_EMPTY;
+}
+
+// Flag of the manifest recording that datasets were carved since attributes were last copied. Returns -1 if the file has no manifest.
+int get_manifest_attributes_pending(hid_t carved_file) {
+	carving_manifest *manifest = get_manifest(carved_file);
+
+	return manifest == NULL ? -1 : manifest->are_attributes_pending;
+}
+
+bool set_manifest_attributes_pending(hid_t carved_file, bool are_attributes_pending) {
+	carving_manifest *manifest = get_manifest(carved_file);
+
+	if (manifest == NULL) {
+		return false;
+	}
+
+	if (manifest->are_attributes_pending != are_attributes_pending) {
+		manifest->are_attributes_pending = are_attributes_pending;
+		manifest->is_dirty = true;
+	}
+
+	return true;
+}
+
+// Record that the lazily built skeleton of a carved file has been completed
+void set_manifest_skeleton_complete(hid_t carved_file) {
+	carving_manifest *manifest = get_manifest(carved_file);
+
+	if (manifest != NULL && manifest->is_skeleton_incomplete) {
+		manifest->is_skeleton_incomplete = false;
+		manifest->is_dirty = true;
+	}
+}
+
+// Whether the carved file containing a location may lack objects of its original file. Carved files without a manifest have complete skeletons.
+bool is_skeleton_incomplete(hid_t carved_loc_id) {
+	H5O_info2_t object_info;
+
+	if (H5Oget_info3(carved_loc_id, &object_info, H5O_INFO_BASIC) < 0) {
+		return false;
+	}
+
+	carving_manifest *manifest = get_manifest_by_fileno(object_info.fileno);
+
+	return manifest != NULL && manifest->is_skeleton_incomplete;
+}
+
+// Original file of a carved file opened in repeat mode. The original file is opened on the first fallback to it, and kept for every reopening of the carved file.
+typedef struct {
+	char *filename;
+	unsigned flags;
+	hid_t fapl_id;
+	hid_t original_file_id;
+} original_file_handle;
+
+static original_file_handle **original_files;
+static int original_files_size;
+
+// Original files by the file numbers the carved files were opened under
+static fileno_map original_file_filenos;
+
+// Location of the original file matching a location of a carved file, kept open in a bounded cache
+typedef struct {
+	unsigned long carved_fileno;
+	H5O_token_t carved_token;
+	hid_t original_loc_id;
+	unsigned long last_used;
+} original_location;
+
+#define ORIGINAL_LOCATION_CACHE_SIZE 64
+
+static original_location original_location_cache[ORIGINAL_LOCATION_CACHE_SIZE];
+static int original_location_cache_size;
+static unsigned long original_location_clock;
+
+// Record the original file of a carved file opened in repeat mode, without opening it
+void register_original_file(hid_t carved_file, const char *filename, unsigned flags, hid_t fapl_id) {
+	unsigned long carved_fileno;
+
+	if (H5Fget_fileno(carved_file, &carved_fileno) < 0 || get_fileno_map(&original_file_filenos, carved_fileno) != NULL) {
+		return;
+	}
+
+	// Original files are identified by their absolute path, so that a reopened file shares the handle opened for the first fallback
+	char *original_path = realpath(filename, NULL);
+
+	if (original_path == NULL) {
+		original_path = malloc(strlen(filename) + 1);
+		strcpy(original_path, filename);
+	}
+
+	for (int i = 0; i < original_files_size; i++) {
+		if (strcmp(original_files[i]->filename, original_path) == 0) {
+			put_fileno_map(&original_file_filenos, carved_fileno, original_files[i]);
+			free(original_path);
+			return;
+		}
+	}
+
+	original_file_handle *handle = malloc(sizeof(original_file_handle));
+	handle->filename = original_path;
+	handle->flags = flags;
+	// The application may close its access property list before a fallback happens
+	handle->fapl_id = fapl_id == H5P_DEFAULT ? H5P_DEFAULT : H5Pcopy(fapl_id);
+	handle->original_file_id = H5I_INVALID_HID;
+
+	original_files = realloc(original_files, (original_files_size + 1) * sizeof(original_file_handle *));
+	original_files[original_files_size] = handle;
+	original_files_size += 1;
+	put_fileno_map(&original_file_filenos, carved_fileno, handle);
+}
+
+// Fetch the original file of the carved file containing a location, opening it on first use
+hid_t get_original_file(hid_t carved_loc_id) {
+	hid_t carved_file_id = H5Iget_file_id(carved_loc_id);
+	unsigned long carved_fileno;
+	herr_t fileno_return_val = H5Fget_fileno(carved_file_id, &carved_fileno);
+
+	H5Fclose(carved_file_id);
+
+	if (fileno_return_val < 0) {
+		return H5I_INVALID_HID;
+	}
+
+	original_file_handle *handle = get_fileno_map(&original_file_filenos, carved_fileno);
+
+	if (handle == NULL) {
+		return H5I_INVALID_HID;
+	}
+
+	if (handle->original_file_id == H5I_INVALID_HID) {
+		if (DEBUG)
+			fprintf(log_ptr, "Opening original file for fallback %s\n", handle->filename);
+
+		handle->original_file_id = original_H5Fopen(handle->filename, handle->flags, handle->fapl_id);
+
+		if (handle->original_file_id == H5I_INVALID_HID && DEBUG)
+			fprintf(log_ptr, "Error opening original file to be used as fallback %s %d\n", handle->filename, handle->flags);
+	}
+
+	return handle->original_file_id;
+}
+
+/*
+	Fetch the object of the original file at the path of a location of a carved file.
+	Locations are cached by the token of the carved location, so repeated fallbacks under the same group skip resolving its path.
+	The cache holds ORIGINAL_LOCATION_CACHE_SIZE locations, the least recently used one is closed when it is full.
+	The returned identifier belongs to the cache and must not be closed.
+*/
+hid_t get_original_location(hid_t carved_loc_id) {
+	H5O_info2_t carved_info;
+
+	if (H5Oget_info3(carved_loc_id, &carved_info, H5O_INFO_BASIC) < 0) {
+		return H5I_INVALID_HID;
+	}
+
+	original_location_clock += 1;
+
+	for (int i = 0; i < original_location_cache_size; i++) {
+		original_location *location = &original_location_cache[i];
+
+		if (location->carved_fileno == carved_info.fileno && memcmp(&location->carved_token, &carved_info.token, sizeof(H5O_token_t)) == 0) {
+			location->last_used = original_location_clock;
+			return location->original_loc_id;
+		}
+	}
+
+	hid_t original_file_id = get_original_file(carved_loc_id);
+
+	if (original_file_id == H5I_INVALID_HID) {
+		return H5I_INVALID_HID;
+	}
+
+	int size_of_name_buffer = H5Iget_name(carved_loc_id, NULL, 0) + 1;
+
+	if (size_of_name_buffer <= 1) {
+		return H5I_INVALID_HID;
+	}
+
+	char *loc_name = malloc(size_of_name_buffer);
+	H5Iget_name(carved_loc_id, loc_name, size_of_name_buffer);
+
+	hid_t original_loc_id = original_H5Oopen(original_file_id, loc_name, H5P_DEFAULT);
+	free(loc_name);
+
+	if (original_loc_id == H5I_INVALID_HID) {
+		return H5I_INVALID_HID;
+	}
+
+	int slot = original_location_cache_size;
+
+	if (original_location_cache_size < ORIGINAL_LOCATION_CACHE_SIZE) {
+		original_location_cache_size += 1;
+	} else {
+		slot = 0;
+
+		for (int i = 1; i < ORIGINAL_LOCATION_CACHE_SIZE; i++) {
+			if (original_location_cache[i].last_used < original_location_cache[slot].last_used) {
+				slot = i;
+			}
+		}
+
+		H5Oclose(original_location_cache[slot].original_loc_id);
+	}
+
+	original_location_cache[slot].carved_fileno = carved_info.fileno;
+	original_location_cache[slot].carved_token = carved_info.token;
+	original_location_cache[slot].original_loc_id = original_loc_id;
+	original_location_cache[slot].last_used = original_location_clock;
+
+	return original_loc_id;
+}
+
+// Close the cached locations and the original files opened for fallbacks
+void release_original_files(void) {
+	for (int i = 0; i < original_location_cache_size; i++) {
+		H5Oclose(original_location_cache[i].original_loc_id);
+	}
+
+	original_location_cache_size = 0;
+
+	for (int i = 0; i < original_files_size; i++) {
+		original_file_handle *handle = original_files[i];
+
+		if (handle->original_file_id != H5I_INVALID_HID)
+			H5Fclose(handle->original_file_id);
+		if (handle->fapl_id != H5P_DEFAULT)
+			H5Pclose(handle->fapl_id);
+		free(handle->filename);
+		free(handle);
+	}
+
+	free(original_files);
+	original_files = NULL;
+	original_files_size = 0;
+	release_fileno_map(&original_file_filenos);
+}
+
+// Dataset opened in the original file by the repeat-mode fallback, counted towards its promotion into the carved file
+typedef struct {
+	char *filename;
+	char *dataset_name;
+	int hits;
+	bool is_promoted;
+	bool is_pending;
+} fallback_dataset;
+
+static fallback_dataset **fallback_datasets;
+static int fallback_datasets_size;
+
+// H5Aiterate2 callback recording an attribute of a skeleton dataset as accessed on the source dataset, if the source dataset has it
+static herr_t record_skeleton_attribute(hid_t loc_id, const char *name, const H5A_info_t *ainfo, void *opdata) {
+	(void)loc_id;
+	(void)ainfo;
+
+	hid_t src_dataset_id = *(hid_t *)opdata;
+
+	if (H5Aexists(src_dataset_id, name) > 0) {
+		record_attribute_access(src_dataset_id, name);
+	}
+
+	return 0;
+}
+
+/*
+	Record the attributes the carving run copied onto a skeleton dataset as accessed, so that they are copied again onto the dataset promoted
+	in its place when the promotions are finished. Only needed when the accessed attributes are copied, otherwise all of them are.
+*/
+static void record_promoted_dataset_attributes(carved_file_handle *handle, hid_t dataset_id, const char *dataset_name) {
+	hid_t skeleton_dataset_id = is_copying_all_attributes ? H5I_INVALID_HID : original_H5Oopen(handle->carved_file_id, dataset_name, H5P_DEFAULT);
+
+	if (skeleton_dataset_id != H5I_INVALID_HID) {
+		original_H5Aiterate2(skeleton_dataset_id, H5_INDEX_NAME, H5_ITER_INC, NULL, record_skeleton_attribute, &dataset_id);
+		H5Oclose(skeleton_dataset_id);
+	}
+}
+
+// Copy a dataset of an original file into its carved file, through the pooled handles of the original file
+static void promote_dataset(fallback_dataset *dataset) {
+	carved_file_handle *handle = acquire_file_handle(dataset->filename, H5I_INVALID_HID);
+
+	if (handle == NULL) {
+		if (DEBUG)
+			fprintf(log_ptr, "Error acquiring file handles for promoting dataset %s\n", dataset->dataset_name);
+		return;
+	}
+
+	// Datasets missing from a lazily built carved file are added to its skeleton first
+	if (ensure_skeleton_path(handle, dataset->dataset_name) < 0) {
+		return;
+	}
+
+	hid_t dataset_id = H5Dopen(handle->src_file_id, dataset->dataset_name, H5P_DEFAULT);
+
+	if (dataset_id == H5I_INVALID_HID) {
+		if (DEBUG)
+			fprintf(log_ptr, "Error opening dataset to promote %s\n", dataset->dataset_name);
+		return;
+	}
+
+	record_promoted_dataset_attributes(handle, dataset_id, dataset->dataset_name);
+
+	bool is_fully_carved;
+
+	if (carve_dataset(handle, dataset_id, dataset->dataset_name, H5I_INVALID_HID, H5I_INVALID_HID, H5S_ALL, H5I_INVALID_HID, NULL, &is_fully_carved) < 0) {
+		if (DEBUG)
+			fprintf(log_ptr, "Error promoting dataset %s\n", dataset->dataset_name);
+	}
+
+	H5Dclose(dataset_id);
+}
+
+/*
+	Count a dataset opened in the original file by the repeat-mode fallback, and promote it into the carved file once it has
+	been opened promotion_threshold times in this run. The carving worker copies it while the application carries on. 
+	Without a thread-safe library the copy waits for finish_dataset_promotions, when the library terminates.
+*/
+void record_fallback_hit(hid_t original_object_id) {
+	if (H5Iget_type(original_object_id) != H5I_DATASET) {
+		return;
+	}
+
+	int size_of_name_buffer = H5Iget_name(original_object_id, NULL, 0) + 1;
+	hid_t original_file_id = H5Iget_file_id(original_object_id);
+	int size_of_filename_buffer = H5Fget_name(original_file_id, NULL, 0) + 1;
+
+	if (size_of_name_buffer <= 1 || size_of_filename_buffer <= 1) {
+		H5Fclose(original_file_id);
+		return;
+	}
+
+	char *dataset_name = malloc(size_of_name_buffer);
+	char *filename = malloc(size_of_filename_buffer);
+	H5Iget_name(original_object_id, dataset_name, size_of_name_buffer);
+	H5Fget_name(original_file_id, filename, size_of_filename_buffer);
+
+	fallback_dataset *dataset = NULL;
+
+	for (int i = 0; i < fallback_datasets_size; i++) {
+		if (strcmp(fallback_datasets[i]->dataset_name, dataset_name) == 0 && strcmp(fallback_datasets[i]->filename, filename) == 0) {
+			dataset = fallback_datasets[i];
+			break;
+		}
+	}
+
+	if (dataset == NULL) {
+		dataset = calloc(1, sizeof(fallback_dataset));
+		dataset->filename = filename;
+		dataset->dataset_name = dataset_name;
+
+		fallback_datasets = realloc(fallback_datasets, (fallback_datasets_size + 1) * sizeof(fallback_dataset *));
+		fallback_datasets[fallback_datasets_size] = dataset;
+		fallback_datasets_size += 1;
+	} else {
+		free(filename);
+		free(dataset_name);
+	}
+
+	dataset->hits += 1;
+
+	if (dataset->is_promoted || dataset->hits < promotion_threshold) {
+		H5Fclose(original_file_id);
+		return;
+	}
+
+	dataset->is_promoted = true;
+
+	if (DEBUG)
+		fprintf(log_ptr, "Promoting dataset %s of %s after %d fallbacks\n", dataset->dataset_name, dataset->filename, dataset->hits);
+
+	// The pooled source handle is opened with the file access properties of the fallback
+	carved_file_handle *handle = acquire_file_handle(dataset->filename, original_file_id);
+	H5Fclose(original_file_id);
+
+	// The skeleton path is created here, so that the worker only copies the data
+	if (handle == NULL || ensure_skeleton_path(handle, dataset->dataset_name) < 0) {
+		dataset->is_pending = true;
+		return;
+	}
+
+	hid_t dataset_id = H5Dopen(handle->src_file_id, dataset->dataset_name, H5P_DEFAULT);
+
+	if (dataset_id != H5I_INVALID_HID) {
+		record_promoted_dataset_attributes(handle, dataset_id, dataset->dataset_name);
+		H5Dclose(dataset_id);
+	}
+
+	if (!enqueue_carve_job(handle, dataset->dataset_name, H5S_ALL)) {
+		dataset->is_pending = true;
+	}
+}
+
+// Carve the promoted datasets the carving worker did not take, and copy the attributes of the carved files they were promoted into
+void finish_dataset_promotions(void) {
+	for (int i = 0; i < fallback_datasets_size; i++) {
+		fallback_dataset *dataset = fallback_datasets[i];
+
+		if (dataset->is_pending) {
+			promote_dataset(dataset);
+		}
+	}
+
+	// Promoted datasets replaced skeleton datasets, or were missing from a lazily built skeleton, so their carved files get attributes as when the library terminates
+	for (int i = 0; i < fallback_datasets_size; i++) {
+		fallback_dataset *dataset = fallback_datasets[i];
+		carved_file_handle *handle = dataset->is_promoted ? get_file_handle(dataset->filename) : NULL;
+
+		for (int j = 0; j < i && handle != NULL; j++) {
+			if (fallback_datasets[j]->is_promoted && strcmp(fallback_datasets[j]->filename, dataset->filename) == 0) {
+				handle = NULL;
+			}
+		}
+
+		if (handle != NULL) {
+			if (is_copying_all_attributes) {
+				copy_carved_file_attributes(handle);
+			} else {
+				copy_accessed_attributes(handle);
+			}
+		}
+	}
+
+	for (int i = 0; i < fallback_datasets_size; i++) {
+		free(fallback_datasets[i]->filename);
+		free(fallback_datasets[i]->dataset_name);
+		free(fallback_datasets[i]);
+	}
+
+	free(fallback_datasets);
+	fallback_datasets = NULL;
+	fallback_datasets_size = 0;
+}
+
+// File identified by its device and inode, which stay the same when the file is reopened under another file number
+typedef struct {
+	dev_t device;
+	ino_t inode;
+} file_identity;
+
+// Identities of the files attributes were accessed in, by file number
+static fileno_map file_identities;
+
+static bool get_file_identity(hid_t loc_id, unsigned long fileno, file_identity *identity) {
+	file_identity *known_identity = get_fileno_map(&file_identities, fileno);
+
+	if (known_identity == NULL) {
+		hid_t file_id = H5Iget_file_id(loc_id);
+		char *file_path = file_id < 0 ? NULL : get_file_path(file_id);
+		struct stat file_stat;
+
+		if (file_id >= 0)
+			H5Fclose(file_id);
+
+		if (file_path == NULL || stat(file_path, &file_stat) < 0) {
+			free(file_path);
+			return false;
+		}
+
+		free(file_path);
+
+		known_identity = malloc(sizeof(file_identity));
+		known_identity->device = file_stat.st_dev;
+		known_identity->inode = file_stat.st_ino;
+		put_fileno_map(&file_identities, fileno, known_identity);
+	}
+
+	*identity = *known_identity;
+
+	return true;
+}
+
+static bool file_identities_equal(const file_identity *a, const file_identity *b) {
+	return a->device == b->device && a->inode == b->inode;
+}
+
+// Attribute accessed by the application, identified by the file and token of its object and its name
+typedef struct {
+	file_identity file;
+	H5O_token_t token;
+	char *attribute_name;
+	char *object_name;
+} accessed_attribute;
+
+static accessed_attribute *accessed_attributes;
+static size_t accessed_attributes_size;
+static size_t *accessed_attribute_slots; // Hash set of indices into accessed_attributes, offset by one so that 0 marks an unused slot
+static size_t accessed_attribute_capacity;
+
+static size_t hash_accessed_attribute(const file_identity *file, const H5O_token_t *token, const char *attribute_name) {
+	// FNV-1a over the file identity, the object token and the attribute name
+	uint64_t hash = 14695981039346656037ULL;
+	const unsigned char *bytes = (const unsigned char *)&file->device;
+
+	for (size_t i = 0; i < sizeof(file->device); i++) {
+		hash = (hash ^ bytes[i]) * 1099511628211ULL;
+	}
+
+	bytes = (const unsigned char *)&file->inode;
+
+	for (size_t i = 0; i < sizeof(file->inode); i++) {
+		hash = (hash ^ bytes[i]) * 1099511628211ULL;
+	}
+
+	bytes = (const unsigned char *)token;
+
+	for (size_t i = 0; i < sizeof(H5O_token_t); i++) {
+		hash = (hash ^ bytes[i]) * 1099511628211ULL;
+	}
+
+	for (bytes = (const unsigned char *)attribute_name; *bytes != '\0'; bytes++) {
+		hash = (hash ^ *bytes) * 1099511628211ULL;
+	}
+
+	return (size_t)hash;
+}
+
+// Slot of an attribute in the hash set, or of the unused slot where it would be inserted
+static size_t find_accessed_attribute_slot(const file_identity *file, const H5O_token_t *token, const char *attribute_name) {
+	size_t slot = hash_accessed_attribute(file, token, attribute_name) & (accessed_attribute_capacity - 1);
+
+	while (accessed_attribute_slots[slot] != 0) {
+		accessed_attribute *attribute = &accessed_attributes[accessed_attribute_slots[slot] - 1];
+
+		if (file_identities_equal(&attribute->file, file) && memcmp(&attribute->token, token, sizeof(H5O_token_t)) == 0 && strcmp(attribute->attribute_name, attribute_name) == 0) {
+			break;
+		}
+
+		slot = (slot + 1) & (accessed_attribute_capacity - 1);
+	}
+
+	return slot;
+}
+
+/*
+	Record an attribute read or iterated over by the application. loc_id is the attribute, or the object it is attached to.
+	The path of the object is resolved once, when the attribute is first recorded.
+*/
+void record_attribute_access(hid_t loc_id, const char *attribute_name) {
+	// Traces do not record attributes, h5carve_materialize copies all of them
+	if (is_tracing_mode) {
+		return;
+	}
+
+	H5O_info2_t object_info;
+	file_identity file;
+
+	if (H5Oget_info3(loc_id, &object_info, H5O_INFO_BASIC) < 0 || !get_file_identity(loc_id, object_info.fileno, &file)) {
+		return;
+	}
+
+	if (accessed_attribute_capacity > 0 && accessed_attribute_slots[find_accessed_attribute_slot(&file, &object_info.token, attribute_name)] != 0) {
+		return;
+	}
 
-		// Open the dataset
-		dataset_id = H5Dopen(src_file_id, object_name, H5P_DEFAULT);
+	int size_of_name_buffer = H5Iget_name(loc_id, NULL, 0) + 1;
 
-		if (dataset_id == H5I_INVALID_HID) {
-			if (DEBUG)
-    			fprintf(log_ptr, "Error opening dataset %ld %s\n", src_file_id, object_name);
+	// Anonymous objects cannot be found in the carved file
+	if (size_of_name_buffer <= 1) {
+		return;
+	}
 
-			return dataset_id;
+	// Keep the load factor below one half, doubling and rehashing when exceeded
+	if ((accessed_attributes_size + 1) * 2 > accessed_attribute_capacity) {
+		free(accessed_attribute_slots);
+		accessed_attribute_capacity = accessed_attribute_capacity == 0 ? 64 : accessed_attribute_capacity * 2;
+		accessed_attribute_slots = calloc(accessed_attribute_capacity, sizeof(size_t));
+		accessed_attributes = realloc(accessed_attributes, accessed_attribute_capacity / 2 * sizeof(accessed_attribute));
+
+		for (size_t i = 0; i < accessed_attributes_size; i++) {
+			accessed_attribute *attribute = &accessed_attributes[i];
+			accessed_attribute_slots[find_accessed_attribute_slot(&attribute->file, &attribute->token, attribute->attribute_name)] = i + 1;
 		}
+	}
 
-		// Fetch data type of dataset
-		data_type = H5Dget_type(dataset_id);
+	accessed_attribute *attribute = &accessed_attributes[accessed_attributes_size];
+	attribute->file = file;
+	attribute->token = object_info.token;
+	attribute->attribute_name = malloc(strlen(attribute_name) + 1);
+	strcpy(attribute->attribute_name, attribute_name);
+	attribute->object_name = malloc(size_of_name_buffer);
+	H5Iget_name(loc_id, attribute->object_name, size_of_name_buffer);
 
-		if (data_type == H5I_INVALID_HID) {
-			if (DEBUG)
-    			fprintf(log_ptr, "Error fetching type of dataset %ld\n", dataset_id);
+	accessed_attribute_slots[find_accessed_attribute_slot(&file, &object_info.token, attribute_name)] = accessed_attributes_size + 1;
+	accessed_attributes_size += 1;
+}
 
-			return data_type;
-		}
+/*
+	Copy the attributes of a source file accessed by the application into its carved file, in place of all its attributes.
+	Called for every carved file when the library terminates, unless CARVE_ATTRIBUTES is set to "all".
+*/
+void copy_accessed_attributes(carved_file_handle *handle) {
+	unsigned long src_fileno;
+	file_identity src_file;
+
+	// The source file may have been reopened since the attributes were accessed, so it is matched by identity rather than file number
+	if (H5Fget_fileno(handle->src_file_id, &src_fileno) < 0 || !get_file_identity(handle->src_file_id, src_fileno, &src_file)) {
+		return;
+	}
 
-		// Create null dataspace for shallow copy
-		data_space = H5Dget_space(dataset_id);
+	// Reference attributes are copied through the global source and carved files
+	src_file_id = handle->src_file_id;
+	dest_file_id = handle->carved_file_id;
 
-		if (data_space == H5I_INVALID_HID) {
-			if (DEBUG)
-    			fprintf(log_ptr, "Error fetching data space of dataset %ld\n", dataset_id);
-			return data_space;
+	for (size_t i = 0; i < accessed_attributes_size; i++) {
+		accessed_attribute *attribute = &accessed_attributes[i];
+
+		if (!file_identities_equal(&attribute->file, &src_file)) {
+			continue;
 		}
 
-		// Create dataset in destination file
-		hid_t dest_dataset_id = H5Dcreate(*dest_parent_object_id, object_name, data_type, data_space, H5P_DEFAULT, H5Dget_create_plist(dataset_id), H5P_DEFAULT);
+		hid_t src_object_id = H5Oopen_by_token(handle->src_file_id, attribute->token);
+		hid_t dest_object_id = original_H5Oopen(handle->carved_file_id, attribute->object_name, H5P_DEFAULT);
+
+		// Objects missing from a lazily built skeleton are added to it
+		if (dest_object_id == H5I_INVALID_HID && is_lazy_skeleton_mode && ensure_skeleton_path(handle, attribute->object_name) >= 0) {
+			dest_object_id = original_H5Oopen(handle->carved_file_id, attribute->object_name, H5P_DEFAULT);
+		}
 
-		if (dest_dataset_id < 0) {
+		if (src_object_id == H5I_INVALID_HID || dest_object_id == H5I_INVALID_HID) {
+			if (DEBUG)
+				fprintf(log_ptr, "Error opening object of accessed attribute %s %s\n", attribute->object_name, attribute->attribute_name);
+		} else {
 			if (DEBUG)
-    			fprintf(log_ptr, "Error creating shallow copy of dataset %s. dest_parent_object_id is %ld data_type %ld dataspace %ld\n", name, *dest_parent_object_id, data_type, data_space);
-			return dest_dataset_id;
+				fprintf(log_ptr, "Copying accessed attribute %s of %s\n", attribute->attribute_name, attribute->object_name);
+
+			if (copy_object_attributes(src_object_id, attribute->attribute_name, NULL, &dest_object_id) < 0 && DEBUG)
+				fprintf(log_ptr, "Error copying accessed attribute %s of %s\n", attribute->attribute_name, attribute->object_name);
 		}
 
-		// Create a scalar dataspace for the attribute.
-	    hid_t attr_dataspace_id = H5Screate(H5S_SCALAR);
+		if (src_object_id >= 0)
+			H5Oclose(src_object_id);
+		if (dest_object_id >= 0)
+			H5Oclose(dest_object_id);
+	}
+
+	release_reference_memo();
+	release_type_copy_plans();
+	log_attribute_arena_peak();
+}
 
-	    // Create an attribute to indicate that the dataset is empty.
-	    hid_t attr_id = H5Acreate2(dest_dataset_id, "CARVED_DATASET_IS_EMPTY", H5T_NATIVE_HBOOL, attr_dataspace_id, 
-	                               H5P_DEFAULT, H5P_DEFAULT);
+/*
+	Sidecar index of the carved datasets that can be read without the library: contiguous, carved, with no references or variable-length data.
+	It is kept next to each carved file as <carved file>.index. When the pooled handles are released, the entries of the datasets carved in this run
+	are added to it or replace their previous entries. In repeat mode, reads of these datasets that need no type conversion and select one contiguous
+	run of elements are served with pread on the carved file. Entries are checked against the opened dataset before they are used,
+	so an index left behind by an older carved file is harmless.
+*/
+#define DIRECT_READ_INDEX_MAGIC "H5CIDX1\n"
+
+// Bytes of an entry with no dimensions and a one-byte encoded type: token, offset, storage size, rank, type size and type
+#define DIRECT_READ_ENTRY_MIN_SIZE (sizeof(H5O_token_t) + 3 * sizeof(uint64_t) + sizeof(int32_t) + 1)
+
+typedef enum {
+	DIRECT_READ_UNCHECKED,
+	DIRECT_READ_VALID,
+	DIRECT_READ_INVALID,
+} direct_read_state;
+
+typedef struct {
+	H5O_token_t token;
+	haddr_t offset;
+	hsize_t storage_size;
+	int rank;
+	hsize_t dims[H5S_MAX_RANK];
+	hid_t type_id;
+	size_t element_size;
+	direct_read_state state;
+} direct_read_entry;
+
+// Index of a carved file opened in repeat mode, with its entries sorted by token. Reopening the file reuses its index and descriptor.
+typedef struct {
+	char *carved_path;
+	int fd;
+	direct_read_entry *entries;
+	size_t entries_size;
+} direct_read_index;
+
+static direct_read_index **direct_read_indexes;
+static size_t direct_read_indexes_size;
+
+// Indexes by the file numbers the carved files were opened under
+static fileno_map direct_read_index_filenos;
+
+static char *get_direct_read_index_filename(const char *carved_filename) {
+	char *index_filename = malloc(strlen(carved_filename) + strlen(".index") + 1);
+	strcpy(index_filename, carved_filename);
+	strcat(index_filename, ".index");
+
+	return index_filename;
+}
 
-	    hbool_t is_empty = true;
-	    H5Awrite(attr_id, H5T_NATIVE_HBOOL, &is_empty);
+static int compare_direct_read_entries(const void *a, const void *b) {
+	return memcmp(&((const direct_read_entry *)a)->token, &((const direct_read_entry *)b)->token, sizeof(H5O_token_t));
+}
 
-	    free(object_name);
+static void release_direct_read_entries(direct_read_entry *entries, size_t entries_size) {
+	for (size_t i = 0; i < entries_size; i++) {
+		H5Tclose(entries[i].type_id);
+	}
 
-	// If object is a group, make shallow copy of the group and recursively go down the tree
-	} else if (object_type == H5I_GROUP) {
-		// Create group in destination file
-		hid_t dest_group_id = H5Gcreate1(*dest_parent_object_id, name, size_of_name_buffer);
+	free(entries);
+}
 
-		if (dest_group_id < 0) {
-			if (DEBUG)
-    			fprintf(log_ptr, "Error creating shallow copy of group %s. dest_parent_object_id is %ld\n", name, *dest_parent_object_id);
+// Read the entries of a direct read index file. Returns false if the file is missing or unreadable, with no entries.
+static bool read_direct_read_index_file(const char *index_filename, direct_read_entry **entries_out, size_t *entries_size_out) {
+	*entries_out = NULL;
+	*entries_size_out = 0;
 
-			return dest_group_id;
+	FILE *index_file = fopen(index_filename, "rb");
+
+	if (index_file == NULL) {
+		return false;
+	}
+
+	// Sizes read from the index are bounded by the size of the file, so that a truncated or corrupted index cannot request huge allocations
+	struct stat index_stat;
+	char magic[sizeof(DIRECT_READ_INDEX_MAGIC)] = { 0 };
+	uint64_t entries_size = 0;
+	direct_read_entry *entries = NULL;
+	bool is_read = fstat(fileno(index_file), &index_stat) == 0
+		&& fread(magic, 1, strlen(DIRECT_READ_INDEX_MAGIC), index_file) == strlen(DIRECT_READ_INDEX_MAGIC)
+		&& strcmp(magic, DIRECT_READ_INDEX_MAGIC) == 0 && fread(&entries_size, sizeof(entries_size), 1, index_file) == 1
+		&& entries_size <= (uint64_t)index_stat.st_size / DIRECT_READ_ENTRY_MIN_SIZE;
+
+	if (is_read && entries_size > 0) {
+		entries = calloc(entries_size, sizeof(direct_read_entry));
+		is_read = entries != NULL;
+	}
+
+	uint64_t entries_read = 0;
+
+	while (is_read && entries_read < entries_size) {
+		direct_read_entry *entry = &entries[entries_read];
+		uint64_t entry_offset, entry_storage_size, entry_type_size;
+		int32_t rank;
+
+		is_read = fread(&entry->token, sizeof(H5O_token_t), 1, index_file) == 1
+			&& fread(&entry_offset, sizeof(entry_offset), 1, index_file) == 1
+			&& fread(&entry_storage_size, sizeof(entry_storage_size), 1, index_file) == 1
+			&& fread(&rank, sizeof(rank), 1, index_file) == 1 && rank >= 0 && rank <= H5S_MAX_RANK
+			&& fread(entry->dims, sizeof(hsize_t), rank, index_file) == (size_t)rank
+			&& fread(&entry_type_size, sizeof(entry_type_size), 1, index_file) == 1;
+
+		if (!is_read) {
+			break;
 		}
 
-		// Iterate over objects at this level in the source file, and make shallow copes in the destination file
-		herr_t link_iterate_return_val = H5Literate2(object_id, H5_INDEX_NAME, H5_ITER_INC, NULL, shallow_copy_object, &dest_group_id);
+		long position = ftell(index_file);
+		unsigned char *encoded_type = position >= 0 && entry_type_size <= (uint64_t)(index_stat.st_size - position) ? malloc(entry_type_size) : NULL;
+		is_read = encoded_type != NULL && fread(encoded_type, 1, entry_type_size, index_file) == entry_type_size;
+		entry->type_id = is_read ? H5Tdecode(encoded_type) : H5I_INVALID_HID;
+		free(encoded_type);
+
+		is_read = is_read && entry->type_id >= 0;
+		entry->offset = entry_offset;
+		entry->storage_size = entry_storage_size;
+		entry->rank = rank;
+		entry->element_size = is_read ? H5Tget_size(entry->type_id) : 0;
+		entry->state = DIRECT_READ_UNCHECKED;
+
+		if (is_read) {
+			entries_read += 1;
+		}
+	}
 
-		if (link_iterate_return_val < 0) {
-			if (DEBUG)
-    			fprintf(log_ptr, "Link iteration failed\n");
-			return link_iterate_return_val;
-		}	
+	fclose(index_file);
+
+	if (!is_read) {
+		if (DEBUG)
+			fprintf(log_ptr, "Ignoring unreadable direct read index %s\n", index_filename);
+		release_direct_read_entries(entries, entries_read);
+		return false;
 	}
-	
-	return 0;
-}
 
-char *get_carved_filename(const char *filename, char *is_netcdf4, char *use_carved) {
-	char *carved_directory = getenv("CARVED_DIRECTORY");
+	qsort(entries, entries_read, sizeof(direct_read_entry), compare_direct_read_entries);
 
-	// Make a copy of the filename.
-	char *filename_copy;
-	filename_copy = malloc(strlen(filename) + 1);
-	strcpy(filename_copy, filename);
+	*entries_out = entries;
+	*entries_size_out = entries_read;
 
-	// If original file is a netCDF4 file and tool is being used in re-execution mode, interposed nc_open returns filename with the .carved suffix, leading to the carved file name being <filename>.carved.carved.
-	// Removes .carved suffix for netCDF4 files in re-execution mode.
-	if (strlen(filename_copy) >= 7 && strcmp(filename_copy + (strlen(filename_copy) - 7), ".carved") == 0) {
-                filename_copy[strlen(filename_copy) - 7] = '\0';
-        }
+	return true;
+}
 
-	// Traverse the file path to get to the last occurrence of directory separtors to get to name of the file
-	char *filename_without_directories = strrchr(filename_copy, '/');
+// Fill the index entry of a carved dataset. Returns false if the dataset cannot be read directly.
+static bool get_direct_read_entry(hid_t carved_file_id, const char *name, direct_read_entry *entry) {
+	H5O_info2_t object_info;
 
-	// If there are no directory separators in filename, strrchr returns NULL. 
-	// If it has returned NULL, replace variable back with the filename. 
-	// Otherwise, increment by 1 to skip the last directory separator
-	if (filename_without_directories != NULL) {
-	        filename_without_directories = filename_without_directories + 1;
-	} else {
-	        filename_without_directories = filename_copy;
+	if (H5Oget_info_by_name3(carved_file_id, name, &object_info, H5O_INFO_BASIC, H5P_DEFAULT) < 0 || object_info.type != H5O_TYPE_DATASET) {
+		return false;
 	}
 
-	char *carved_filename;
-	int carved_filename_length_without_suffix;
+	hid_t dataset_id = H5Dopen(carved_file_id, name, H5P_DEFAULT);
 
-	// If no directory is specified for the carved files, the length of the carved file directory path does not need to be considered.
-	// If a directory is specified for the carved files, the length of the carved file directory path needs to be included when allocating memory.
-	if (carved_directory == NULL) {
-		carved_filename_length_without_suffix = strlen(filename);
-	} else {
-		carved_filename_length_without_suffix = strlen(carved_directory) + strlen(filename_without_directories);
+	if (dataset_id < 0) {
+		return false;
 	}
 
-	carved_filename = (char *)malloc(carved_filename_length_without_suffix + 7 + 1); // 7 + 1 is for the suffix .carved and null terminating character
+	hid_t create_plist = H5Dget_create_plist(dataset_id);
+	hid_t data_type = H5Dget_type(dataset_id);
+	hid_t data_space = H5Dget_space(dataset_id);
+	haddr_t offset = H5Dget_offset(dataset_id);
+	hsize_t storage_size = H5Dget_storage_size(dataset_id);
+
+	bool qualifies = create_plist >= 0 && data_type >= 0 && data_space >= 0
+		&& H5Pget_layout(create_plist) == H5D_CONTIGUOUS && H5Pget_external_count(create_plist) == 0
+		&& H5Tdetect_class(data_type, H5T_REFERENCE) == 0 && H5Tdetect_class(data_type, H5T_VLEN) == 0 && H5Tis_variable_str(data_type) == 0
+		&& H5Sget_simple_extent_type(data_space) == H5S_SIMPLE && offset != HADDR_UNDEF && storage_size > 0
+		&& does_dataset_exist(dataset_id);
+
+	if (qualifies) {
+		entry->token = object_info.token;
+		entry->offset = offset;
+		entry->storage_size = storage_size;
+		entry->rank = H5Sget_simple_extent_dims(data_space, entry->dims, NULL);
+		entry->type_id = H5Tcopy(data_type);
+		entry->element_size = H5Tget_size(data_type);
+		entry->state = DIRECT_READ_UNCHECKED;
+		qualifies = entry->rank >= 0 && entry->type_id >= 0;
+
+		if (!qualifies && entry->type_id >= 0)
+			H5Tclose(entry->type_id);
+	}
 
-	// Construct the path of the carved file.
-	// If no directory for carved files is specified, carved files are created in the same location as the original files.
-	// If a directory for carved files is specified, carved files are created in the specified directory. 
-	if (carved_directory == NULL) {
-	    carved_filename[0] = '\0';
-		strcat(carved_filename, filename_copy);
-		strcat(carved_filename, ".carved");	
-	} else {
-		carved_filename[0] = '\0';
-		strcat(carved_filename, carved_directory);
-		strcat(carved_filename, filename_without_directories);
-		strcat(carved_filename, ".carved");
+	if (create_plist >= 0)
+		H5Pclose(create_plist);
+	if (data_type >= 0)
+		H5Tclose(data_type);
+	if (data_space >= 0)
+		H5Sclose(data_space);
+
+	H5Dclose(dataset_id);
+
+	return qualifies;
+}
+
+static bool write_direct_read_entry(FILE *index_file, const direct_read_entry *entry) {
+	size_t encoded_type_size = 0;
+
+	if (H5Tencode(entry->type_id, NULL, &encoded_type_size) < 0) {
+		return false;
 	}
 
-	free(filename_copy);
+	unsigned char *encoded_type = malloc(encoded_type_size);
+	int32_t rank = entry->rank;
+	uint64_t entry_offset = entry->offset;
+	uint64_t entry_storage_size = entry->storage_size;
+	uint64_t entry_type_size = encoded_type_size;
 
-	return carved_filename;
+	bool is_written = H5Tencode(entry->type_id, encoded_type, &encoded_type_size) >= 0
+		&& fwrite(&entry->token, sizeof(H5O_token_t), 1, index_file) == 1
+		&& fwrite(&entry_offset, sizeof(entry_offset), 1, index_file) == 1
+		&& fwrite(&entry_storage_size, sizeof(entry_storage_size), 1, index_file) == 1
+		&& fwrite(&rank, sizeof(rank), 1, index_file) == 1
+		&& fwrite(entry->dims, sizeof(hsize_t), rank, index_file) == (size_t)rank
+		&& fwrite(&entry_type_size, sizeof(entry_type_size), 1, index_file) == 1
+		&& fwrite(encoded_type, 1, encoded_type_size, index_file) == encoded_type_size;
+
+	free(encoded_type);
+
+	return is_written;
 }
 
-bool does_dataset_exist(hid_t dataset_id) {
-	// If the CARVED_DATASET_IS_EMPTY attribute does not exist, the dataset is not empty.
-	if (!H5Aexists(dataset_id, "CARVED_DATASET_IS_EMPTY")) {
-		return true;
+/*
+	Update the direct read index of a carved file with the datasets carved in this run: their entries are added, or replace the entries of the same object,
+	and datasets that no longer qualify lose theirs. The other entries are kept as they are. The index is written to a temporary file renamed over the previous one.
+*/
+void write_direct_read_index(carved_file_handle *handle) {
+	if (handle->carved_dataset_names_size == 0) {
+		return;
 	}
 
-	hid_t attr_id = H5Aopen(dataset_id, "CARVED_DATASET_IS_EMPTY", H5P_DEFAULT);
+	char *index_filename = get_direct_read_index_filename(handle->carved_filename);
+	direct_read_entry *entries;
+	size_t entries_size;
 
-	if (attr_id < 0) {
-		if (DEBUG)
-    		fprintf(log_ptr, "Error opening CARVED_DATASET_IS_EMPTY attribute %ld\n", dataset_id);
-		return attr_id;
+	read_direct_read_index_file(index_filename, &entries, &entries_size);
+
+	// Entries read from the index are sorted, the ones of datasets new to it are appended and sorted in once all are known
+	size_t known_entries_size = entries_size;
+
+	for (int i = 0; i < handle->carved_dataset_names_size; i++) {
+		direct_read_entry entry;
+		bool qualifies = get_direct_read_entry(handle->carved_file_id, handle->carved_dataset_names[i], &entry);
+		H5O_info2_t object_info;
+
+		if (!qualifies && H5Oget_info_by_name3(handle->carved_file_id, handle->carved_dataset_names[i], &object_info, H5O_INFO_BASIC, H5P_DEFAULT) < 0) {
+			continue;
+		}
+
+		direct_read_entry probe = { .token = qualifies ? entry.token : object_info.token };
+		direct_read_entry *known_entry = bsearch(&probe, entries, known_entries_size, sizeof(direct_read_entry), compare_direct_read_entries);
+
+		if (known_entry != NULL) {
+			H5Tclose(known_entry->type_id);
+
+			if (qualifies) {
+				*known_entry = entry;
+			} else {
+				memmove(known_entry, known_entry + 1, (entries + entries_size - known_entry - 1) * sizeof(direct_read_entry));
+				known_entries_size -= 1;
+				entries_size -= 1;
+			}
+		} else if (qualifies) {
+			entries = realloc(entries, (entries_size + 1) * sizeof(direct_read_entry));
+			entries[entries_size] = entry;
+			entries_size += 1;
+		}
 	}
 
-	hbool_t is_empty;
+	qsort(entries, entries_size, sizeof(direct_read_entry), compare_direct_read_entries);
 
-	herr_t attribute_read_ret = H5Aread(attr_id, H5T_NATIVE_UINT8, &is_empty);
+	// A dataset carved through several hard links is appended once per link
+	size_t unique_entries_size = 0;
 
-	if (attribute_read_ret < 0) {
+	for (size_t i = 0; i < entries_size; i++) {
+		if (unique_entries_size > 0 && compare_direct_read_entries(&entries[unique_entries_size - 1], &entries[i]) == 0) {
+			H5Tclose(entries[i].type_id);
+		} else {
+			entries[unique_entries_size] = entries[i];
+			unique_entries_size += 1;
+		}
+	}
+
+	entries_size = unique_entries_size;
+
+	// A unique temporary file, so that processes releasing the same carved file do not write into each other's index
+	char *temporary_filename = malloc(strlen(index_filename) + strlen(".XXXXXX") + 1);
+	sprintf(temporary_filename, "%s.XXXXXX", index_filename);
+
+	int fd = mkstemp(temporary_filename);
+	FILE *index_file = fd < 0 ? NULL : fdopen(fd, "wb");
+	uint64_t entries_count = entries_size;
+
+	bool is_written = index_file != NULL && fchmod(fd, 0644) == 0
+		&& fwrite(DIRECT_READ_INDEX_MAGIC, 1, strlen(DIRECT_READ_INDEX_MAGIC), index_file) == strlen(DIRECT_READ_INDEX_MAGIC)
+		&& fwrite(&entries_count, sizeof(entries_count), 1, index_file) == 1;
+
+	for (size_t i = 0; is_written && i < entries_size; i++) {
+		is_written = write_direct_read_entry(index_file, &entries[i]);
+	}
+
+	if (index_file != NULL) {
+		is_written = fclose(index_file) == 0 && is_written;
+	} else if (fd >= 0) {
+		close(fd);
+	}
+
+	if (!is_written || rename(temporary_filename, index_filename) < 0) {
 		if (DEBUG)
-    		fprintf(log_ptr, "Error reading CARVED_DATASET_IS_EMPTY attribute %ld\n", attr_id);
-		return attribute_read_ret;
+			fprintf(log_ptr, "Error writing direct read index %s: %s\n", index_filename, strerror(errno));
+		if (fd >= 0)
+			unlink(temporary_filename);
+	} else if (DEBUG) {
+		fprintf(log_ptr, "Wrote direct read index %s with %zu datasets, %d carved in this run\n", index_filename, entries_size, handle->carved_dataset_names_size);
 	}
 
-	return !(is_empty == true);
+	release_direct_read_entries(entries, entries_size);
+	free(temporary_filename);
+	free(index_filename);
 }
 
-bool is_already_recorded(const char *filename) {
-	for (int i = 0; i < files_opened_current_size; i++) {
-		if (strcmp(files_opened[i], filename) == 0) {
-			return true;
+/*
+	Load the direct read index of a carved file opened in repeat mode. Carved files without an index are read through the library.
+	Indexes are identified by the absolute path of their carved file, so that reopening a file reuses the entries and the descriptor it was first opened with.
+*/
+void load_direct_read_index(hid_t carved_file_id, const char *carved_filename) {
+	unsigned long fileno;
+
+	if (H5Fget_fileno(carved_file_id, &fileno) < 0 || get_fileno_map(&direct_read_index_filenos, fileno) != NULL) {
+		return;
+	}
+
+	char *carved_path = get_file_path(carved_file_id);
+
+	for (size_t i = 0; carved_path != NULL && i < direct_read_indexes_size; i++) {
+		direct_read_index *index = direct_read_indexes[i];
+
+		if (strcmp(index->carved_path, carved_path) == 0) {
+			// The file may have been carved into since its entries were checked
+			for (size_t j = 0; j < index->entries_size; j++) {
+				index->entries[j].state = DIRECT_READ_UNCHECKED;
+			}
+
+			put_fileno_map(&direct_read_index_filenos, fileno, index);
+			free(carved_path);
+			return;
 		}
 	}
 
-	return false;
+	char *index_filename = get_direct_read_index_filename(carved_filename);
+	direct_read_entry *entries;
+	size_t entries_size;
+
+	read_direct_read_index_file(index_filename, &entries, &entries_size);
+	free(index_filename);
+
+	int fd = carved_path != NULL && entries_size > 0 ? open(carved_filename, O_RDONLY) : -1;
+
+	if (fd < 0) {
+		release_direct_read_entries(entries, entries_size);
+		free(carved_path);
+		return;
+	}
+
+	direct_read_index *index = malloc(sizeof(direct_read_index));
+	*index = (direct_read_index){ .carved_path = carved_path, .fd = fd, .entries = entries, .entries_size = entries_size };
+
+	direct_read_indexes = realloc(direct_read_indexes, (direct_read_indexes_size + 1) * sizeof(direct_read_index *));
+	direct_read_indexes[direct_read_indexes_size] = index;
+	direct_read_indexes_size += 1;
+	put_fileno_map(&direct_read_index_filenos, fileno, index);
+
+	if (DEBUG)
+		fprintf(log_ptr, "Loaded direct read index of %s with %zu datasets\n", carved_filename, entries_size);
 }
 
-herr_t create_fallback_metadata(const char *filename, hid_t destination_root_group) {
-	hsize_t dims[1] = {1};
-	hid_t fallback_attribute_dataspace = H5Screate(H5S_SIMPLE);
-    H5Sset_extent_simple(fallback_attribute_dataspace, 1, dims, dims);
-    char file_absolute_path[PATH_MAX];
-    realpath(filename, file_absolute_path);
-    int file_absolute_path_length = strlen(file_absolute_path);
+// Whether the extent of a dataspace is the one of an index entry, so that element positions computed in it match the bytes on disk
+static bool is_direct_read_extent(hid_t space_id, const direct_read_entry *entry) {
+	hsize_t dims[H5S_MAX_RANK];
 
-    hid_t fallback_compound_type = H5Tcreate(H5T_COMPOUND, sizeof(fallback_enum) + file_absolute_path_length);
+	return H5Sget_simple_extent_ndims(space_id) == entry->rank && H5Sget_simple_extent_dims(space_id, dims, NULL) == entry->rank
+		&& memcmp(dims, entry->dims, entry->rank * sizeof(hsize_t)) == 0;
+}
 
-    hid_t enum_type = H5Tcreate(H5T_ENUM, sizeof(fallback_enum));
+// Check an index entry against the dataset opened by the application: same storage, shape and type, in a file opened read-only whose raw data the library cannot hold back
+static bool is_direct_read_entry_valid(hid_t dataset_id, const direct_read_entry *entry) {
+	hid_t file_id = H5Iget_file_id(dataset_id);
+	hid_t data_type = H5Dget_type(dataset_id);
+	hid_t data_space = H5Dget_space(dataset_id);
+	unsigned intent = H5F_ACC_RDWR;
+
+	bool is_valid = file_id >= 0 && data_type >= 0 && data_space >= 0
+		&& H5Fget_intent(file_id, &intent) >= 0 && (intent & H5F_ACC_RDWR) == 0
+		&& H5Dget_offset(dataset_id) == entry->offset && H5Dget_storage_size(dataset_id) == entry->storage_size
+		&& is_direct_read_extent(data_space, entry) && H5Tequal(data_type, entry->type_id) > 0;
+
+	if (file_id >= 0)
+		H5Fclose(file_id);
+	if (data_type >= 0)
+		H5Tclose(data_type);
+	if (data_space >= 0)
+		H5Sclose(data_space);
+
+	return is_valid;
+}
 
-    int enum_value;
-    enum_value = LOCAL;
-    H5Tenum_insert(enum_type, "LOCAL", &enum_value);
-    enum_value = REMOTE;
-    H5Tenum_insert(enum_type, "REMOTE", &enum_value);
+/*
+	Find the elements selected in a dataspace as one run in row-major order, by its first element and number of elements.
+	The selection must be all of the extent, or a single block spanning every dimension after its first dimension of more than one element.
+*/
+static bool get_contiguous_selection(hid_t space_id, hsize_t *first_element, hsize_t *elements_size) {
+	hsize_t dims[H5S_MAX_RANK], start[H5S_MAX_RANK], end[H5S_MAX_RANK];
+	int rank = H5Sget_simple_extent_dims(space_id, dims, NULL);
+	H5S_sel_type selection_type = H5Sget_select_type(space_id);
+
+	if (rank < 0) {
+		return false;
+	}
 
-    H5Tinsert(fallback_compound_type, "FALLBACK_TYPE", 0, enum_type);
-    
-    hid_t string_dtype = H5Tcopy(H5T_C_S1);
-    H5Tset_size (string_dtype, file_absolute_path_length);
-    H5Tinsert(fallback_compound_type, "PATH", sizeof(fallback_enum), string_dtype);
+	if (selection_type == H5S_SEL_ALL) {
+		*first_element = 0;
+		*elements_size = 1;
 
-	hid_t dest_fallback_attribute_id = H5Acreate2(destination_root_group, "FALLBACK_METADATA", fallback_compound_type, fallback_attribute_dataspace, H5P_DEFAULT, H5P_DEFAULT);
+		for (int i = 0; i < rank; i++) {
+			*elements_size *= dims[i];
+		}
 
-	fallback_enum value = LOCAL;
-	void *buffer = malloc(sizeof(fallback_enum) + file_absolute_path_length);
-	
-	memcpy(buffer, &value, sizeof(fallback_enum));
-	memcpy(buffer + sizeof(fallback_enum), file_absolute_path, file_absolute_path_length);
+		return true;
+	}
 
-	herr_t write_return_val = H5Awrite(dest_fallback_attribute_id, fallback_compound_type, buffer);
-	
-    if (write_return_val < 0) {
-		if (DEBUG)
-			fprintf(log_ptr, "Error writing attribute %ld %ld\n", dest_fallback_attribute_id, fallback_compound_type);
-		return write_return_val;
+	if (selection_type != H5S_SEL_HYPERSLABS || H5Sget_select_hyper_nblocks(space_id) != 1 || H5Sget_select_bounds(space_id, start, end) < 0) {
+		return false;
+	}
+
+	bool is_spanning = false;
+	*first_element = 0;
+	*elements_size = 1;
+
+	for (int i = 0; i < rank; i++) {
+		hsize_t block_size = end[i] - start[i] + 1;
+
+		// Once a dimension selects more than one element, the following ones must be selected whole
+		if (is_spanning && block_size != dims[i]) {
+			return false;
+		}
+
+		is_spanning = is_spanning || block_size > 1;
+		*first_element = *first_element * dims[i] + start[i];
+		*elements_size *= block_size;
+	}
+
+	return true;
+}
+
+/*
+	Serve a read of a carved dataset with pread, bypassing the library, when the dataset is in the direct read index of its carved file,
+	the memory type is the type of the dataset and both selections are contiguous runs of elements.
+	Returns 0 if the read was served, and 1 if it has to go through the library.
+*/
+herr_t read_dataset_directly(hid_t dataset_id, hid_t mem_type_id, hid_t mem_space_id, hid_t file_space_id, hid_t dxpl_id, void *buf) {
+	// Data transforms alter the values read, and are left to the library
+	if (direct_read_indexes_size == 0 || (dxpl_id != H5P_DEFAULT && H5Pget_data_transform(dxpl_id, NULL, 0) > 0)) {
+		return 1;
+	}
+
+	carved_dataset_key key;
+
+	if (get_carved_dataset_key(dataset_id, &key) < 0) {
+		return 1;
+	}
+
+	direct_read_index *index = get_fileno_map(&direct_read_index_filenos, key.fileno);
+	direct_read_entry probe = { .token = key.token };
+	direct_read_entry *entry = index == NULL ? NULL : bsearch(&probe, index->entries, index->entries_size, sizeof(direct_read_entry), compare_direct_read_entries);
+
+	if (entry == NULL) {
+		return 1;
+	}
+
+	if (entry->state == DIRECT_READ_UNCHECKED) {
+		entry->state = is_direct_read_entry_valid(dataset_id, entry) ? DIRECT_READ_VALID : DIRECT_READ_INVALID;
+	}
+
+	if (entry->state != DIRECT_READ_VALID || H5Tequal(mem_type_id, entry->type_id) <= 0) {
+		return 1;
+	}
+
+	// Element positions are computed in the file dataspace, whose extent must still be the one indexed
+	hid_t data_space = file_space_id == H5S_ALL ? H5Dget_space(dataset_id) : file_space_id;
+	bool is_extent_indexed = data_space >= 0 && is_direct_read_extent(data_space, entry);
+
+	if (file_space_id == H5S_ALL && data_space >= 0)
+		H5Sclose(data_space);
+
+	if (!is_extent_indexed) {
+		return 1;
+	}
+
+	// The selections of H5S_ALL are the whole dataset, and for the memory, the file selection in a buffer shaped like the dataset
+	hsize_t file_first_element = 0, file_elements_size = 1, mem_first_element, mem_elements_size;
+
+	if (file_space_id == H5S_ALL) {
+		for (int i = 0; i < entry->rank; i++) {
+			file_elements_size *= entry->dims[i];
+		}
+	} else if (!get_contiguous_selection(file_space_id, &file_first_element, &file_elements_size)) {
+		return 1;
+	}
+
+	if (mem_space_id == H5S_ALL) {
+		mem_first_element = file_first_element;
+		mem_elements_size = file_elements_size;
+	} else if (!get_contiguous_selection(mem_space_id, &mem_first_element, &mem_elements_size)) {
+		return 1;
+	}
+
+	size_t length = file_elements_size * entry->element_size;
+	off_t file_offset = (off_t)(entry->offset + file_first_element * entry->element_size);
+	char *dest = (char *)buf + mem_first_element * entry->element_size;
+
+	if (mem_elements_size != file_elements_size || (haddr_t)file_offset + length > entry->offset + entry->storage_size) {
+		return 1;
+	}
+
+	size_t bytes_read = 0;
+
+	while (bytes_read < length) {
+		ssize_t read_return_val = pread(index->fd, dest + bytes_read, length - bytes_read, file_offset + bytes_read);
+
+		if (read_return_val <= 0) {
+			if (DEBUG)
+				fprintf(log_ptr, "Error reading carved dataset %ld directly, reading it through the library: %s\n", dataset_id, strerror(errno));
+			entry->state = DIRECT_READ_INVALID;
+			return 1;
+		}
+
+		bytes_read += read_return_val;
 	}
 
 	return 0;
 }
+
+// Close the carved files and release the entries of the direct read indexes. Called from H5_term_library.
+void release_direct_read_indexes(void) {
+	for (size_t i = 0; i < direct_read_indexes_size; i++) {
+		release_direct_read_entries(direct_read_indexes[i]->entries, direct_read_indexes[i]->entries_size);
+		close(direct_read_indexes[i]->fd);
+		free(direct_read_indexes[i]->carved_path);
+		free(direct_read_indexes[i]);
+	}
+
+	free(direct_read_indexes);
+	direct_read_indexes = NULL;
+	direct_read_indexes_size = 0;
+	release_fileno_map(&direct_read_index_filenos);
+}
@@ -34,13 +34,23 @@
 #ifndef H5CARVE_HELPER_FUNCTIONS_H
 #define H5CARVE_HELPER_FUNCTIONS_H
 
+void *attribute_arena_alloc(size_t size);
+void release_attribute_arena(void);
+void log_attribute_arena_peak(void);
+size_t open_attribute_scope(void);
+hid_t scope_attribute_handle(hid_t id);
+void close_attribute_scope(size_t scope);
 hobj_ref_t *copy_reference_object(hobj_ref_t *source_ref, int num_elements, hid_t src_attribute_id);
-herr_t copy_compound_type(hid_t src_id, void *src_buffer, void *dest_buffer, hid_t data_type, int num_elements, int num_members, size_t starting_offset);
+void release_reference_memo(void);
+herr_t copy_type_elements(hid_t src_id, void *src_buffer, void *dest_buffer, hid_t data_type, hsize_t num_elements);
+void release_type_copy_plans(void);
 hvl_t *copy_vlen_type(hid_t src_attribute_id, hid_t data_type, hvl_t *src_data, int num_elements);
 herr_t copy_attributes(hid_t loc_id, const char *name, const H5L_info_t *linfo, void *opdata);
 int copy_object_attributes(hid_t loc_id, const char *name, const H5A_info_t *ainfo, void *opdata);
 herr_t delete_attributes(hid_t loc_id, const char *name, const H5A_info_t *ainfo, void *opdata);
 bool is_already_recorded(const char *filename);
+herr_t create_empty_dataset(hid_t dataset_id, hid_t dest_loc_id, const char *name);
+herr_t build_skeleton(hid_t src_file, hid_t carved_file);
 herr_t shallow_copy_object(hid_t loc_id, const char *name, const H5L_info_t *linfo, void *opdata);
 char *get_carved_filename(const char *filename, char *is_netcdf4, char *use_carved);
 bool does_dataset_exist(hid_t dataset_id);
@@ -49,7 +59,70 @@ herr_t create_fallback_metadata(const char *filename, hid_t destination_root_gro
 hsize_t get_total_num_elems_and_base_type(hid_t type_id, hid_t *base_type_id);
 // void create_array_of_references(hid_t src_attribute_id, hid_t dest_attribute_id, hid_t array_dtype_copy, H5R_ref_t *src_data, H5R_ref_t *head_dest_data, H5R_ref_t *current_dest_data, int total_elements);
 H5R_ref_t* copy_reference_object_H5R_ref_t(hid_t src_attribute_id, hid_t dest_file_id, hid_t attribute_data_type, size_t total_elements, H5R_ref_t *src_data);
-void *copy_array(hid_t src_attribute_id, void *src_data, hid_t attribute_data_type, hid_t base_type_id, int total_elements);
+carved_file_handle *get_file_handle(const char *filename);
+carved_file_handle *acquire_file_handle(const char *filename, hid_t file_id);
+void track_application_file(carved_file_handle *handle, hid_t file_id);
+void release_application_file(hid_t file_id);
+void record_dataset_carved(carved_file_handle *handle, const char *dataset_name);
+void release_file_handles(void);
+herr_t copy_dataset_object(hid_t src_file, hid_t carved_file, const char *dataset_name);
+herr_t mark_dataset_copied(hid_t carved_file);
+herr_t clear_carving_status(hid_t carved_dataset_id);
+bool is_lossless_conversion(hid_t file_type, hid_t mem_type);
+herr_t carve_dataset_from_buffer(hid_t dataset_id, hid_t carved_file, const char *dataset_name, hid_t mem_type_id, hid_t mem_space_id, hid_t file_space_id, hid_t dxpl_id, const void *buf);
+bool get_coverage_block_dims(hid_t data_type, hid_t data_space, hsize_t *block_dims);
+hid_t get_skeleton_create_plist(hid_t dataset_id, hid_t data_type, hid_t data_space);
+herr_t carve_dataset_contiguous(carved_file_handle *handle, const char *dataset_name);
+herr_t carve_dataset_chunks(hid_t src_file, hid_t carved_file, const char *dataset_name);
+herr_t carve_dataset_selection(hid_t dataset_id, hid_t carved_file, const char *dataset_name, hid_t file_space_id, bool *is_fully_carved);
+bool is_partially_carved(hid_t carved_dataset_id);
+bool is_selection_carved(hid_t carved_dataset_id, hid_t file_space_id);
+herr_t carve_dataset(carved_file_handle *handle, hid_t dataset_id, const char *dataset_name, hid_t mem_type_id, hid_t mem_space_id, hid_t file_space_id, hid_t dxpl_id, const void *buf, bool *is_fully_carved);
+void lock_carving_state(void);
+void unlock_carving_state(void);
+bool enqueue_carve_job(carved_file_handle *handle, const char *dataset_name, hid_t file_space_id);
+void drain_carve_queue(void);
+hid_t create_skeleton_file(hid_t src_file, const char *carved_filename);
+hid_t open_carved_file(const char *carved_filename, unsigned flags, hid_t fapl_id);
+hid_t create_carved_file(hid_t src_file, const char *carved_filename);
+void record_deferred_dataset(const char *filename, const char *dataset_name, int rank, const hsize_t *start, const hsize_t *end);
+void carve_deferred_datasets(void);
+int get_selection_bounds(hid_t file_space_id, hsize_t *start, hsize_t *end);
+void copy_carved_file_attributes(carved_file_handle *handle);
+bool open_carve_trace(const char *trace_filename);
+void close_carve_trace(void);
+void append_trace_file(const char *filename);
+void append_trace_dataset(const char *filename, const char *dataset_name, int rank, const hsize_t *start, const hsize_t *end);
+uint64_t get_trace_file_id(const char *filename);
+herr_t ensure_skeleton_path(carved_file_handle *handle, const char *object_path);
+herr_t add_object_to_skeleton(hid_t object_id);
+herr_t complete_skeleton(carved_file_handle *handle);
+void create_carving_manifest(hid_t carved_file);
+herr_t load_carving_manifest(hid_t carved_file);
+herr_t write_carving_manifest(hid_t carved_file);
+herr_t close_carving_manifest(hid_t carved_file);
+bool add_empty_dataset_to_manifest(hid_t carved_dataset_id);
+void mark_dataset_carved_in_manifest(unsigned long fileno, const H5O_token_t *token);
+int get_manifest_status(hid_t carved_dataset_id);
+int get_manifest_attributes_pending(hid_t carved_file);
+bool set_manifest_attributes_pending(hid_t carved_file, bool are_attributes_pending);
+void set_manifest_skeleton_complete(hid_t carved_file);
+bool is_skeleton_incomplete(hid_t carved_loc_id);
+void register_original_file(hid_t carved_file, const char *filename, unsigned flags, hid_t fapl_id);
+hid_t get_original_file(hid_t carved_loc_id);
+hid_t get_original_location(hid_t carved_loc_id);
+void release_original_files(void);
+void record_fallback_hit(hid_t original_object_id);
+void finish_dataset_promotions(void);
+void record_attribute_access(hid_t loc_id, const char *attribute_name);
+void copy_accessed_attributes(carved_file_handle *handle);
+herr_t get_carved_dataset_key(hid_t dataset_id, carved_dataset_key *key);
+bool is_in_carved_set(const carved_dataset_key *key);
+void add_to_carved_set(const carved_dataset_key *key);
+void write_direct_read_index(carved_file_handle *handle);
+void load_direct_read_index(hid_t carved_file_id, const char *carved_filename);
+herr_t read_dataset_directly(hid_t dataset_id, hid_t mem_type_id, hid_t mem_space_id, hid_t file_space_id, hid_t dxpl_id, void *buf);
+void release_direct_read_indexes(void);
 
 typedef enum {
     LOCAL,
@@ -0,0 +1,374 @@
+/*
+ * HDF5/netCDF4 Data Carving
+ *
+ * Copyright (c) 2024-2025, SRI International
+ *
+ *  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of SRI International nor the names of its contributors may
+ *   be used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+	Builds carved files from the access traces written by the preload library with CARVE_TRACE set.
+	Usage: h5carve_materialize [-j jobs] trace...
+	The files in the traces are split across jobs worker processes, each building the skeleton of its files
+	and carving the datasets recorded for them in the same way as in deferred mode.
+*/
+
+#define _GNU_SOURCE
+#include "hdf5.h"
+#include "netcdf.h"
+#include "H5carve.h"
+#include "H5carve_helper_functions.h"
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+// The helper functions call the original HDF5 functions through these pointers. There is nothing to interpose on in the tool.
+herr_t (*original_H5Dread)(hid_t, hid_t, hid_t, hid_t, hid_t, void*);
+hid_t (*original_H5Fopen)(const char *, unsigned, hid_t);
+herr_t (*original_H5Fclose)(hid_t);
+hid_t (*original_H5Oopen)(hid_t, const char *, hid_t);
+herr_t (*original_H5Aread)(hid_t, hid_t, void *);
+herr_t (*original_H5Aiterate2)(hid_t, H5_index_t, H5_iter_order_t, hsize_t *, H5A_operator2_t, void *);
+herr_t (*original_H5Aiterate_by_name)(hid_t, const char *, H5_index_t, H5_iter_order_t, hsize_t *, H5A_operator2_t, void *, hid_t);
+int (*original_nc_open)(const char *path, int omode, int *ncidp);
+void (*original_H5_term_library)(void);
+
+// Global variables shared with the helper functions
+char *use_carved;
+hid_t src_file_id;
+hid_t dest_file_id;
+char *is_netcdf4;
+char **files_opened;
+int files_opened_current_size;
+FILE *log_ptr;
+char *DEBUG;
+int flush_interval;
+char *carved_directory;
+bool is_repeat_mode;
+bool is_passthrough_mode;
+bool is_partial_carving_mode;
+hsize_t partial_carving_block_size;
+size_t chunk_buffer_size;
+bool is_async_carving_mode;
+bool is_deferred_carving_mode;
+bool is_tracing_mode;
+bool is_lazy_skeleton_mode;
+bool is_skeleton_completed_at_exit;
+bool is_skeleton_template_mode;
+bool is_skeleton_storage_deferred;
+hsize_t carved_file_page_size;
+bool is_free_space_persistent;
+hsize_t core_file_size_limit;
+bool is_direct_read_mode;
+int promotion_threshold;
+bool is_copying_all_attributes;
+carved_file_handle **file_handle_pool;
+int file_handle_pool_current_size;
+
+// Dataset record of a trace. The name points into the mapped trace.
+typedef struct {
+	const char *dataset_name;
+	int rank;
+	hsize_t start[H5S_MAX_RANK];
+	hsize_t end[H5S_MAX_RANK];
+} traced_dataset;
+
+// Original file of a trace with the datasets recorded for it
+typedef struct {
+	uint64_t file_id;
+	const char *filename;
+	traced_dataset *datasets;
+	size_t datasets_size;
+} traced_file;
+
+static traced_file *traced_files;
+static size_t traced_files_size;
+
+static traced_file *get_traced_file(uint64_t file_id) {
+	for (size_t i = 0; i < traced_files_size; i++) {
+		if (traced_files[i].file_id == file_id) {
+			return &traced_files[i];
+		}
+	}
+
+	traced_files = realloc(traced_files, (traced_files_size + 1) * sizeof(traced_file));
+	traced_file *file = &traced_files[traced_files_size];
+	file->file_id = file_id;
+	file->filename = NULL;
+	file->datasets = NULL;
+	file->datasets_size = 0;
+	traced_files_size += 1;
+
+	return file;
+}
+
+// Map a trace and collect its records. The trace stays mapped until the process exits.
+static int load_trace(const char *trace_filename) {
+	int fd = open(trace_filename, O_RDONLY);
+	struct stat trace_stat;
+
+	if (fd < 0 || fstat(fd, &trace_stat) < 0) {
+		fprintf(stderr, "Error opening trace %s\n", trace_filename);
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+
+	if (trace_stat.st_size == 0) {
+		close(fd);
+		return 0;
+	}
+
+	const char *trace = mmap(NULL, trace_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (trace == MAP_FAILED) {
+		fprintf(stderr, "Error mapping trace %s\n", trace_filename);
+		return -1;
+	}
+
+	size_t position = 0;
+
+	while (position + sizeof(carve_trace_record) <= (size_t)trace_stat.st_size) {
+		const carve_trace_record *record = (const carve_trace_record *)(trace + position);
+		size_t payload_length = 2 * record->rank * sizeof(uint64_t) + record->name_length;
+
+		// A truncated or corrupt record ends the trace, e.g. when a traced process was killed while appending
+		if (record->magic != CARVE_TRACE_MAGIC || record->rank > H5S_MAX_RANK || record->name_length == 0 ||
+			record->record_length < sizeof(carve_trace_record) + payload_length || position + record->record_length > (size_t)trace_stat.st_size) {
+			fprintf(stderr, "Ignoring trace %s after offset %zu, invalid record\n", trace_filename, position);
+			break;
+		}
+
+		const uint64_t *bounds = (const uint64_t *)(trace + position + sizeof(carve_trace_record));
+		const char *name = (const char *)(bounds + 2 * record->rank);
+
+		if (name[record->name_length - 1] != '\0') {
+			fprintf(stderr, "Ignoring trace %s after offset %zu, invalid record\n", trace_filename, position);
+			break;
+		}
+
+		traced_file *file = get_traced_file(record->file_id);
+
+		if (record->kind == CARVE_TRACE_FILE) {
+			file->filename = name;
+		} else if (record->kind == CARVE_TRACE_DATASET) {
+			file->datasets = realloc(file->datasets, (file->datasets_size + 1) * sizeof(traced_dataset));
+			traced_dataset *dataset = &file->datasets[file->datasets_size];
+			dataset->dataset_name = name;
+			dataset->rank = record->rank;
+
+			for (int i = 0; i < record->rank; i++) {
+				dataset->start[i] = bounds[i];
+				dataset->end[i] = bounds[record->rank + i];
+			}
+
+			file->datasets_size += 1;
+		}
+
+		position += record->record_length;
+	}
+
+	return 0;
+}
+
+// Build the carved files of the traced files assigned to a worker
+static int materialize_files(int worker, int num_workers) {
+	for (size_t i = worker; i < traced_files_size; i += num_workers) {
+		traced_file *file = &traced_files[i];
+
+		if (file->filename == NULL) {
+			fprintf(stderr, "Skipping %zu datasets of a file missing from the traces\n", file->datasets_size);
+			continue;
+		}
+
+		files_opened = realloc(files_opened, (files_opened_current_size + 1) * sizeof(char *));
+		files_opened[files_opened_current_size] = malloc(strlen(file->filename) + 1);
+		strcpy(files_opened[files_opened_current_size], file->filename);
+		files_opened_current_size += 1;
+
+		for (size_t j = 0; j < file->datasets_size; j++) {
+			traced_dataset *dataset = &file->datasets[j];
+			record_deferred_dataset(file->filename, dataset->dataset_name, dataset->rank, dataset->start, dataset->end);
+		}
+	}
+
+	carve_deferred_datasets();
+
+	int return_val = 0;
+
+	for (int i = 0; i < files_opened_current_size; i++) {
+		carved_file_handle *handle = get_file_handle(files_opened[i]);
+
+		if (handle == NULL) {
+			fprintf(stderr, "Error building carved file of %s\n", files_opened[i]);
+			return_val = -1;
+		} else {
+			if (is_skeleton_completed_at_exit) {
+				complete_skeleton(handle);
+			}
+
+			copy_carved_file_attributes(handle);
+			printf("%s\n", handle->carved_filename);
+		}
+
+		free(files_opened[i]);
+	}
+
+	free(files_opened);
+	files_opened = NULL;
+	files_opened_current_size = 0;
+
+	release_file_handles();
+	fflush(stdout);
+
+	return return_val;
+}
+
+int main(int argc, char **argv) {
+	long num_workers = sysconf(_SC_NPROCESSORS_ONLN);
+	int option;
+
+	while ((option = getopt(argc, argv, "j:")) != -1) {
+		if (option == 'j') {
+			num_workers = strtol(optarg, NULL, 10);
+		} else {
+			fprintf(stderr, "Usage: %s [-j jobs] trace...\n", argv[0]);
+			return 2;
+		}
+	}
+
+	if (optind == argc || num_workers < 1) {
+		fprintf(stderr, "Usage: %s [-j jobs] trace...\n", argv[0]);
+		return 2;
+	}
+
+	// Carving options are read from the same environment variables as in the preload library
+	DEBUG = getenv("DEBUG");
+
+	if (DEBUG) {
+		log_ptr = fopen("log", "w");
+	}
+
+	is_netcdf4 = getenv("NETCDF4");
+	carved_directory = getenv("CARVED_DIRECTORY");
+
+	char *partial_env = getenv("CARVE_PARTIAL");
+	is_partial_carving_mode = partial_env != NULL && strcmp(partial_env, "true") == 0;
+
+	char *partial_block_size_env = getenv("CARVE_PARTIAL_BLOCK_SIZE");
+	partial_carving_block_size = partial_block_size_env == NULL ? 1024 * 1024 : strtoull(partial_block_size_env, NULL, 10);
+
+	char *chunk_buffer_size_env = getenv("CARVE_CHUNK_BUFFER_SIZE");
+	chunk_buffer_size = chunk_buffer_size_env == NULL ? 64 * 1024 * 1024 : strtoull(chunk_buffer_size_env, NULL, 10);
+
+	char *lazy_skeleton_env = getenv("CARVE_LAZY_SKELETON");
+	is_skeleton_completed_at_exit = lazy_skeleton_env != NULL && strcmp(lazy_skeleton_env, "complete") == 0;
+	is_lazy_skeleton_mode = is_skeleton_completed_at_exit || (lazy_skeleton_env != NULL && strcmp(lazy_skeleton_env, "true") == 0);
+
+	char *skeleton_templates_env = getenv("CARVE_SKELETON_TEMPLATES");
+	is_skeleton_template_mode = skeleton_templates_env != NULL && strcmp(skeleton_templates_env, "true") == 0;
+
+	char *skeleton_no_alloc_env = getenv("CARVE_SKELETON_NO_ALLOC");
+	is_skeleton_storage_deferred = skeleton_no_alloc_env != NULL && strcmp(skeleton_no_alloc_env, "true") == 0;
+
+	char *page_size_env = getenv("CARVE_PAGE_SIZE");
+	carved_file_page_size = page_size_env == NULL ? 0 : strtoull(page_size_env, NULL, 10);
+
+	char *persist_free_space_env = getenv("CARVE_PERSIST_FREE_SPACE");
+	is_free_space_persistent = persist_free_space_env != NULL && strcmp(persist_free_space_env, "true") == 0;
+
+	char *direct_read_env = getenv("CARVE_DIRECT_READ");
+	is_direct_read_mode = direct_read_env != NULL && strcmp(direct_read_env, "true") == 0;
+
+	// There is no application whose attribute accesses could be recorded, so every attribute is copied
+	is_copying_all_attributes = true;
+
+	original_H5Dread = H5Dread;
+	original_H5Fopen = H5Fopen;
+	original_H5Fclose = H5Fclose;
+	original_H5Oopen = H5Oopen;
+	original_H5Aread = H5Aread;
+	original_H5Aiterate2 = H5Aiterate2;
+	original_H5Aiterate_by_name = H5Aiterate_by_name;
+
+	for (int i = optind; i < argc; i++) {
+		if (load_trace(argv[i]) < 0) {
+			return 1;
+		}
+	}
+
+	if ((size_t)num_workers > traced_files_size) {
+		num_workers = traced_files_size;
+	}
+
+	if (num_workers <= 1) {
+		return materialize_files(0, 1) < 0 ? 1 : 0;
+	}
+
+	int return_val = 0;
+
+	// Each worker is a separate process with its own HDF5 library state, so files are carved in parallel without a thread-safe build
+	for (int worker = 0; worker < num_workers; worker++) {
+		pid_t pid = fork();
+
+		if (pid < 0) {
+			fprintf(stderr, "Error starting worker %d\n", worker);
+			return_val = 1;
+			break;
+		}
+
+		if (pid == 0) {
+			// The debug log is shared with the parent, workers log to their own
+			if (DEBUG) {
+				char log_filename[32];
+				snprintf(log_filename, sizeof(log_filename), "log.%d", worker);
+				log_ptr = fopen(log_filename, "w");
+			}
+
+			int worker_return_val = materialize_files(worker, num_workers);
+			H5close();
+			_exit(worker_return_val < 0 ? 1 : 0);
+		}
+	}
+
+	int status;
+
+	while (wait(&status) > 0) {
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			return_val = 1;
+		}
+	}
+
+	return return_val;
+}
@@ -0,0 +1,189 @@
+#!/usr/bin/env python3
+"""
+Benchmarks of the carving library.
+
+Each benchmark builds a synthetic HDF5 file once, then runs its workload in a child process for every --preload given,
+with LD_PRELOAD set to that value and a fresh CARVED_DIRECTORY, so that builds of the library before and after a change
+are measured on the same file. An empty --preload runs the workload without carving.
+
+    python3 benchmarks/carve_benchmark.py reads \
+        --preload "before/h5carve.so $HDF5_CARVE_LIBRARY/lib/libhdf5.so" \
+        --preload "after/h5carve.so $HDF5_CARVE_LIBRARY/lib/libhdf5.so"
+
+Other environment variables, such as CARVE_ASYNC, are passed to the workload as they are set.
+"""
+
+import argparse
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+import h5py
+import numpy as np
+
+
+# Benchmark "reads": many small datasets, each read once, which is the cost the handle pool removes from every H5Dread
+
+def build_reads_file(filename, args):
+    with h5py.File(filename, "w") as f:
+        group = f.create_group("data")
+
+        for i in range(args.datasets):
+            group.create_dataset("d%06d" % i, data=np.arange(args.elements, dtype=np.float64))
+
+
+def run_reads(filename, args):
+    with h5py.File(filename, "r") as f:
+        datasets = [f["data"][name] for name in sorted(f["data"])]
+
+        start = time.perf_counter()
+
+        for dataset in datasets:
+            dataset[...]
+
+        elapsed = time.perf_counter() - start
+
+    return {"reads": len(datasets), "read_us": elapsed / len(datasets) * 1e6}
+
+
+# Benchmark "skeleton": a deep hierarchy of groups, each with a dataset and attributes, opened once, which is the cost of building its skeleton
+
+def build_skeleton_file(filename, args):
+    with h5py.File(filename, "w") as f:
+        def add_level(group, depth):
+            group.attrs["depth"] = depth
+            group.attrs["label"] = "level %d" % depth
+            group.create_dataset("values", data=np.arange(args.elements, dtype=np.float64)).attrs["units"] = "m"
+
+            if depth < args.depth:
+                for i in range(args.fanout):
+                    add_level(group.create_group("g%d" % i), depth + 1)
+
+        add_level(f, 0)
+
+
+def run_skeleton(filename, args):
+    start = time.perf_counter()
+
+    with h5py.File(filename, "r") as f:
+        opened = time.perf_counter()
+        f["/".join(["g0"] * args.depth + ["values"])][...]
+
+    groups = sum(args.fanout ** depth for depth in range(args.depth + 1))
+
+    return {"groups": groups, "open_ms": (opened - start) * 1e3}
+
+
+# Benchmark "attributes": many objects with variable-length, compound and reference attributes, which is the memory used to copy them
+
+def build_attributes_file(filename, args):
+    compound_type = np.dtype([("index", np.int64), ("scale", np.float64), ("target", h5py.ref_dtype)])
+    vlen_type = h5py.vlen_dtype(np.int32)
+
+    with h5py.File(filename, "w") as f:
+        target = f.create_dataset("target", data=np.arange(args.elements, dtype=np.float64))
+        group = f.create_group("objects")
+
+        sequence = np.empty(args.elements, dtype=object)
+
+        for j in range(args.elements):
+            sequence[j] = np.arange(j + 1, dtype=np.int32)
+
+        for i in range(args.objects):
+            dataset = group.create_dataset("d%06d" % i, data=np.arange(args.elements, dtype=np.float64))
+            dataset.attrs["label"] = "object %d" % i
+            dataset.attrs.create("sequence", sequence, dtype=vlen_type)
+            dataset.attrs.create("records", np.array([(j, j * 0.5, target.ref) for j in range(args.elements)], dtype=compound_type))
+            dataset.attrs.create("targets", np.array([target.ref, dataset.ref], dtype=h5py.ref_dtype))
+
+
+def run_attributes(filename, args):
+    start = time.perf_counter()
+
+    with h5py.File(filename, "r") as f:
+        opened = time.perf_counter()
+        f["objects"][sorted(f["objects"])[0]][...]
+
+    return {"objects": args.objects, "open_ms": (opened - start) * 1e3}
+
+
+BENCHMARKS = {
+    "attributes": (build_attributes_file, run_attributes),
+    "reads": (build_reads_file, run_reads),
+    "skeleton": (build_skeleton_file, run_skeleton),
+}
+
+
+def run_child(benchmark, filename, args):
+    results = BENCHMARKS[benchmark][1](filename, args)
+    print(" ".join("%s=%s" % item for item in results.items()), flush=True)
+
+
+def run_workload(benchmark, filename, preload, args):
+    carved_directory = tempfile.mkdtemp(prefix="carve_benchmark_")
+    # Carved filenames are the directory and the basename of the original file concatenated
+    env = dict(os.environ, CARVED_DIRECTORY=carved_directory + os.sep)
+
+    # Attributes are only all copied, with the skeleton, under this policy
+    if benchmark == "attributes":
+        env.setdefault("CARVE_ATTRIBUTES", "all")
+
+    if preload:
+        env["LD_PRELOAD"] = preload
+    else:
+        env.pop("LD_PRELOAD", None)
+
+    command = [sys.executable, os.path.abspath(__file__)] + sys.argv[1:] + ["--child", filename]
+    start = time.perf_counter()
+    child = subprocess.Popen(command, env=env, stdout=subprocess.PIPE, text=True)
+    output = child.stdout.read()
+
+    # wait4 reports the peak resident set size of this child alone
+    _, status, usage = os.wait4(child.pid, 0)
+    wall = time.perf_counter() - start
+
+    shutil.rmtree(carved_directory, ignore_errors=True)
+
+    if status != 0:
+        raise SystemExit("workload failed with LD_PRELOAD=%r" % preload)
+
+    return output.strip(), wall, usage.ru_maxrss
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("benchmark", choices=sorted(BENCHMARKS))
+    parser.add_argument("--preload", action="append", default=[], help="LD_PRELOAD of a run, may be repeated")
+    parser.add_argument("--runs", type=int, default=3, help="runs per preload, the fastest is reported")
+    parser.add_argument("--datasets", type=int, default=2000, help="reads: number of datasets")
+    parser.add_argument("--elements", type=int, default=64, help="reads, skeleton, attributes: elements per dataset and attribute")
+    parser.add_argument("--objects", type=int, default=2000, help="attributes: number of datasets with attributes")
+    parser.add_argument("--depth", type=int, default=6, help="skeleton: levels of groups below the root")
+    parser.add_argument("--fanout", type=int, default=4, help="skeleton: subgroups per group")
+    parser.add_argument("--child", metavar="FILE", help=argparse.SUPPRESS)
+    args = parser.parse_args()
+
+    # The workload itself, run with the arguments of the parent
+    if args.child is not None:
+        run_child(args.benchmark, args.child, args)
+        return
+
+    work_directory = tempfile.mkdtemp(prefix="carve_benchmark_")
+    filename = os.path.join(work_directory, "%s.h5" % args.benchmark)
+
+    try:
+        BENCHMARKS[args.benchmark][0](filename, args)
+
+        for preload in args.preload or [""]:
+            runs = [run_workload(args.benchmark, filename, preload, args) for _ in range(args.runs)]
+            output, wall, max_rss = min(runs, key=lambda run: run[1])
+            print("%-60s wall=%.3fs max_rss=%dKiB %s" % (preload or "(no carving)", wall, max_rss, output))
+    finally:
+        shutil.rmtree(work_directory, ignore_errors=True)
+
+
+if __name__ == "__main__":
+    main()